@@ -0,0 +1,635 @@
+#include "Config.h"
+#include "APU.h"
+#include <cstring>
+#include <cmath>
+
+#define NR10 0xFF10
+#define NR30 0xFF1A
+#define NR32 0xFF1C
+#define NR43 0xFF22
+#define NR50 0xFF24
+#define NR51 0xFF25
+#define NR52 0xFF26
+#define WAVE_RAM 0xFF30
+
+// cpu cycles between frame sequencer steps (512hz)
+#define SEQUENCER_PERIOD 8192
+
+static const BYTE DUTY[4][8] = {
+    { 0, 0, 0, 0, 0, 0, 0, 1 },
+    { 1, 0, 0, 0, 0, 0, 0, 1 },
+    { 1, 0, 0, 0, 0, 1, 1, 1 },
+    { 0, 1, 1, 1, 1, 1, 1, 0 }
+};
+
+/**
+ * Band-limited step kernel. Each phase holds the differences of a windowed
+ * sinc step placed at that fraction of a sample, summing to exactly 1 << 15
+ */
+struct BlepKernel {
+    int taps[APU_BLEP_PHASES][APU_BLEP_WIDTH];
+
+    BlepKernel() {
+        const double pi = 3.14159265358979323846;
+        const double cutoff = 0.9;
+
+        for(int phase = 0; phase < APU_BLEP_PHASES; phase++) {
+            double impulse[APU_BLEP_WIDTH];
+            double sum = 0;
+
+            for(int i = 0; i < APU_BLEP_WIDTH; i++) {
+                double x = i - (APU_BLEP_WIDTH / 2) - ((double)phase / APU_BLEP_PHASES) + 1;
+                double sinc = (x == 0) ? 1.0 : sin(pi * cutoff * x) / (pi * cutoff * x);
+                double w = (x + (APU_BLEP_WIDTH / 2)) / APU_BLEP_WIDTH;
+                double window = 0.42 - 0.5 * cos(2 * pi * w) + 0.08 * cos(4 * pi * w);
+                impulse[i] = sinc * window;
+                sum += impulse[i];
+            }
+
+            // round to fixed point and put the error on the centre tap
+            int total = 0;
+            for(int i = 0; i < APU_BLEP_WIDTH; i++) {
+                taps[phase][i] = (int)floor(impulse[i] / sum * 32768 + 0.5);
+                total += taps[phase][i];
+            }
+            taps[phase][APU_BLEP_WIDTH / 2] += 32768 - total;
+        }
+    }
+};
+
+static const BlepKernel s_Kernel;
+
+APU::APU() {
+    Reset();
+}
+
+/**
+ * Power up state, registers as the boot rom leaves them with every channel quiet
+ */
+void APU::Reset() {
+    static const BYTE powerUp[0x17] = {
+        0x80, 0xBF, 0xF3, 0x00, 0xBF,
+        0x00, 0x3F, 0x00, 0x00, 0xBF,
+        0x7F, 0xFF, 0x9F, 0x00, 0xBF,
+        0x00, 0xFF, 0x00, 0x00, 0xBF,
+        0x77, 0xF3, 0xF1
+    };
+
+    memset(m_Registers, 0, sizeof(m_Registers));
+    memcpy(m_Registers, powerUp, sizeof(powerUp));
+    memset(m_Channels, 0, sizeof(m_Channels));
+    for(int i = SQUARE1; i <= WAVE; i++)
+        SetFrequency(i, ((m_Registers[(i * 5) + 4] & 0x7) << 8) | m_Registers[(i * 5) + 3]);
+    m_Channels[NOISE].period = 8;
+
+    m_SweepTimer = 0;
+    m_SweepShadow = 0;
+    m_SweepEnabled = false;
+    m_LFSR = 0x7FFF;
+
+    m_SequencerDelay = SEQUENCER_PERIOD;
+    m_SequencerStep = 0;
+
+    m_Time = 0;
+    m_FrameClock = 0;
+    memset(m_Level, 0, sizeof(m_Level));
+
+    m_SampleOffset = 0;
+    memset(m_Deltas, 0, sizeof(m_Deltas));
+    memset(m_Integrator, 0, sizeof(m_Integrator));
+    memset(m_HighPass, 0, sizeof(m_HighPass));
+    m_SampleCount = 0;
+}
+
+/**
+ * Register write at the given emulator clock. Sound is synthesized up to
+ * that point first so the write lands at the right time
+ */
+void APU::Write(WORD address, BYTE data, int clock) {
+    int time = CatchUp(clock);
+    if(time < m_Time)
+        time = m_Time;
+
+    RunUntil(time);
+    WriteRegister(address, data, time);
+}
+
+/**
+ * Finish the frame at the given emulator clock and turn it into samples.
+ * Returns the clock the frame ended at, which is clock 0 of the next one,
+ * the caller moves its own clock back by as much so neither keeps growing
+ */
+int APU::EndFrame(int clock) {
+    int time = CatchUp(clock);
+    if(time < m_Time)
+        time = m_Time;
+
+    FinishFrame(time);
+
+    int end = m_FrameClock + time;
+    m_FrameClock = 0;
+    return end;
+}
+
+/**
+ * Time into the frame of an emulator clock. A clock further on than the
+ * delta buffer holds ends frames early until it fits
+ */
+int APU::CatchUp(int clock) {
+    int time = clock - m_FrameClock;
+    while(time > APU_MAX_FRAME_CLOCKS) {
+        FinishFrame(APU_MAX_FRAME_CLOCKS);
+        m_FrameClock += APU_MAX_FRAME_CLOCKS;
+        time = clock - m_FrameClock;
+    }
+    return time;
+}
+
+/**
+ * Synthesize up to time and integrate everything so far into samples
+ */
+void APU::FinishFrame(int time) {
+    RunUntil(time);
+
+    int total = m_SampleOffset + time;
+    FlushSamples(total / APU_CLOCKS_PER_SAMPLE);
+    m_SampleOffset = total % APU_CLOCKS_PER_SAMPLE;
+
+    m_Time = 0;
+}
+
+/**
+ * Whether saved channel and timing values are ones the apu can run from,
+ * so a state can be checked before any of it is loaded
+ */
+bool APU::ValidState(const Channel *channels, int sequencerDelay, int time, int sampleOffset) {
+    for(int i = 0; i < 4; i++) {
+        const Channel &channel = channels[i];
+        int positions = (i == WAVE) ? 32 : 8;
+        if((channel.period <= 0) || (channel.delay < 0) || (channel.position < 0) || (channel.position >= positions))
+            return false;
+        if((channel.volume < 0) || (channel.volume > 15))
+            return false;
+    }
+
+    if((sequencerDelay <= 0) || (sequencerDelay > SEQUENCER_PERIOD))
+        return false;
+    return (time >= 0) && (time <= APU_MAX_FRAME_CLOCKS) && (sampleOffset >= 0) && (sampleOffset < APU_CLOCKS_PER_SAMPLE);
+}
+
+/**
+ * NR52 status bits for the four channels
+ */
+BYTE APU::ChannelStatus() const {
+    BYTE status = 0;
+    for(int i = 0; i < 4; i++) {
+        if(m_Channels[i].enabled)
+            status = BitSet(status, i);
+    }
+    return status;
+}
+
+int APU::SamplesAvailable() const {
+    return m_SampleCount;
+}
+
+/**
+ * Copy out up to maxSamples stereo frames, returns how many were read
+ */
+int APU::ReadSamples(short *out, int maxSamples) {
+    int count = (maxSamples < m_SampleCount) ? maxSamples : m_SampleCount;
+    memcpy(out, m_Samples, count * 2 * sizeof(short));
+    DiscardSamples(count);
+    return count;
+}
+
+/**
+ * The stereo frames not read yet, for reading in place before discarding
+ * them
+ */
+const short *APU::Samples() const {
+    return m_Samples;
+}
+
+void APU::DiscardSamples(int count) {
+    if(count > m_SampleCount)
+        count = m_SampleCount;
+    memmove(m_Samples, m_Samples + (count * 2), (m_SampleCount - count) * 2 * sizeof(short));
+    m_SampleCount -= count;
+}
+
+/**
+ * Run the channels up to time, stopping at every frame sequencer step
+ */
+void APU::RunUntil(int time) {
+    while(m_Time < time) {
+        int end = time;
+        if(end > m_Time + m_SequencerDelay)
+            end = m_Time + m_SequencerDelay;
+
+        RunSquare(SQUARE1, m_Time, end);
+        RunSquare(SQUARE2, m_Time, end);
+        RunWave(m_Time, end);
+        RunNoise(m_Time, end);
+
+        m_SequencerDelay -= end - m_Time;
+        m_Time = end;
+
+        if(m_SequencerDelay == 0) {
+            ClockSequencer(end);
+            m_SequencerDelay = SEQUENCER_PERIOD;
+        }
+    }
+}
+
+/**
+ * Pulse channels step through the 8 step duty pattern
+ */
+void APU::RunSquare(int index, int start, int end) {
+    Channel &channel = m_Channels[index];
+    int time = start + channel.delay;
+
+    if(!channel.enabled || (channel.volume == 0)) {
+        // silent, just keep the phase moving
+        if(time < end) {
+            int ticks = ((end - time) + channel.period - 1) / channel.period;
+            channel.position = (channel.position + ticks) & 7;
+            time += ticks * channel.period;
+        }
+    } else {
+        while(time < end) {
+            channel.position = (channel.position + 1) & 7;
+            SetOutput(index, time);
+            time += channel.period;
+        }
+    }
+
+    channel.delay = time - end;
+}
+
+/**
+ * Wave channel steps through the 32 samples of wave ram
+ */
+void APU::RunWave(int start, int end) {
+    Channel &channel = m_Channels[WAVE];
+    int time = start + channel.delay;
+
+    if(!channel.enabled) {
+        if(time < end) {
+            int ticks = ((end - time) + channel.period - 1) / channel.period;
+            channel.position = (channel.position + ticks) & 31;
+            time += ticks * channel.period;
+        }
+    } else {
+        while(time < end) {
+            channel.position = (channel.position + 1) & 31;
+            SetOutput(WAVE, time);
+            time += channel.period;
+        }
+    }
+
+    channel.delay = time - end;
+}
+
+/**
+ * Noise channel clocks the linear feedback shift register
+ */
+void APU::RunNoise(int start, int end) {
+    Channel &channel = m_Channels[NOISE];
+    int time = start + channel.delay;
+    bool narrow = TestBit(Register(NR43), 3);
+
+    if(!channel.enabled) {
+        // the shift register is reloaded on trigger so it can stand still
+        if(time < end)
+            time += (((end - time) + channel.period - 1) / channel.period) * channel.period;
+    } else {
+        int offset = m_SampleOffset;
+        int lfsr = m_LFSR;
+        while(time < end) {
+            int feedback = (lfsr ^ (lfsr >> 1)) & 1;
+            lfsr = (lfsr >> 1) | (feedback << 14);
+            if(narrow)
+                lfsr = (lfsr & ~0x40) | (feedback << 6);
+
+            // only the last level inside one output sample is heard
+            int next = time + channel.period;
+            if((next >= end) || ((unsigned)(offset + time) / APU_CLOCKS_PER_SAMPLE != (unsigned)(offset + next) / APU_CLOCKS_PER_SAMPLE)) {
+                m_LFSR = lfsr;
+                SetOutput(NOISE, time);
+            }
+            time = next;
+        }
+    }
+
+    channel.delay = time - end;
+}
+
+/**
+ * Frame sequencer: length on even steps, sweep on 2 and 6, envelope on 7
+ */
+void APU::ClockSequencer(int time) {
+    int step = m_SequencerStep;
+    m_SequencerStep = (m_SequencerStep + 1) & 7;
+
+    if((step & 1) == 0) {
+        for(int i = 0; i < 4; i++) {
+            Channel &channel = m_Channels[i];
+            if(channel.lengthEnabled && (channel.length > 0)) {
+                channel.length--;
+                if(channel.length == 0) {
+                    channel.enabled = false;
+                    SetOutput(i, time);
+                }
+            }
+        }
+    }
+
+    if((step == 2) || (step == 6))
+        ClockSweep(time);
+
+    if(step == 7) {
+        for(int i = 0; i < 4; i++) {
+            if(i == WAVE)
+                continue;
+
+            Channel &channel = m_Channels[i];
+            BYTE envelope = Register(0xFF12 + (i * 5));
+            int period = envelope & 0x7;
+            if(period == 0)
+                continue;
+
+            channel.envelopeTimer--;
+            if(channel.envelopeTimer <= 0) {
+                channel.envelopeTimer = period;
+                if(TestBit(envelope, 3) && (channel.volume < 15))
+                    channel.volume++;
+                else if(!TestBit(envelope, 3) && (channel.volume > 0))
+                    channel.volume--;
+                SetOutput(i, time);
+            }
+        }
+    }
+}
+
+/**
+ * Channel 1 frequency sweep
+ */
+void APU::ClockSweep(int time) {
+    BYTE sweep = Register(NR10);
+    int period = (sweep >> 4) & 0x7;
+
+    m_SweepTimer--;
+    if(m_SweepTimer > 0)
+        return;
+
+    m_SweepTimer = (period != 0) ? period : 8;
+    if(!m_SweepEnabled || (period == 0))
+        return;
+
+    int frequency = SweepFrequency();
+    if((frequency <= 2047) && ((sweep & 0x7) != 0)) {
+        m_SweepShadow = frequency;
+        SetFrequency(SQUARE1, frequency);
+        frequency = SweepFrequency();
+    }
+
+    // overflow turns the channel off
+    if(frequency > 2047) {
+        m_Channels[SQUARE1].enabled = false;
+        SetOutput(SQUARE1, time);
+    }
+}
+
+int APU::SweepFrequency() const {
+    BYTE sweep = Register(NR10);
+    int delta = m_SweepShadow >> (sweep & 0x7);
+    return TestBit(sweep, 3) ? m_SweepShadow - delta : m_SweepShadow + delta;
+}
+
+/**
+ * Write an 11 bit frequency back to a channel's registers and timer
+ */
+void APU::SetFrequency(int index, int frequency) {
+    WORD base = 0xFF10 + (index * 5);
+    m_Registers[base + 3 - 0xFF10] = frequency & 0xFF;
+    m_Registers[base + 4 - 0xFF10] = (Register(base + 4) & 0xF8) | ((frequency >> 8) & 0x7);
+    m_Channels[index].period = (2048 - frequency) * ((index == WAVE) ? 2 : 4);
+}
+
+/**
+ * Restart a channel from its registers
+ */
+void APU::Trigger(int index, int time) {
+    Channel &channel = m_Channels[index];
+    WORD base = 0xFF10 + (index * 5);
+
+    channel.enabled = channel.dacEnabled;
+    if(channel.length == 0)
+        channel.length = (index == WAVE) ? 256 : 64;
+    channel.delay = channel.period;
+
+    if(index == WAVE) {
+        channel.position = 0;
+    } else {
+        BYTE envelope = Register(base + 2);
+        channel.volume = envelope >> 4;
+        channel.envelopeTimer = envelope & 0x7;
+    }
+
+    if(index == NOISE)
+        m_LFSR = 0x7FFF;
+
+    if(index == SQUARE1) {
+        BYTE sweep = Register(NR10);
+        int period = (sweep >> 4) & 0x7;
+        m_SweepShadow = ((Register(base + 4) & 0x7) << 8) | Register(base + 3);
+        m_SweepTimer = (period != 0) ? period : 8;
+        m_SweepEnabled = (period != 0) || ((sweep & 0x7) != 0);
+        if(((sweep & 0x7) != 0) && (SweepFrequency() > 2047))
+            channel.enabled = false;
+    }
+
+    SetOutput(index, time);
+}
+
+/**
+ * Digital output of a channel, 0 - 15
+ */
+int APU::Output(int index) const {
+    const Channel &channel = m_Channels[index];
+    if(!channel.enabled)
+        return 0;
+
+    switch(index) {
+        case SQUARE1:
+        case SQUARE2: {
+            int duty = Register(0xFF11 + (index * 5)) >> 6;
+            return DUTY[duty][channel.position] ? channel.volume : 0;
+        }
+        case WAVE: {
+            BYTE sample = Register(WAVE_RAM + (channel.position / 2));
+            sample = (channel.position & 1) ? (sample & 0xF) : (sample >> 4);
+            int shift = (Register(NR32) >> 5) & 0x3;
+            return (shift == 0) ? 0 : (sample >> (shift - 1));
+        }
+        case NOISE:
+            return (m_LFSR & 1) ? 0 : channel.volume;
+    }
+
+    return 0;
+}
+
+/**
+ * Send a channel's current output through the panning and master volume
+ * and add a step to each side of the mix it changed on
+ */
+void APU::SetOutput(int index, int time) {
+    int output = Output(index);
+    BYTE panning = Register(NR51);
+    BYTE volume = Register(NR50);
+
+    int right = TestBit(panning, index) ? output * ((volume & 0x7) + 1) : 0;
+    int left = TestBit(panning, index + 4) ? output * (((volume >> 4) & 0x7) + 1) : 0;
+
+    if(left != m_Level[index][0]) {
+        AddDelta(0, time, left - m_Level[index][0]);
+        m_Level[index][0] = left;
+    }
+
+    if(right != m_Level[index][1]) {
+        AddDelta(1, time, right - m_Level[index][1]);
+        m_Level[index][1] = right;
+    }
+}
+
+/**
+ * Add a band-limited step of the given size at time
+ */
+void APU::AddDelta(int side, int time, int delta) {
+    int clock = m_SampleOffset + time;
+    int position = clock / APU_CLOCKS_PER_SAMPLE;
+    int phase = (clock % APU_CLOCKS_PER_SAMPLE) * APU_BLEP_PHASES / APU_CLOCKS_PER_SAMPLE;
+
+    const int *taps = s_Kernel.taps[phase];
+    int *out = &m_Deltas[side][position];
+    for(int i = 0; i < APU_BLEP_WIDTH; i++)
+        out[i] += delta * taps[i];
+}
+
+/**
+ * Apply a register write
+ */
+void APU::WriteRegister(WORD address, BYTE data, int time) {
+    // with the power off only wave ram and NR52 can be written
+    if(!TestBit(Register(NR52), 7) && (address < WAVE_RAM) && (address != NR52))
+        return;
+
+    m_Registers[address - 0xFF10] = data;
+
+    if(address >= WAVE_RAM)
+        return;
+
+    if(address == NR52) {
+        if(!TestBit(data, 7)) {
+            memset(m_Registers, 0, NR52 - 0xFF10);
+            for(int i = 0; i < 4; i++) {
+                m_Channels[i].enabled = false;
+                m_Channels[i].dacEnabled = false;
+                SetOutput(i, time);
+            }
+        }
+        return;
+    }
+
+    if((address == NR50) || (address == NR51)) {
+        for(int i = 0; i < 4; i++)
+            SetOutput(i, time);
+        return;
+    }
+
+    int index = (address - 0xFF10) / 5;
+    if(index > NOISE)
+        return;
+
+    Channel &channel = m_Channels[index];
+    WORD base = 0xFF10 + (index * 5);
+
+    switch(address - base) {
+        case 0:
+            if(index == WAVE) {
+                channel.dacEnabled = TestBit(data, 7);
+                if(!channel.dacEnabled)
+                    channel.enabled = false;
+            }
+            break;
+
+        case 1:
+            channel.length = (index == WAVE) ? 256 - data : 64 - (data & 0x3F);
+            break;
+
+        case 2:
+            if(index != WAVE) {
+                channel.dacEnabled = (data & 0xF8) != 0;
+                if(!channel.dacEnabled)
+                    channel.enabled = false;
+            }
+            break;
+
+        case 3:
+        case 4:
+            if(index == NOISE) {
+                if(address == NR43) {
+                    int divisor = ((data & 0x7) == 0) ? 8 : (data & 0x7) * 16;
+                    int shift = data >> 4;
+                    // shifts of 14 and 15 stop the shift register
+                    channel.period = (shift < 14) ? divisor << shift : 0x7FFFFFFF / 2;
+                }
+            } else {
+                SetFrequency(index, ((Register(base + 4) & 0x7) << 8) | Register(base + 3));
+            }
+
+            if(address == base + 4) {
+                channel.lengthEnabled = TestBit(data, 6);
+                if(TestBit(data, 7))
+                    Trigger(index, time);
+            }
+            break;
+    }
+
+    SetOutput(index, time);
+}
+
+/**
+ * Integrate count samples out of the delta buffer and keep the kernel tails
+ */
+void APU::FlushSamples(int count) {
+    for(int i = 0; i < count; i++) {
+        int sample[2];
+        for(int side = 0; side < 2; side++) {
+            m_Integrator[side] += m_Deltas[side][i];
+
+            // levels go up to 480, scale to 16 bit and remove the dc offset
+            int level = m_Integrator[side] >> 9;
+            m_HighPass[side] += ((level * 256) - m_HighPass[side]) / 1024;
+            sample[side] = level - (m_HighPass[side] >> 8);
+        }
+
+        if(m_SampleCount < APU_MAX_SAMPLES) {
+            for(int side = 0; side < 2; side++) {
+                int value = sample[side];
+                if(value > 32767)
+                    value = 32767;
+                else if(value < -32768)
+                    value = -32768;
+                m_Samples[(m_SampleCount * 2) + side] = (short)value;
+            }
+            m_SampleCount++;
+        }
+    }
+
+    for(int side = 0; side < 2; side++) {
+        memmove(m_Deltas[side], m_Deltas[side] + count, APU_BLEP_WIDTH * sizeof(int));
+        memset(m_Deltas[side] + APU_BLEP_WIDTH, 0, count * sizeof(int));
+    }
+}
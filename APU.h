@@ -0,0 +1,116 @@
+#ifndef APU_H
+#define APU_H
+
+#include "Config.h"
+
+// the apu produces samples at the cpu clock / 32
+#define APU_CLOCKS_PER_SAMPLE 32
+#define APU_SAMPLE_RATE (4194304 / APU_CLOCKS_PER_SAMPLE)
+
+// stereo frames held until the host reads them, a little under 4 video frames
+#define APU_MAX_SAMPLES 8192
+
+// band-limited step kernel
+#define APU_BLEP_PHASES 32
+#define APU_BLEP_WIDTH 16
+
+// longest stretch that fits in the delta buffer between two EndFrame calls
+#define APU_MAX_FRAME_CLOCKS ((APU_MAX_SAMPLES - 1) * APU_CLOCKS_PER_SAMPLE)
+
+/**
+ * DMG sound: two pulse channels, a wave channel and a noise channel.
+ *
+ * Nothing runs per CPU cycle. Register writes are timestamped with the
+ * emulator's cycle count and the channels are only brought up to date when
+ * a write arrives or the frame ends. Each change in a channel's output level
+ * is added to a delta buffer as a band-limited step, which EndFrame
+ * integrates into 16-bit stereo samples at APU_SAMPLE_RATE. EndFrame also
+ * moves the clock back to 0, so the emulator's count stays within a frame.
+ */
+class APU {
+    public:
+        enum CHANNEL {
+            SQUARE1,
+            SQUARE2,
+            WAVE,
+            NOISE
+        };
+
+        APU();
+        void Reset();
+        void Write(WORD address, BYTE data, int clock);
+        int EndFrame(int clock);
+        BYTE ChannelStatus() const;
+        int SamplesAvailable() const;
+        int ReadSamples(short *out, int maxSamples);
+        const short *Samples() const;
+        void DiscardSamples(int count);
+
+        struct Channel {
+            bool enabled;
+            bool dacEnabled;
+            int delay;
+            int period;
+            int position;
+            int length;
+            bool lengthEnabled;
+            int volume;
+            int envelopeTimer;
+        };
+
+        static bool ValidState(const Channel *channels, int sequencerDelay, int time, int sampleOffset);
+
+        // registers FF10 - FF3F
+        BYTE m_Registers[0x30];
+        Channel m_Channels[4];
+
+        // channel 1 sweep
+        int m_SweepTimer;
+        int m_SweepShadow;
+        bool m_SweepEnabled;
+
+        // channel 4 shift register
+        WORD m_LFSR;
+
+        // frame sequencer, clocks length, sweep and envelope at 512hz
+        int m_SequencerDelay;
+        int m_SequencerStep;
+
+        // cycles into the current frame that have been synthesized, and
+        // the emulator clock the frame started at. That is 0 unless a
+        // frame ran too long for the delta buffer and was ended early
+        int m_Time;
+        int m_FrameClock;
+
+        // last level sent to each side of the mix per channel
+        int m_Level[4][2];
+
+        // band-limited synthesis
+        int m_SampleOffset;
+        int m_Deltas[2][APU_MAX_SAMPLES + APU_BLEP_WIDTH];
+        int m_Integrator[2];
+        int m_HighPass[2];
+        short m_Samples[APU_MAX_SAMPLES * 2];
+        int m_SampleCount;
+
+    private:
+        BYTE Register(WORD address) const { return m_Registers[address - 0xFF10]; }
+        int CatchUp(int clock);
+        void FinishFrame(int time);
+        void RunUntil(int time);
+        void RunSquare(int index, int start, int end);
+        void RunWave(int start, int end);
+        void RunNoise(int start, int end);
+        void ClockSequencer(int time);
+        void ClockSweep(int time);
+        int SweepFrequency() const;
+        void SetFrequency(int index, int frequency);
+        void Trigger(int index, int time);
+        int Output(int index) const;
+        void SetOutput(int index, int time);
+        void AddDelta(int side, int time, int delta);
+        void WriteRegister(WORD address, BYTE data, int time);
+        void FlushSamples(int count);
+};
+
+#endif
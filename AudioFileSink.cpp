@@ -0,0 +1,101 @@
+#include "Config.h"
+#include "AudioFileSink.h"
+#include <cstring>
+
+static void PutLE(BYTE *out, unsigned value, int bytes) {
+    for(int i = 0; i < bytes; i++)
+        out[i] = (value >> (i * 8)) & 0xFF;
+}
+
+AudioFileSink::AudioFileSink() {
+    m_File = NULL;
+    m_Format = WAV;
+    m_SampleRate = 0;
+    m_Frames = 0;
+}
+
+AudioFileSink::~AudioFileSink() {
+    Close();
+}
+
+/**
+ * Create the file, a WAV header is written now and patched on Close
+ */
+bool AudioFileSink::Open(const char *path, int sampleRate, FORMAT format) {
+    Close();
+
+    m_File = fopen(path, "wb");
+    if(m_File == NULL)
+        return false;
+
+    m_Format = format;
+    m_SampleRate = sampleRate;
+    m_Frames = 0;
+
+    if((m_Format == WAV) && !WriteHeader()) {
+        fclose(m_File);
+        m_File = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Append interleaved stereo frames. They go out in host byte order, which is
+ * little-endian on everything we build for
+ */
+bool AudioFileSink::Write(const short *frames, int count) {
+    if(m_File == NULL)
+        return false;
+
+    size_t written = fwrite(frames, 2 * sizeof(short), count, m_File);
+    m_Frames += written;
+    return written == (size_t)count;
+}
+
+/**
+ * Fill in the WAV sizes and close the file, false if any of it failed to
+ * reach the disk
+ */
+bool AudioFileSink::Close() {
+    if(m_File == NULL)
+        return true;
+
+    bool ok = true;
+    if(m_Format == WAV)
+        ok = (fseek(m_File, 0, SEEK_SET) == 0) && WriteHeader();
+
+    if(fclose(m_File) != 0)
+        ok = false;
+    m_File = NULL;
+    return ok;
+}
+
+long long AudioFileSink::FramesWritten() const {
+    return m_Frames;
+}
+
+/**
+ * 44 byte canonical WAV header for 16-bit stereo PCM
+ */
+bool AudioFileSink::WriteHeader() {
+    BYTE header[44];
+    unsigned dataBytes = (unsigned)(m_Frames * 4);
+
+    memcpy(header, "RIFF", 4);
+    PutLE(header + 4, 36 + dataBytes, 4);
+    memcpy(header + 8, "WAVE", 4);
+    memcpy(header + 12, "fmt ", 4);
+    PutLE(header + 16, 16, 4);
+    PutLE(header + 20, 1, 2); // pcm
+    PutLE(header + 22, 2, 2); // channels
+    PutLE(header + 24, m_SampleRate, 4);
+    PutLE(header + 28, m_SampleRate * 4, 4); // bytes per second
+    PutLE(header + 32, 4, 2); // bytes per frame
+    PutLE(header + 34, 16, 2); // bits per sample
+    memcpy(header + 36, "data", 4);
+    PutLE(header + 40, dataBytes, 4);
+
+    return fwrite(header, 1, sizeof(header), m_File) == sizeof(header);
+}
@@ -0,0 +1,37 @@
+#ifndef AUDIO_FILE_SINK_H
+#define AUDIO_FILE_SINK_H
+
+#include "Config.h"
+
+/**
+ * Writes stereo 16-bit frames to disk, either as a WAV file or as headerless
+ * little-endian PCM. Needs no audio device so it works headless, for
+ * recording sessions and for measuring latency offline.
+ */
+class AudioFileSink {
+    public:
+        enum FORMAT {
+            WAV,
+            RAW
+        };
+
+        AudioFileSink();
+        ~AudioFileSink();
+        bool Open(const char *path, int sampleRate, FORMAT format);
+        bool Write(const short *frames, int count);
+        bool Close();
+        long long FramesWritten() const;
+
+    private:
+        AudioFileSink(const AudioFileSink &);
+        AudioFileSink &operator=(const AudioFileSink &);
+
+        bool WriteHeader();
+
+        FILE *m_File;
+        FORMAT m_Format;
+        int m_SampleRate;
+        long long m_Frames;
+};
+
+#endif
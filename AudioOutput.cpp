@@ -0,0 +1,86 @@
+#include "Config.h"
+#include "AudioOutput.h"
+
+AudioOutput::AudioOutput(int outputRate, int capacity, int targetFill)
+    : m_Ring(capacity) {
+    m_OutputRate = outputRate;
+    m_Resampler.Setup(APU_SAMPLE_RATE, outputRate);
+
+    m_RateControl = true;
+    m_TargetFill = targetFill;
+    m_MaxDeviation = 0.005;
+    m_Adjust = 1.0;
+
+    // room for a full apu buffer at the highest adjusted rate
+    m_Resampler.SetRateAdjust(1.0 + m_MaxDeviation);
+    m_OutputCapacity = m_Resampler.MaxOutput(APU_MAX_SAMPLES);
+    m_Resampler.SetRateAdjust(1.0);
+    m_Output = new short[m_OutputCapacity * 2];
+
+    m_Dropped = 0;
+}
+
+AudioOutput::~AudioOutput() {
+    delete [] m_Output;
+}
+
+/**
+ * Producer side: take everything the APU has, resample it and queue it
+ */
+void AudioOutput::Push(APU &apu) {
+    int count = apu.ReadSamples(m_Input, APU_MAX_SAMPLES);
+    if(count == 0)
+        return;
+
+    if(m_RateControl) {
+        // positive when the ring is below target, so produce a little more
+        double deviation = (double)(m_TargetFill - m_Ring.Fill()) / m_TargetFill;
+        if(deviation > 1.0)
+            deviation = 1.0;
+        else if(deviation < -1.0)
+            deviation = -1.0;
+
+        m_Adjust = 1.0 + (m_MaxDeviation * deviation);
+        m_Resampler.SetRateAdjust(m_Adjust);
+    }
+
+    int frames = m_Resampler.Process(m_Input, count, m_Output, m_OutputCapacity);
+    int written = m_Ring.Write(m_Output, frames);
+
+    // the consumer fell behind, the newest audio is lost
+    m_Dropped += frames - written;
+}
+
+/**
+ * Consumer side, safe to call from the host audio callback
+ */
+int AudioOutput::Pull(short *out, int frames) {
+    return m_Ring.Read(out, frames);
+}
+
+void AudioOutput::SetRateControl(bool enabled) {
+    m_RateControl = enabled;
+    if(!enabled) {
+        m_Adjust = 1.0;
+        m_Resampler.SetRateAdjust(1.0);
+    }
+}
+
+int AudioOutput::Fill() const {
+    return m_Ring.Fill();
+}
+
+/**
+ * How long the audio queued right now will take to play
+ */
+double AudioOutput::LatencyMs() const {
+    return (m_Ring.Fill() * 1000.0) / m_OutputRate;
+}
+
+double AudioOutput::RateAdjust() const {
+    return m_Adjust;
+}
+
+long long AudioOutput::DroppedFrames() const {
+    return m_Dropped;
+}
@@ -0,0 +1,53 @@
+#ifndef AUDIO_OUTPUT_H
+#define AUDIO_OUTPUT_H
+
+#include "Config.h"
+#include "APU.h"
+#include "Resampler.h"
+#include "AudioRingBuffer.h"
+
+/**
+ * Moves sound from the APU to the host. The emulation thread calls Push
+ * after each frame, which resamples to the host rate and writes into a
+ * lock-free ring. The host audio thread calls Pull from its callback.
+ *
+ * With rate control on, the output rate is nudged by up to m_MaxDeviation
+ * so that the ring hovers around the target fill instead of slowly running
+ * dry or overflowing when the emulated and host clocks disagree. Headless
+ * recording turns it off since the consumer drains the ring straight away.
+ */
+class AudioOutput {
+    public:
+        AudioOutput(int outputRate, int capacity, int targetFill);
+        ~AudioOutput();
+        void Push(APU &apu);
+        int Pull(short *out, int frames);
+        void SetRateControl(bool enabled);
+        int Fill() const;
+        double LatencyMs() const;
+        double RateAdjust() const;
+        long long DroppedFrames() const;
+
+    private:
+        AudioOutput(const AudioOutput &);
+        AudioOutput &operator=(const AudioOutput &);
+
+        int m_OutputRate;
+        Resampler m_Resampler;
+        AudioRingBuffer m_Ring;
+
+        // rate control
+        bool m_RateControl;
+        int m_TargetFill;
+        double m_MaxDeviation;
+        double m_Adjust;
+
+        // scratch for one frame of apu output and its resampled version
+        short m_Input[APU_MAX_SAMPLES * 2];
+        short *m_Output;
+        int m_OutputCapacity;
+
+        long long m_Dropped;
+};
+
+#endif
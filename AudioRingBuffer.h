@@ -0,0 +1,93 @@
+#ifndef AUDIO_RING_BUFFER_H
+#define AUDIO_RING_BUFFER_H
+
+#include "Config.h"
+#include <atomic>
+#include <cstring>
+
+/**
+ * Lock-free single producer / single consumer ring of stereo 16-bit frames.
+ * The emulation thread writes and the host audio thread reads, neither ever
+ * waits on the other. Capacity is rounded up to a power of two.
+ */
+class AudioRingBuffer {
+    public:
+        explicit AudioRingBuffer(int capacity) {
+            m_Capacity = 1;
+            while(m_Capacity < (unsigned)capacity)
+                m_Capacity <<= 1;
+            m_Frames = new short[m_Capacity * 2];
+            m_Head.store(0);
+            m_Tail.store(0);
+        }
+
+        ~AudioRingBuffer() {
+            delete [] m_Frames;
+        }
+
+        int Capacity() const {
+            return (int)m_Capacity;
+        }
+
+        /**
+         * Frames waiting to be read, safe to call from either side
+         */
+        int Fill() const {
+            return (int)(m_Tail.load(std::memory_order_acquire) - m_Head.load(std::memory_order_acquire));
+        }
+
+        /**
+         * Producer side, returns how many frames fit
+         */
+        int Write(const short *frames, int count) {
+            unsigned tail = m_Tail.load(std::memory_order_relaxed);
+            unsigned head = m_Head.load(std::memory_order_acquire);
+            unsigned space = m_Capacity - (tail - head);
+            if((unsigned)count > space)
+                count = space;
+
+            unsigned start = tail & (m_Capacity - 1);
+            unsigned first = Split(start, count);
+            memcpy(m_Frames + (start * 2), frames, first * 2 * sizeof(short));
+            memcpy(m_Frames, frames + (first * 2), (count - first) * 2 * sizeof(short));
+            m_Tail.store(tail + count, std::memory_order_release);
+            return count;
+        }
+
+        /**
+         * Consumer side, returns how many frames were read
+         */
+        int Read(short *frames, int count) {
+            unsigned head = m_Head.load(std::memory_order_relaxed);
+            unsigned tail = m_Tail.load(std::memory_order_acquire);
+            unsigned available = tail - head;
+            if((unsigned)count > available)
+                count = available;
+
+            unsigned start = head & (m_Capacity - 1);
+            unsigned first = Split(start, count);
+            memcpy(frames, m_Frames + (start * 2), first * 2 * sizeof(short));
+            memcpy(frames + (first * 2), m_Frames, (count - first) * 2 * sizeof(short));
+            m_Head.store(head + count, std::memory_order_release);
+            return count;
+        }
+
+    private:
+        AudioRingBuffer(const AudioRingBuffer &);
+        AudioRingBuffer &operator=(const AudioRingBuffer &);
+
+        // frames that fit before the end of the ring, the rest wrap to the start
+        unsigned Split(unsigned start, int count) const {
+            unsigned first = m_Capacity - start;
+            return (first > (unsigned)count) ? (unsigned)count : first;
+        }
+
+        unsigned m_Capacity;
+        short *m_Frames;
+
+        // read and write positions on their own cache lines
+        alignas(64) std::atomic<unsigned> m_Head;
+        alignas(64) std::atomic<unsigned> m_Tail;
+};
+
+#endif
@@ -0,0 +1,112 @@
+#include "Config.h"
+#include "BatchRunner.h"
+
+/**
+ * Load instances copies of the rom image, which isn't needed once this
+ * returns
+ */
+BatchRunner::BatchRunner(const BYTE *rom, size_t size, int instances, int threads)
+    : m_Pool(threads) {
+    m_Size = instances;
+    m_Instances = new Emulator*[instances];
+    m_Held = new BYTE[instances];
+    m_Frames = new unsigned long long[instances];
+
+    for(int i = 0; i < instances; i++) {
+        m_Instances[i] = NULL;
+        m_Held[i] = 0;
+        m_Frames[i] = 0;
+    }
+
+    m_Actions = NULL;
+    m_Observations = NULL;
+    m_StepFrames = 0;
+
+    // build each instance on a worker so its memory is first touched by
+    // the threads that will run it
+    m_ROM = rom;
+    m_ROMSize = size;
+    m_Pool.Run(instances, CreateTask, this);
+    m_ROM = NULL;
+    m_ROMSize = 0;
+}
+
+BatchRunner::~BatchRunner() {
+    for(int i = 0; i < m_Size; i++)
+        delete m_Instances[i];
+
+    delete [] m_Instances;
+    delete [] m_Held;
+    delete [] m_Frames;
+}
+
+int BatchRunner::Size() const {
+    return m_Size;
+}
+
+int BatchRunner::Threads() const {
+    return m_Pool.Threads();
+}
+
+Emulator &BatchRunner::Instance(int index) {
+    return *m_Instances[index];
+}
+
+/**
+ * Apply actions[i] to instance i, run every instance for frames frames and
+ * report where each ended up. Either array may be NULL
+ */
+void BatchRunner::Step(const BYTE *actions, BatchObservation *observations, int frames) {
+    m_Actions = actions;
+    m_Observations = observations;
+    m_StepFrames = frames;
+
+    m_Pool.Run(m_Size, StepTask, this);
+}
+
+void BatchRunner::CreateTask(void *context, int index) {
+    BatchRunner *runner = (BatchRunner *)context;
+    Emulator *emulator = new Emulator();
+    emulator->LoadCartridge(runner->m_ROM, runner->m_ROMSize);
+    runner->m_Instances[index] = emulator;
+}
+
+void BatchRunner::StepTask(void *context, int index) {
+    BatchRunner *runner = (BatchRunner *)context;
+    Emulator &emulator = *runner->m_Instances[index];
+
+    if(runner->m_Actions != NULL)
+        runner->ApplyAction(index, runner->m_Actions[index]);
+
+    for(int frame = 0; frame < runner->m_StepFrames; frame++)
+        emulator.Update();
+
+    runner->m_Frames[index] += runner->m_StepFrames;
+
+    if(runner->m_Observations != NULL) {
+        BatchObservation &observation = runner->m_Observations[index];
+        observation.screen = &emulator.m_ScreenData[0][0][0];
+        observation.emulator = &emulator;
+        observation.frame = runner->m_Frames[index];
+    }
+}
+
+/**
+ * Press and release only the keys that changed since the last action
+ */
+void BatchRunner::ApplyAction(int index, BYTE action) {
+    Emulator &emulator = *m_Instances[index];
+    BYTE changed = action ^ m_Held[index];
+
+    for(int key = 0; key < 8; key++) {
+        if(!TestBit(changed, key))
+            continue;
+
+        if(TestBit(action, key))
+            emulator.KeyPressed(key);
+        else
+            emulator.KeyReleased(key);
+    }
+
+    m_Held[index] = action;
+}
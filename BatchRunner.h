@@ -0,0 +1,62 @@
+#ifndef BATCH_RUNNER_H
+#define BATCH_RUNNER_H
+
+#include "Config.h"
+#include "Emulator.h"
+#include "ThreadPool.h"
+
+/**
+ * What an instance looks like after a step. The pointers are lent from the
+ * emulator and stay valid until the next Step, memory is read through the
+ * emulator's ReadMemory.
+ */
+struct BatchObservation {
+    const BYTE *screen;
+    const Emulator *emulator;
+    unsigned long long frame;
+};
+
+/**
+ * Owns N emulator instances of one rom and steps them together across all
+ * cores.
+ *
+ * One Step call applies an action to every instance, runs each for the
+ * same number of frames on the thread pool and fills in one observation
+ * per instance, so the per-call cost is paid once per batch rather than
+ * once per instance. An action is a joypad byte with a bit set for every
+ * key held, using the same key numbers as KeyPressed.
+ */
+class BatchRunner {
+    public:
+        BatchRunner(const BYTE *rom, size_t size, int instances, int threads = 0);
+        ~BatchRunner();
+        int Size() const;
+        int Threads() const;
+        Emulator &Instance(int index);
+        void Step(const BYTE *actions, BatchObservation *observations, int frames = 1);
+
+    private:
+        BatchRunner(const BatchRunner &);
+        BatchRunner &operator=(const BatchRunner &);
+
+        static void CreateTask(void *context, int index);
+        static void StepTask(void *context, int index);
+        void ApplyAction(int index, BYTE action);
+
+        ThreadPool m_Pool;
+        int m_Size;
+        Emulator **m_Instances;
+        BYTE *m_Held;
+        unsigned long long *m_Frames;
+
+        // the rom image, only while the constructor loads it
+        const BYTE *m_ROM;
+        size_t m_ROMSize;
+
+        // arguments of the step in progress
+        const BYTE *m_Actions;
+        BatchObservation *m_Observations;
+        int m_StepFrames;
+};
+
+#endif
@@ -0,0 +1,296 @@
+#include "Config.h"
+#include "Emulator.h"
+#include "TestRoms.h"
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+
+typedef std::chrono::steady_clock Clock;
+
+#define BENCHMARK_RUNS 5
+#define BENCHMARK_VERSION 1
+
+// every benchmark is a setup on a fresh emulator and a body run n times
+struct Benchmark {
+    const char *name;
+    TEST_ROM rom;
+    int warmupFrames;
+    void (*run)(Emulator &emulator, long long n);
+};
+
+struct Result {
+    std::string name;
+    double nsPerOp;
+    long long ops;
+};
+
+struct Options {
+    const char *out;
+    const char *baseline;
+    const char *filter;
+    double threshold;
+    double minTime;
+};
+
+// keeps the reads from being optimised away
+static volatile BYTE g_Sink;
+
+// addresses for the memory benchmarks, spread over every region
+static WORD g_ReadAddresses[4096];
+static WORD g_WriteAddresses[4096];
+
+static void MakeAddresses() {
+    unsigned seed = 0x2545F491;
+    for(int i = 0; i < 4096; i++) {
+        seed = (seed * 1103515245) + 12345;
+        g_ReadAddresses[i] = (WORD)(seed >> 16);
+
+        // writes stay in vram, wram and hram, the io registers and the
+        // mapper have side effects that would change what is measured
+        seed = (seed * 1103515245) + 12345;
+        WORD write = 0x8000 + ((seed >> 16) % 0x6000);
+        g_WriteAddresses[i] = ((i & 7) == 0) ? (WORD)(0xFF80 + (write % 0x7F)) : write;
+    }
+}
+
+static void RunOpcodes(Emulator &emulator, long long n) {
+    for(long long i = 0; i < n; i++) {
+        // restart the loop now and then so a stray jump can't run off
+        if((i & 1023) == 0)
+            emulator.m_ProgramCounter = 0x150;
+        emulator.ExecuteNextOpcode();
+    }
+}
+
+static void RunReads(Emulator &emulator, long long n) {
+    BYTE sum = 0;
+    for(long long i = 0; i < n; i++)
+        sum += emulator.ReadMemory(g_ReadAddresses[i & 4095]);
+    g_Sink = sum;
+}
+
+static void RunWrites(Emulator &emulator, long long n) {
+    for(long long i = 0; i < n; i++)
+        emulator.WriteByte(g_WriteAddresses[i & 4095], (BYTE)i);
+}
+
+static void RunTiles(Emulator &emulator, long long n) {
+    BYTE lcdControl = emulator.ReadMemory(0xFF40);
+    for(long long i = 0; i < n; i++) {
+        emulator.m_Memory.Write(0xFF44, (BYTE)(i % 144));
+        emulator.RenderTiles(lcdControl);
+    }
+}
+
+static void RunSprites(Emulator &emulator, long long n) {
+    BYTE lcdControl = emulator.ReadMemory(0xFF40);
+    for(long long i = 0; i < n; i++) {
+        emulator.m_Memory.Write(0xFF44, (BYTE)(i % 144));
+        emulator.RenderSprites(lcdControl);
+    }
+}
+
+static void RunFrames(Emulator &emulator, long long n) {
+    for(long long i = 0; i < n; i++)
+        emulator.Update();
+}
+
+static const Benchmark BENCHMARKS[] = {
+    {"execute_opcode", ROM_ALU, 0, RunOpcodes},
+    {"read_memory", ROM_ALU, 0, RunReads},
+    {"write_byte", ROM_ALU, 0, RunWrites},
+    {"render_tiles", ROM_SCROLL, 4, RunTiles},
+    {"render_sprites", ROM_SPRITES, 4, RunSprites},
+    {"frame/alu", ROM_ALU, 1, RunFrames},
+    {"frame/memcopy", ROM_MEMCOPY, 1, RunFrames},
+    {"frame/bankswitch", ROM_BANKSWITCH, 1, RunFrames},
+    {"frame/halt", ROM_HALT, 1, RunFrames},
+    {"frame/sprites", ROM_SPRITES, 1, RunFrames},
+    {"frame/scroll", ROM_SCROLL, 1, RunFrames},
+};
+
+static const int NUM_BENCHMARKS = sizeof(BENCHMARKS) / sizeof(BENCHMARKS[0]);
+
+static Emulator *Prepare(const Benchmark &benchmark) {
+    Emulator *emulator = new Emulator();
+    std::vector<BYTE> rom = MakeTestRom(benchmark.rom);
+    emulator->LoadCartridge(&rom[0], rom.size());
+
+    for(int i = 0; i < benchmark.warmupFrames; i++)
+        emulator->Update();
+    return emulator;
+}
+
+static double TimeRun(const Benchmark &benchmark, long long n) {
+    Emulator *emulator = Prepare(benchmark);
+    Clock::time_point start = Clock::now();
+    benchmark.run(*emulator, n);
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    delete emulator;
+    return seconds;
+}
+
+/**
+ * Double the op count until one run takes minTime, then keep the best of
+ * BENCHMARK_RUNS runs at that count. Every run starts from the same state
+ */
+static Result Measure(const Benchmark &benchmark, double minTime) {
+    long long n = 1;
+    while(TimeRun(benchmark, n) < minTime)
+        n *= 2;
+
+    double best = 0;
+    for(int run = 0; run < BENCHMARK_RUNS; run++) {
+        double seconds = TimeRun(benchmark, n);
+        if((run == 0) || (seconds < best))
+            best = seconds;
+    }
+
+    Result result;
+    result.name = benchmark.name;
+    result.nsPerOp = (best * 1e9) / n;
+    result.ops = n;
+    return result;
+}
+
+static bool WriteResults(const char *path, const std::vector<Result> &results) {
+    FILE *out = fopen(path, "w");
+    if(out == NULL)
+        return false;
+
+    // one result per line, LoadBaseline depends on it
+    fprintf(out, "{\n  \"version\": %d,\n  \"runs\": %d,\n  \"results\": [\n", BENCHMARK_VERSION, BENCHMARK_RUNS);
+    for(size_t i = 0; i < results.size(); i++) {
+        fprintf(out, "    {\"name\": \"%s\", \"ns_per_op\": %.3f, \"ops\": %lld}%s\n",
+            results[i].name.c_str(), results[i].nsPerOp, results[i].ops, (i + 1 < results.size()) ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+
+    return fclose(out) == 0;
+}
+
+/**
+ * Read back a file written by WriteResults
+ */
+static bool LoadBaseline(const char *path, std::vector<Result> &results) {
+    FILE *in = fopen(path, "r");
+    if(in == NULL)
+        return false;
+
+    char line[512];
+    while(fgets(line, sizeof(line), in) != NULL) {
+        char name[128];
+        Result result;
+        const char *entry = strstr(line, "{\"name\"");
+        if((entry == NULL) || (sscanf(entry, "{\"name\": \"%127[^\"]\", \"ns_per_op\": %lf, \"ops\": %lld", name, &result.nsPerOp, &result.ops) != 3))
+            continue;
+        result.name = name;
+        results.push_back(result);
+    }
+
+    fclose(in);
+    return !results.empty();
+}
+
+static void Usage() {
+    fprintf(stderr,
+        "usage: gb-bench [options]\n"
+        "  --out FILE        write results as json (default bench.json)\n"
+        "  --baseline FILE   compare against an earlier --out file\n"
+        "  --threshold PCT   slowdown that counts as a regression (default 10)\n"
+        "  --filter TEXT     only run benchmarks whose name contains TEXT\n"
+        "  --min-time MS     shortest timed run (default 20)\n");
+}
+
+static bool ParseOptions(int argc, char **argv, Options &options) {
+    options.out = "bench.json";
+    options.baseline = NULL;
+    options.filter = NULL;
+    options.threshold = 10;
+    options.minTime = 0.02;
+
+    for(int i = 1; i < argc; i += 2) {
+        const char *arg = argv[i];
+        const char *value = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if(value == NULL)
+            return false;
+
+        char *end = NULL;
+        if(strcmp(arg, "--out") == 0) {
+            options.out = value;
+        } else if(strcmp(arg, "--baseline") == 0) {
+            options.baseline = value;
+        } else if(strcmp(arg, "--filter") == 0) {
+            options.filter = value;
+        } else if(strcmp(arg, "--threshold") == 0) {
+            options.threshold = strtod(value, &end);
+            if((end == value) || (*end != '\0') || (options.threshold < 0))
+                return false;
+        } else if(strcmp(arg, "--min-time") == 0) {
+            options.minTime = strtod(value, &end) / 1000.0;
+            if((end == value) || (*end != '\0') || (options.minTime <= 0))
+                return false;
+        } else {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Micro benchmarks of the hot paths and whole frames of the synthetic
+ * roms in TestRoms.cpp, so no cartridge is needed. Exits with 1 when a
+ * benchmark is more than the threshold slower than the baseline
+ */
+int main(int argc, char **argv) {
+    Options options;
+    if(!ParseOptions(argc, argv, options)) {
+        Usage();
+        return 2;
+    }
+
+    std::vector<Result> baseline;
+    if((options.baseline != NULL) && !LoadBaseline(options.baseline, baseline)) {
+        fprintf(stderr, "gb-bench: cannot read baseline %s\n", options.baseline);
+        return 2;
+    }
+
+    MakeAddresses();
+
+    std::vector<Result> results;
+    int regressions = 0;
+    for(int i = 0; i < NUM_BENCHMARKS; i++) {
+        const Benchmark &benchmark = BENCHMARKS[i];
+        if((options.filter != NULL) && (strstr(benchmark.name, options.filter) == NULL))
+            continue;
+
+        Result result = Measure(benchmark, options.minTime);
+        results.push_back(result);
+        printf("%-20s %12.2f ns/op", result.name.c_str(), result.nsPerOp);
+
+        for(size_t j = 0; j < baseline.size(); j++) {
+            if(baseline[j].name != result.name)
+                continue;
+
+            double change = 100.0 * (result.nsPerOp - baseline[j].nsPerOp) / baseline[j].nsPerOp;
+            bool regressed = change > options.threshold;
+            printf("  %+7.1f%%%s", change, regressed ? "  REGRESSION" : "");
+            if(regressed)
+                regressions++;
+        }
+        printf("\n");
+    }
+
+    if(!WriteResults(options.out, results)) {
+        fprintf(stderr, "gb-bench: cannot write %s\n", options.out);
+        return 2;
+    }
+
+    if(regressions > 0) {
+        printf("%d benchmark%s regressed by more than %.1f%%\n", regressions, (regressions == 1) ? "" : "s", options.threshold);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,119 @@
+#include "Config.h"
+#include "Emulator.h"
+
+/**
+ * Read count hex digits from code, skipping dashes
+ */
+static bool ParseHex(const char *code, int *digits, int &count) {
+    count = 0;
+    for(const char *c = code; *c != '\0'; c++) {
+        int digit;
+        if((*c >= '0') && (*c <= '9'))
+            digit = *c - '0';
+        else if((*c >= 'A') && (*c <= 'F'))
+            digit = *c - 'A' + 10;
+        else if((*c >= 'a') && (*c <= 'f'))
+            digit = *c - 'a' + 10;
+        else if(*c == '-')
+            continue;
+        else
+            return false;
+
+        if(count == 9)
+            return false;
+        digits[count++] = digit;
+    }
+    return true;
+}
+
+/**
+ * Add a game genie code, ABC-DEF or ABC-DEF-GHI. The new value goes into
+ * every rom bank that can show up at the address, only where the rom
+ * holds the compare value when there is one
+ */
+bool Emulator::AddGameGenie(const char *code) {
+    int d[9];
+    int count = 0;
+    if(!ParseHex(code, d, count) || ((count != 6) && (count != 9)))
+        return false;
+
+    BYTE value = (d[0] << 4) | d[1];
+    WORD address = ((d[5] ^ 0xF) << 12) | (d[2] << 8) | (d[3] << 4) | d[4];
+    if(address >= 0x8000)
+        return false;
+
+    bool compare = (count == 9);
+    BYTE expected = 0;
+    if(compare) {
+        BYTE scrambled = (d[6] << 4) | d[8];
+        expected = (BYTE)((scrambled >> 2) | (scrambled << 6)) ^ 0xBA;
+    }
+
+    if(address < 0x4000) {
+        if(!compare || (m_CartridgeMemory[address] == expected))
+            m_Memory.PatchROM(0, address, value);
+        return true;
+    }
+
+    // rom size from the header, 32k << n
+    int banks = (m_CartridgeMemory[0x148] <= 6) ? (2 << m_CartridgeMemory[0x148]) : (CARTRIDGE_SIZE / 0x4000);
+    if(banks > CARTRIDGE_SIZE / 0x4000)
+        banks = CARTRIDGE_SIZE / 0x4000;
+
+    for(int bank = 1; bank < banks; bank++) {
+        if(!compare || (m_CartridgeMemory[(bank * 0x4000) + (address - 0x4000)] == expected))
+            m_Memory.PatchROM(bank, address, value);
+    }
+    return true;
+}
+
+/**
+ * Add a gameshark code, TTVVLLHH. Type 01 writes to the address as mapped
+ * at the time, 80 - 83 write to that cartridge ram bank
+ */
+bool Emulator::AddGameShark(const char *code) {
+    int d[9];
+    int count = 0;
+    if(!ParseHex(code, d, count) || (count != 8))
+        return false;
+
+    BYTE type = (d[0] << 4) | d[1];
+    RAMPatch patch;
+    patch.value = (d[2] << 4) | d[3];
+    patch.address = (d[6] << 12) | (d[7] << 8) | (d[4] << 4) | d[5];
+    patch.bank = -1;
+
+    if((type & 0xF0) == 0x80) {
+        if(((type & 0xF) > 3) || (patch.address < 0xA000) || (patch.address >= 0xC000))
+            return false;
+        patch.bank = type & 0xF;
+    } else if(type != 0x01) {
+        return false;
+    }
+
+    if(patch.address < 0x8000)
+        return false;
+
+    m_RAMPatches.push_back(patch);
+    return true;
+}
+
+void Emulator::ClearCheats() {
+    m_Memory.ClearROMPatches();
+    m_RAMPatches.clear();
+}
+
+/**
+ * Write every gameshark code, once a frame as the cartridge did
+ */
+void Emulator::ApplyRAMPatches() {
+    for(size_t i = 0; i < m_RAMPatches.size(); i++) {
+        const RAMPatch &patch = m_RAMPatches[i];
+        if((patch.address >= 0xA000) && (patch.address < 0xC000)) {
+            int bank = (patch.bank >= 0) ? patch.bank : m_CurrentRAMBank;
+            m_Memory.WriteRAM((patch.address - 0xA000) + (bank * 0x2000), patch.value);
+        } else {
+            m_Memory.Write(patch.address, patch.value);
+        }
+    }
+}
@@ -7,6 +7,12 @@
 #include <stdio.h>
 #include <assert.h>
 
+// Type definitions for the Gameboy's data types
+typedef unsigned char BYTE ;
+typedef char SIGNED_BYTE ;
+typedef unsigned short WORD ;
+typedef signed short SIGNED_WORD ;
+
 template< typename typeData >
 bool TestBit( typeData inData, size_t inBitPosition )
 {
@@ -0,0 +1,189 @@
+#include "Config.h"
+#include "Debugger.h"
+#include "Disassembler.h"
+#include <cstring>
+
+Debugger::Debugger(Emulator &emulator) : m_Emulator(emulator) {
+    memset(&m_Breakpoints, 0, sizeof(m_Breakpoints));
+    memset(&m_ReadWatches, 0, sizeof(m_ReadWatches));
+    m_Traps = 0;
+    m_Reads = 0;
+    m_FrameCycles = 0;
+    m_Resuming = false;
+    m_StopAddress = 0;
+}
+
+Debugger::~Debugger() {
+    Clear();
+}
+
+void Debugger::Set(TrapSet &set, WORD address, bool on) {
+    if(TestBit(set.bits[address >> 3], address & 7) == on)
+        return;
+
+    if(on) {
+        set.bits[address >> 3] = BitSet(set.bits[address >> 3], address & 7);
+        set.pages[address >> PAGE_SHIFT]++;
+    } else {
+        set.bits[address >> 3] = BitReset(set.bits[address >> 3], address & 7);
+        set.pages[address >> PAGE_SHIFT]--;
+    }
+}
+
+void Debugger::AddBreakpoint(WORD pc) {
+    if(!m_Breakpoints.Has(pc))
+        m_Traps++;
+    Set(m_Breakpoints, pc, true);
+}
+
+void Debugger::RemoveBreakpoint(WORD pc) {
+    if(m_Breakpoints.Has(pc))
+        m_Traps--;
+    Set(m_Breakpoints, pc, false);
+}
+
+void Debugger::AddReadWatch(WORD address) {
+    if(!m_ReadWatches.Has(address)) {
+        m_Traps++;
+        m_Reads++;
+    }
+    Set(m_ReadWatches, address, true);
+}
+
+void Debugger::RemoveReadWatch(WORD address) {
+    if(m_ReadWatches.Has(address)) {
+        m_Traps--;
+        m_Reads--;
+    }
+    Set(m_ReadWatches, address, false);
+}
+
+/**
+ * False for rom addresses, writes there never reach memory
+ */
+bool Debugger::AddWriteWatch(WORD address) {
+    for(size_t i = 0; i < m_WriteWatches.size(); i++) {
+        if(m_WriteWatches[i].first == address)
+            return true;
+    }
+
+    int id = m_Emulator.AddWatch(address, MemoryMap::WATCH_WRITE);
+    if(id < 0)
+        return false;
+
+    m_WriteWatches.push_back(std::make_pair(address, id));
+    m_Traps++;
+    return true;
+}
+
+void Debugger::RemoveWriteWatch(WORD address) {
+    for(size_t i = 0; i < m_WriteWatches.size(); i++) {
+        if(m_WriteWatches[i].first != address)
+            continue;
+
+        m_Emulator.RemoveWatch(m_WriteWatches[i].second);
+        m_WriteWatches.erase(m_WriteWatches.begin() + i);
+        m_Traps--;
+        return;
+    }
+}
+
+void Debugger::Clear() {
+    for(size_t i = 0; i < m_WriteWatches.size(); i++)
+        m_Emulator.RemoveWatch(m_WriteWatches[i].second);
+    m_WriteWatches.clear();
+
+    memset(&m_Breakpoints, 0, sizeof(m_Breakpoints));
+    memset(&m_ReadWatches, 0, sizeof(m_ReadWatches));
+    m_Traps = 0;
+    m_Reads = 0;
+}
+
+bool Debugger::Armed() const {
+    return m_Traps > 0;
+}
+
+/**
+ * Breakpoint PC or the address read or written by the last stop
+ */
+WORD Debugger::StopAddress() const {
+    return m_StopAddress;
+}
+
+/**
+ * Run the rest of the current frame. Without traps this is just
+ * Emulator::Update. A stop leaves the frame part way through and the next
+ * call carries on from there, starting with the instruction stopped at
+ */
+Debugger::STOP Debugger::Update() {
+    if(!Armed() && (m_FrameCycles == 0)) {
+        m_Emulator.Update();
+        return STOP_NONE;
+    }
+
+    // without read watches only a breakpoint's page needs a closer look,
+    // like RunUntilPC with a page table for the pc
+    bool reads = m_Reads > 0;
+    bool writes = !m_WriteWatches.empty();
+    while(m_FrameCycles < FRAME_CYCLES) {
+        WORD pc = m_Emulator.m_ProgramCounter;
+        if(!m_Resuming && (reads || (m_Breakpoints.pages[pc >> PAGE_SHIFT] != 0))) {
+            STOP stop = CheckBefore();
+            if(stop != STOP_NONE) {
+                m_Resuming = true;
+                return stop;
+            }
+        }
+        m_Resuming = false;
+
+        if(writes)
+            m_Emulator.m_Memory.ResetFiredWatch();
+        m_FrameCycles += m_Emulator.Step();
+        if(writes && (CheckWrite() != STOP_NONE))
+            return STOP_WRITE;
+    }
+
+    m_FrameCycles = 0;
+    m_Emulator.EndFrame();
+    return STOP_NONE;
+}
+
+/**
+ * Breakpoint or read watchpoint hit by the instruction at PC
+ */
+Debugger::STOP Debugger::CheckBefore() {
+    WORD pc = m_Emulator.m_ProgramCounter;
+    if(m_Breakpoints.Has(pc)) {
+        m_StopAddress = pc;
+        return STOP_BREAKPOINT;
+    }
+
+    if(m_Reads == 0)
+        return STOP_NONE;
+
+    WORD addresses[2];
+    int count = DataReads(m_Emulator, addresses);
+    for(int i = 0; i < count; i++) {
+        if(m_ReadWatches.Has(addresses[i])) {
+            m_StopAddress = addresses[i];
+            return STOP_READ;
+        }
+    }
+
+    return STOP_NONE;
+}
+
+/**
+ * Write watchpoint hit by the instruction just run
+ */
+Debugger::STOP Debugger::CheckWrite() {
+    int fired = m_Emulator.m_Memory.FiredWatch();
+    for(size_t i = 0; (fired >= 0) && (i < m_WriteWatches.size()); i++) {
+        if(m_WriteWatches[i].second == fired) {
+            m_StopAddress = m_WriteWatches[i].first;
+            return STOP_WRITE;
+        }
+    }
+
+    return STOP_NONE;
+}
@@ -0,0 +1,77 @@
+#ifndef DEBUGGER_H
+#define DEBUGGER_H
+
+#include "Config.h"
+#include "Emulator.h"
+
+/**
+ * PC breakpoints and read and write watchpoints for one emulator.
+ *
+ * Nothing is added to the emulator's own paths, but while any trap is set
+ * Update leaves Emulator::Update for a loop that steps one instruction at
+ * a time. With breakpoints only, an instruction costs a look at its PC's
+ * page in a page table on top of the step. Read watchpoints also decode
+ * the data addresses of every instruction, whatever page it is on. Write
+ * watchpoints are memory map watches, so only writes to their own pages
+ * leave the inline write path.
+ *
+ * Breakpoints and read watchpoints stop before the instruction, write
+ * watchpoints stop after the instruction that wrote. Reads done by OAM DMA
+ * are not seen.
+ */
+class Debugger {
+    public:
+        enum STOP {
+            STOP_NONE,
+            STOP_BREAKPOINT,
+            STOP_READ,
+            STOP_WRITE
+        };
+
+        explicit Debugger(Emulator &emulator);
+        ~Debugger();
+        void AddBreakpoint(WORD pc);
+        void RemoveBreakpoint(WORD pc);
+        void AddReadWatch(WORD address);
+        void RemoveReadWatch(WORD address);
+        bool AddWriteWatch(WORD address);
+        void RemoveWriteWatch(WORD address);
+        void Clear();
+        bool Armed() const;
+        STOP Update();
+        WORD StopAddress() const;
+
+    private:
+        Debugger(const Debugger &);
+        Debugger &operator=(const Debugger &);
+
+        // one bit per address and a count of set bits per page
+        struct TrapSet {
+            BYTE bits[0x10000 / 8];
+            WORD pages[NUM_ADDRESS_PAGES];
+
+            bool Has(WORD address) const {
+                return (pages[address >> PAGE_SHIFT] != 0) && TestBit(bits[address >> 3], address & 7);
+            }
+        };
+
+        static void Set(TrapSet &set, WORD address, bool on);
+        STOP CheckBefore();
+        STOP CheckWrite();
+
+        Emulator &m_Emulator;
+        TrapSet m_Breakpoints;
+        TrapSet m_ReadWatches;
+        int m_Traps;
+        int m_Reads;
+
+        // write watches as memory map watch ids
+        std::vector<std::pair<WORD, int> > m_WriteWatches;
+
+        // cycles into the current frame when a stop ended Update early
+        int m_FrameCycles;
+        bool m_Resuming;
+        WORD m_StopAddress;
+};
+
+#endif
@@ -0,0 +1,339 @@
+#include "Config.h"
+#include "DiffHarness.h"
+#include "Disassembler.h"
+#include <cstring>
+
+static const char *GRANULARITY_NAMES[3] = {"instruction", "block", "frame"};
+
+// opcodes the fuzzer never emits: the unused ones, STOP, HALT and ADD SP,n
+// which ExecuteOpcode has no case for
+static bool Emittable(BYTE opcode) {
+    switch(opcode) {
+        case 0x10: case 0x76: case 0xE8:
+        case 0xD3: case 0xDB: case 0xDD: case 0xE3: case 0xE4:
+        case 0xEB: case 0xEC: case 0xED: case 0xF4: case 0xFC: case 0xFD:
+            return false;
+        default:
+            return true;
+    }
+}
+
+static unsigned NextRandom(unsigned &state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+DiffHarness::DiffHarness() : m_Test(1) {
+    m_Reference = new Emulator();
+    m_Granularity = DIFF_INSTRUCTION;
+    m_FrameCycles = 0;
+    m_Instructions = 0;
+    m_Frames = 0;
+    m_Next = 0;
+    m_Diverged = false;
+    m_What[0] = '\0';
+    m_ReferenceValue = 0;
+    m_TestValue = 0;
+}
+
+DiffHarness::~DiffHarness() {
+    delete m_Reference;
+}
+
+Emulator &DiffHarness::Reference() {
+    return *m_Reference;
+}
+
+Emulator &DiffHarness::Test() {
+    return m_Test.Lane(0);
+}
+
+/**
+ * Start both cores from power on with the same rom
+ */
+void DiffHarness::Load(const BYTE *rom, size_t size) {
+    delete m_Reference;
+    m_Reference = new Emulator();
+    m_Reference->LoadCartridge(rom, size);
+
+    // the lane can't be replaced, so it takes the fresh reference's state
+    Emulator &test = Test();
+    test.LoadCartridge(rom, size);
+    std::vector<BYTE> state(m_Reference->SaveStateSize());
+    size_t saved = m_Reference->SaveState(&state[0], state.size());
+    test.LoadState(&state[0], saved);
+
+    m_FrameCycles = 0;
+    m_Instructions = 0;
+    m_Frames = 0;
+    m_Next = 0;
+    m_Diverged = false;
+}
+
+void DiffHarness::SetGranularity(GRANULARITY granularity) {
+    m_Granularity = granularity;
+}
+
+/**
+ * Hold the same keys on both cores
+ */
+void DiffHarness::SetInput(BYTE joypad) {
+    Emulator *cores[2] = {m_Reference, &Test()};
+    for(int i = 0; i < 2; i++) {
+        BYTE changed = cores[i]->m_JoypadState ^ joypad;
+        for(int key = 0; key < 8; key++) {
+            if(!TestBit(changed, key))
+                continue;
+            if(TestBit(joypad, key))
+                cores[i]->KeyReleased(key);
+            else
+                cores[i]->KeyPressed(key);
+        }
+    }
+}
+
+bool DiffHarness::Diverged() const {
+    return m_Diverged;
+}
+
+/**
+ * Run both cores for some frames, false at the first divergence. At frame
+ * granularity the cores run whole frames and the report has no history
+ */
+bool DiffHarness::Run(int frames) {
+    unsigned long long end = m_Frames + frames;
+
+    while(!m_Diverged && (m_Frames < end)) {
+        if(m_Granularity == DIFF_FRAME) {
+            unsigned long long before = m_Reference->m_TotalOpcodes;
+            m_Reference->Update();
+            m_Test.Update();
+            m_Instructions += m_Reference->m_TotalOpcodes - before;
+            m_Frames++;
+            Compare();
+            continue;
+        }
+
+        bool blockEnd = StepBoth();
+        if((m_Granularity == DIFF_INSTRUCTION) || blockEnd)
+            Compare();
+    }
+
+    return !m_Diverged;
+}
+
+/**
+ * Run random instructions from random registers, false at the first
+ * divergence. Frame granularity compares every 4096 instructions
+ */
+bool DiffHarness::Fuzz(unsigned seed, long long instructions) {
+    unsigned state = (seed != 0) ? seed : 1;
+
+    std::vector<BYTE> rom(0x8000);
+    for(size_t i = 0; i < rom.size(); i++) {
+        BYTE opcode;
+        do {
+            opcode = (BYTE)NextRandom(state);
+        } while(!Emittable(opcode));
+        rom[i] = opcode;
+    }
+    rom[0x147] = 0x00;
+    rom[0x148] = 0x00;
+    Load(&rom[0], rom.size());
+
+    Emulator *cores[2] = {m_Reference, &Test()};
+    WORD registers[4];
+    for(int i = 0; i < 4; i++)
+        registers[i] = (WORD)NextRandom(state);
+    WORD sp = 0xC100 + ((NextRandom(state) % 0x1E00) & ~1);
+
+    for(int i = 0; i < 2; i++) {
+        cores[i]->m_RegisterAF.reg = registers[0] & 0xFFF0;
+        cores[i]->m_RegisterBC.reg = registers[1];
+        cores[i]->m_RegisterDE.reg = registers[2];
+        cores[i]->m_RegisterHL.reg = registers[3];
+        cores[i]->m_StackPointer.reg = sp;
+    }
+
+    for(long long n = 0; !m_Diverged && (n < instructions); n++) {
+        // out of the program or stuck, both cores go to the same place
+        if((m_Reference->m_ProgramCounter >= 0x8000) || m_Reference->m_Halted) {
+            WORD pc = (WORD)(NextRandom(state) & 0x7FFF);
+            for(int i = 0; i < 2; i++) {
+                cores[i]->m_ProgramCounter = pc;
+                cores[i]->m_Halted = false;
+            }
+        }
+
+        bool blockEnd = StepBoth();
+        if((m_Granularity == DIFF_INSTRUCTION) || ((m_Granularity == DIFF_BLOCK) && blockEnd) ||
+           ((m_Granularity == DIFF_FRAME) && ((n & 4095) == 4095)))
+            Compare();
+    }
+
+    if(!m_Diverged)
+        Compare();
+    return !m_Diverged;
+}
+
+/**
+ * One instruction on both cores, frames end on both at the same point.
+ * True when the instruction ended a basic block
+ */
+bool DiffHarness::StepBoth() {
+    Emulator &reference = *m_Reference;
+    WORD pc = reference.m_ProgramCounter;
+    BYTE opcode = reference.ReadMemory(pc);
+    bool halted = reference.m_Halted;
+    Record(reference, TraceRing::TRACE_INSTRUCTION);
+
+    int cycles = reference.Step();
+    m_Test.Step();
+    m_Instructions++;
+
+    m_FrameCycles += cycles;
+    if(m_FrameCycles >= FRAME_CYCLES) {
+        reference.EndFrame();
+        Test().EndFrame();
+        m_FrameCycles = 0;
+        m_Frames++;
+    }
+
+    return halted || (reference.m_ProgramCounter != (WORD)(pc + InstructionLength(opcode)));
+}
+
+void DiffHarness::Record(const Emulator &emulator, int kind) {
+    TraceRecord &record = m_History[m_Next % DIFF_HISTORY];
+    record.cycle = (unsigned)emulator.Cycles();
+    record.pc = emulator.m_ProgramCounter;
+    record.af = emulator.m_RegisterAF.reg;
+    record.bc = emulator.m_RegisterBC.reg;
+    record.de = emulator.m_RegisterDE.reg;
+    record.hl = emulator.m_RegisterHL.reg;
+    record.sp = emulator.m_StackPointer.reg;
+    record.bank = emulator.m_CurrentROMBank;
+    record.opcode = emulator.ReadMemory(emulator.m_ProgramCounter);
+    record.kind = (BYTE)kind;
+    record.interrupt = 0;
+    m_Next++;
+}
+
+void DiffHarness::Diverge(const char *what, unsigned reference, unsigned test) {
+    m_Diverged = true;
+    snprintf(m_What, sizeof(m_What), "%s", what);
+    m_ReferenceValue = reference;
+    m_TestValue = test;
+}
+
+/**
+ * Compare the cores, false and the first difference noted if they differ
+ */
+bool DiffHarness::Compare() {
+    const Emulator &r = *m_Reference;
+    const Emulator &t = Test();
+
+    struct Field {
+        const char *name;
+        unsigned reference;
+        unsigned test;
+    };
+
+    const Field fields[] = {
+        {"AF", r.m_RegisterAF.reg, t.m_RegisterAF.reg},
+        {"BC", r.m_RegisterBC.reg, t.m_RegisterBC.reg},
+        {"DE", r.m_RegisterDE.reg, t.m_RegisterDE.reg},
+        {"HL", r.m_RegisterHL.reg, t.m_RegisterHL.reg},
+        {"SP", r.m_StackPointer.reg, t.m_StackPointer.reg},
+        {"PC", r.m_ProgramCounter, t.m_ProgramCounter},
+        {"IME", r.m_InterruptMaster, t.m_InterruptMaster},
+        {"pending EI", r.m_PendingInteruptEnabled, t.m_PendingInteruptEnabled},
+        {"pending DI", r.m_PendingInteruptDisabled, t.m_PendingInteruptDisabled},
+        {"halted", r.m_Halted, t.m_Halted},
+        {"rom bank", r.m_CurrentROMBank, t.m_CurrentROMBank},
+        {"ram bank", r.m_CurrentRAMBank, t.m_CurrentRAMBank},
+        {"ram enabled", r.m_EnableRAM, t.m_EnableRAM},
+        {"double speed", (unsigned)r.m_SpeedShift, (unsigned)t.m_SpeedShift},
+        {"hblank dma", r.m_HDMAActive, t.m_HDMAActive},
+        {"hblank dma blocks", (unsigned)r.m_HDMABlocks, (unsigned)t.m_HDMABlocks},
+        {"timer counter", (unsigned)r.m_TimerCounter, (unsigned)t.m_TimerCounter},
+        {"divider counter", (unsigned)r.m_DividerCounter, (unsigned)t.m_DividerCounter},
+        {"scanline counter", (unsigned)r.m_ScanlineCounter, (unsigned)t.m_ScanlineCounter},
+        {"cycle count", (unsigned)r.Cycles(), (unsigned)t.Cycles()},
+        {"instruction count", (unsigned)r.m_TotalOpcodes, (unsigned)t.m_TotalOpcodes}
+    };
+
+    for(size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        if(fields[i].reference != fields[i].test) {
+            Diverge(fields[i].name, fields[i].reference, fields[i].test);
+            return false;
+        }
+    }
+
+    // the color banks are never mapped on a monochrome machine, and a
+    // monochrome state leaves whatever a reused lane had in them
+    int pages = r.m_CGB ? NUM_PAGES : FIRST_VRAM_BANK_PAGE;
+    for(int page = NUM_ROM_PAGES; page < pages; page++) {
+        const BYTE *a = r.m_Memory.PageData(page);
+        const BYTE *b = t.m_Memory.PageData(page);
+        if(memcmp(a, b, PAGE_SIZE) == 0)
+            continue;
+
+        int offset = 0;
+        while(a[offset] == b[offset])
+            offset++;
+
+        char what[64];
+        if(page < NUM_ADDRESS_PAGES)
+            snprintf(what, sizeof(what), "memory %04X", (page << PAGE_SHIFT) + offset);
+        else if(page < FIRST_VRAM_BANK_PAGE)
+            snprintf(what, sizeof(what), "cartridge ram %04X", ((page - NUM_ADDRESS_PAGES) << PAGE_SHIFT) + offset);
+        else
+            snprintf(what, sizeof(what), "color bank page %d byte %02X", page - FIRST_VRAM_BANK_PAGE, offset);
+        Diverge(what, a[offset], b[offset]);
+        return false;
+    }
+
+    return true;
+}
+
+static void WriteRegisters(FILE *out, const char *name, const Emulator &e) {
+    fprintf(out, "  %-9s AF %04X BC %04X DE %04X HL %04X SP %04X PC %04X IME %d halted %d\n", name,
+        e.m_RegisterAF.reg, e.m_RegisterBC.reg, e.m_RegisterDE.reg, e.m_RegisterHL.reg,
+        e.m_StackPointer.reg, e.m_ProgramCounter, e.m_InterruptMaster, e.m_Halted);
+}
+
+/**
+ * The first divergence with both register sets and the reference's last
+ * instructions, or a line saying there was none
+ */
+void DiffHarness::WriteReport(FILE *out) const {
+    if(!m_Diverged) {
+        fprintf(out, "no divergence after %llu instructions, %llu frames, comparing every %s\n",
+            m_Instructions, m_Frames, GRANULARITY_NAMES[m_Granularity]);
+        return;
+    }
+
+    fprintf(out, "diverged at %s comparison after %llu instructions, frame %llu\n",
+        GRANULARITY_NAMES[m_Granularity], m_Instructions, m_Frames);
+    fprintf(out, "  %s: reference %X, test %X\n", m_What, m_ReferenceValue, m_TestValue);
+    WriteRegisters(out, "reference", *m_Reference);
+    WriteRegisters(out, "test", m_Test.Lane(0));
+
+    unsigned long long count = (m_Next < DIFF_HISTORY) ? m_Next : DIFF_HISTORY;
+    if(count == 0)
+        return;
+
+    fprintf(out, "last reference instructions:\n");
+    for(unsigned long long i = m_Next - count; i < m_Next; i++) {
+        const TraceRecord &record = m_History[i % DIFF_HISTORY];
+        BYTE bytes[MAX_INSTRUCTION_LENGTH];
+        char text[32];
+        ReadCode(*m_Reference, record.bank, record.pc, bytes);
+        bytes[0] = record.opcode;
+        Disassemble(bytes, record.pc, text, sizeof(text));
+        fprintf(out, "  %02X:%04X  AF %04X BC %04X DE %04X HL %04X SP %04X  %s\n", record.bank, record.pc,
+            record.af, record.bc, record.de, record.hl, record.sp, text);
+    }
+}
@@ -0,0 +1,77 @@
+#ifndef DIFF_HARNESS_H
+#define DIFF_HARNESS_H
+
+#include "Config.h"
+#include "Emulator.h"
+#include "LockstepCore.h"
+#include "Trace.h"
+
+// reference instructions kept for the divergence report
+#define DIFF_HISTORY 32
+
+/**
+ * Runs the reference core, a plain Emulator stepped an instruction at a
+ * time, next to the core under test, a one lane LockstepCore, on the same
+ * rom and input and stops at the first point their states differ.
+ *
+ * States are compared after every instruction, at the end of every basic
+ * block (after any instruction that doesn't fall through to the next one,
+ * interrupts included) or after every frame. A comparison covers the CPU
+ * registers and flags, interrupt, timer, scanline and bank state, and
+ * every page of memory from 0x8000 up plus cartridge ram and the color
+ * banks. Rom and the APU are left out.
+ *
+ * Fuzz runs random instruction streams instead of a rom. Every byte of the
+ * program is a valid opcode, so any jump into it lands on something that
+ * decodes, and whenever the program counter leaves rom both cores are put
+ * back at the same random address.
+ */
+class DiffHarness {
+    public:
+        enum GRANULARITY {
+            DIFF_INSTRUCTION,
+            DIFF_BLOCK,
+            DIFF_FRAME
+        };
+
+        DiffHarness();
+        ~DiffHarness();
+        void Load(const BYTE *rom, size_t size);
+        void SetGranularity(GRANULARITY granularity);
+        void SetInput(BYTE joypad);
+        bool Run(int frames);
+        bool Fuzz(unsigned seed, long long instructions);
+        bool Diverged() const;
+        void WriteReport(FILE *out) const;
+        Emulator &Reference();
+        Emulator &Test();
+
+    private:
+        DiffHarness(const DiffHarness &);
+        DiffHarness &operator=(const DiffHarness &);
+
+        bool StepBoth();
+        bool Compare();
+        void Record(const Emulator &emulator, int kind);
+        void Diverge(const char *what, unsigned reference, unsigned test);
+
+        Emulator *m_Reference;
+        LockstepCore m_Test;
+        GRANULARITY m_Granularity;
+
+        // cycles into the frame both cores are in
+        int m_FrameCycles;
+        unsigned long long m_Instructions;
+        unsigned long long m_Frames;
+
+        // the last reference instructions, oldest first from m_Next
+        TraceRecord m_History[DIFF_HISTORY];
+        unsigned long long m_Next;
+
+        bool m_Diverged;
+        char m_What[64];
+        unsigned m_ReferenceValue;
+        unsigned m_TestValue;
+};
+
+#endif
@@ -0,0 +1,217 @@
+#include "Config.h"
+#include "Disassembler.h"
+#include <cstring>
+
+// d8/d16 immediates, a8/a16 addresses, r8 relative jumps, s8 signed offsets.
+// 0x40 - 0xBF are built from the register names
+static const char *OPCODES[256] = {
+    "NOP", "LD BC,d16", "LD (BC),A", "INC BC", "INC B", "DEC B", "LD B,d8", "RLCA",
+    "LD (a16),SP", "ADD HL,BC", "LD A,(BC)", "DEC BC", "INC C", "DEC C", "LD C,d8", "RRCA",
+    "STOP d8", "LD DE,d16", "LD (DE),A", "INC DE", "INC D", "DEC D", "LD D,d8", "RLA",
+    "JR r8", "ADD HL,DE", "LD A,(DE)", "DEC DE", "INC E", "DEC E", "LD E,d8", "RRA",
+    "JR NZ,r8", "LD HL,d16", "LD (HL+),A", "INC HL", "INC H", "DEC H", "LD H,d8", "DAA",
+    "JR Z,r8", "ADD HL,HL", "LD A,(HL+)", "DEC HL", "INC L", "DEC L", "LD L,d8", "CPL",
+    "JR NC,r8", "LD SP,d16", "LD (HL-),A", "INC SP", "INC (HL)", "DEC (HL)", "LD (HL),d8", "SCF",
+    "JR C,r8", "ADD HL,SP", "LD A,(HL-)", "DEC SP", "INC A", "DEC A", "LD A,d8", "CCF",
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    "RET NZ", "POP BC", "JP NZ,a16", "JP a16", "CALL NZ,a16", "PUSH BC", "ADD A,d8", "RST 00H",
+    "RET Z", "RET", "JP Z,a16", "PREFIX CB", "CALL Z,a16", "CALL a16", "ADC A,d8", "RST 08H",
+    "RET NC", "POP DE", "JP NC,a16", "DB D3H", "CALL NC,a16", "PUSH DE", "SUB d8", "RST 10H",
+    "RET C", "RETI", "JP C,a16", "DB DBH", "CALL C,a16", "DB DDH", "SBC A,d8", "RST 18H",
+    "LDH (a8),A", "POP HL", "LD (C),A", "DB E3H", "DB E4H", "PUSH HL", "AND d8", "RST 20H",
+    "ADD SP,s8", "JP (HL)", "LD (a16),A", "DB EBH", "DB ECH", "DB EDH", "XOR d8", "RST 28H",
+    "LDH A,(a8)", "POP AF", "LD A,(C)", "DI", "DB F4H", "PUSH AF", "OR d8", "RST 30H",
+    "LD HL,SP+s8", "LD SP,HL", "LD A,(a16)", "EI", "DB FCH", "DB FDH", "CP d8", "RST 38H"
+};
+
+static const char *REGISTERS[8] = {"B", "C", "D", "E", "H", "L", "(HL)", "A"};
+static const char *ALU[8] = {"ADD A,", "ADC A,", "SUB ", "SBC A,", "AND ", "XOR ", "OR ", "CP "};
+static const char *SHIFTS[8] = {"RLC", "RRC", "RL", "RR", "SLA", "SRA", "SWAP", "SRL"};
+static const char *BITS[4] = {"", "BIT", "RES", "SET"};
+
+// operand free names, filled on first use
+static char g_Names[512][16];
+
+/**
+ * Template of an opcode, operands still unfilled
+ */
+static void Template(int opcode, char *text, size_t size) {
+    if(opcode >= 0x100) {
+        int cb = opcode & 0xFF;
+        if(cb < 0x40)
+            snprintf(text, size, "%s %s", SHIFTS[cb >> 3], REGISTERS[cb & 7]);
+        else
+            snprintf(text, size, "%s %d,%s", BITS[cb >> 6], (cb >> 3) & 7, REGISTERS[cb & 7]);
+    } else if(opcode == 0x76) {
+        snprintf(text, size, "HALT");
+    } else if((opcode >= 0x40) && (opcode < 0x80)) {
+        snprintf(text, size, "LD %s,%s", REGISTERS[(opcode >> 3) & 7], REGISTERS[opcode & 7]);
+    } else if((opcode >= 0x80) && (opcode < 0xC0)) {
+        snprintf(text, size, "%s%s", ALU[(opcode >> 3) & 7], REGISTERS[opcode & 7]);
+    } else {
+        snprintf(text, size, "%s", OPCODES[opcode]);
+    }
+}
+
+int InstructionLength(BYTE opcode) {
+    if(opcode == 0xCB)
+        return 2;
+    if((opcode >= 0x40) && (opcode < 0xC0))
+        return 1;
+
+    const char *text = OPCODES[opcode];
+    if(strstr(text, "16") != NULL)
+        return 3;
+    if(strstr(text, "8") != NULL)
+        return (strstr(text, "RST") == NULL) ? 2 : 1;
+    return 1;
+}
+
+const char *OpcodeName(int opcode) {
+    assert((opcode >= 0) && (opcode < 512));
+    if(g_Names[opcode][0] == '\0')
+        Template(opcode, g_Names[opcode], sizeof(g_Names[opcode]));
+    return g_Names[opcode];
+}
+
+int Disassemble(const BYTE *bytes, WORD pc, char *text, size_t size) {
+    BYTE opcode = bytes[0];
+    if(opcode == 0xCB) {
+        Template(0x100 + bytes[1], text, size);
+        return 2;
+    }
+
+    char format[32];
+    Template(opcode, format, sizeof(format));
+    int length = InstructionLength(opcode);
+    WORD word = bytes[1] | (bytes[2] << 8);
+    SIGNED_BYTE offset = (SIGNED_BYTE)bytes[1];
+
+    // swap the one operand placeholder for its value
+    char operand[16] = "";
+    const char *at = NULL;
+    if((at = strstr(format, "d16")) != NULL || (at = strstr(format, "a16")) != NULL)
+        snprintf(operand, sizeof(operand), "%04XH", word);
+    else if((at = strstr(format, "a8")) != NULL)
+        snprintf(operand, sizeof(operand), "FF%02XH", bytes[1]);
+    else if((at = strstr(format, "d8")) != NULL)
+        snprintf(operand, sizeof(operand), "%02XH", bytes[1]);
+    else if((at = strstr(format, "r8")) != NULL)
+        snprintf(operand, sizeof(operand), "%04XH", (WORD)(pc + 2 + offset));
+    else if((at = strstr(format, "s8")) != NULL)
+        snprintf(operand, sizeof(operand), "%+d", offset);
+
+    if(at == NULL) {
+        snprintf(text, size, "%s", format);
+    } else {
+        // the sign of a signed offset replaces the + in front of it
+        int prefix = (int)(at - format);
+        if((at[0] == 's') && (prefix > 0) && (format[prefix - 1] == '+'))
+            prefix--;
+        int placeholder = (at[1] == '1') ? 3 : 2;
+        snprintf(text, size, "%.*s%s%s", prefix, format, operand, at + placeholder);
+    }
+
+    return length;
+}
+
+void ReadCode(const Emulator &emulator, int bank, WORD address, BYTE *bytes) {
+    for(int i = 0; i < MAX_INSTRUCTION_LENGTH; i++) {
+        WORD at = address + i;
+        if(at >= 0x8000)
+            bytes[i] = emulator.ReadMemory(at);
+        else if(at >= 0x4000)
+            bytes[i] = emulator.m_CartridgeMemory[((bank * 0x4000) + (at - 0x4000)) % CARTRIDGE_SIZE];
+        else
+            bytes[i] = emulator.m_CartridgeMemory[at];
+    }
+}
+
+int DataReads(const Emulator &e, WORD *addresses) {
+    WORD pc = e.m_ProgramCounter;
+    BYTE opcode = e.ReadMemory(pc);
+    WORD hl = e.m_RegisterHL.reg;
+    WORD sp = e.m_StackPointer.reg;
+    BYTE flags = e.m_RegisterAF.lo;
+
+    switch(opcode) {
+        case 0x0A: addresses[0] = e.m_RegisterBC.reg; return 1;
+        case 0x1A: addresses[0] = e.m_RegisterDE.reg; return 1;
+        case 0x2A: case 0x3A: case 0x34: case 0x35:
+        case 0x46: case 0x4E: case 0x56: case 0x5E: case 0x66: case 0x6E: case 0x7E:
+        case 0x86: case 0x8E: case 0x96: case 0x9E: case 0xA6: case 0xAE: case 0xB6: case 0xBE:
+            addresses[0] = hl;
+            return 1;
+        case 0xF0: addresses[0] = 0xFF00 + e.ReadMemory(pc + 1); return 1;
+        case 0xF2: addresses[0] = 0xFF00 + e.m_RegisterBC.lo; return 1;
+        case 0xFA: addresses[0] = e.ReadMemory(pc + 1) | (e.ReadMemory(pc + 2) << 8); return 1;
+        case 0xCB: {
+            // every cb opcode with a low 6 works on (HL)
+            if((e.ReadMemory(pc + 1) & 0x7) != 0x6)
+                return 0;
+            addresses[0] = hl;
+            return 1;
+        }
+        case 0xC0: if(TestBit(flags, FLAG_Z)) return 0; break;
+        case 0xC8: if(!TestBit(flags, FLAG_Z)) return 0; break;
+        case 0xD0: if(TestBit(flags, FLAG_C)) return 0; break;
+        case 0xD8: if(!TestBit(flags, FLAG_C)) return 0; break;
+        case 0xC1: case 0xD1: case 0xE1: case 0xF1: case 0xC9: case 0xD9: break;
+        default: return 0;
+    }
+
+    // pops and returns read the top of the stack
+    addresses[0] = sp;
+    addresses[1] = sp + 1;
+    return 2;
+}
+
+int DataWrites(const Emulator &e, WORD *addresses) {
+    WORD pc = e.m_ProgramCounter;
+    BYTE opcode = e.ReadMemory(pc);
+    WORD hl = e.m_RegisterHL.reg;
+    WORD sp = e.m_StackPointer.reg;
+    BYTE flags = e.m_RegisterAF.lo;
+    WORD word = e.ReadMemory(pc + 1) | (e.ReadMemory(pc + 2) << 8);
+
+    switch(opcode) {
+        case 0x02: addresses[0] = e.m_RegisterBC.reg; return 1;
+        case 0x12: addresses[0] = e.m_RegisterDE.reg; return 1;
+        case 0x22: case 0x32: case 0x34: case 0x35: case 0x36:
+        case 0x70: case 0x71: case 0x72: case 0x73: case 0x74: case 0x75: case 0x77:
+            addresses[0] = hl;
+            return 1;
+        case 0x08: addresses[0] = word; addresses[1] = word + 1; return 2;
+        case 0xE0: addresses[0] = 0xFF00 + e.ReadMemory(pc + 1); return 1;
+        case 0xE2: addresses[0] = 0xFF00 + e.m_RegisterBC.lo; return 1;
+        case 0xEA: addresses[0] = word; return 1;
+        case 0xCB: {
+            // bit only tests, the other (HL) forms write back
+            BYTE cb = e.ReadMemory(pc + 1);
+            if(((cb & 0x7) != 0x6) || ((cb >= 0x40) && (cb < 0x80)))
+                return 0;
+            addresses[0] = hl;
+            return 1;
+        }
+        case 0xC4: if(TestBit(flags, FLAG_Z)) return 0; break;
+        case 0xCC: if(!TestBit(flags, FLAG_Z)) return 0; break;
+        case 0xD4: if(TestBit(flags, FLAG_C)) return 0; break;
+        case 0xDC: if(!TestBit(flags, FLAG_C)) return 0; break;
+        case 0xC5: case 0xD5: case 0xE5: case 0xF5: case 0xCD:
+        case 0xC7: case 0xCF: case 0xD7: case 0xDF: case 0xE7: case 0xEF: case 0xF7: case 0xFF:
+            break;
+        default: return 0;
+    }
+
+    // pushes, calls and restarts write below the stack pointer
+    addresses[0] = sp - 1;
+    addresses[1] = sp - 2;
+    return 2;
+}
@@ -0,0 +1,31 @@
+#ifndef DISASSEMBLER_H
+#define DISASSEMBLER_H
+
+#include "Config.h"
+#include "Emulator.h"
+
+// longest instruction, opcode included
+#define MAX_INSTRUCTION_LENGTH 3
+
+/**
+ * Text for one instruction. bytes points at the opcode and has to hold
+ * MAX_INSTRUCTION_LENGTH bytes, pc is where it sits so relative jumps can
+ * show their target. Returns the instruction's length
+ */
+int Disassemble(const BYTE *bytes, WORD pc, char *text, size_t size);
+
+int InstructionLength(BYTE opcode);
+
+// name of an opcode without operands, 0x100 + n for CB n
+const char *OpcodeName(int opcode);
+
+// instruction bytes at an address as they are in the given rom bank, ram
+// as it is now
+void ReadCode(const Emulator &emulator, int bank, WORD address, BYTE *bytes);
+
+// data addresses the instruction at PC is about to read or write, operand
+// fetches don't count. Both return how many there are, at most 2
+int DataReads(const Emulator &emulator, WORD *addresses);
+int DataWrites(const Emulator &emulator, WORD *addresses);
+
+#endif
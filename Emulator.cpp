@@ -2,6 +2,7 @@
 #include "Emulator.h"
 #include <iostream>
 #include <cstring>
+#include <chrono>
 
 // register flags
 #define FLAG_Z 7
@@ -13,7 +14,6 @@
 #define TIMA 0xFF05
 #define TMA 0xFF06
 #define TMC 0xFF07
-#define CLOCKSPEED 4194304
 
 Emulator::Emulator() {
     // initializing starting state
@@ -23,66 +23,45 @@ Emulator::Emulator() {
     m_RegisterDE.reg = 0x00D8;
     m_RegisterHL.reg = 0x014D;
     m_StackPointer.reg = 0xFFFE;
-    m_Rom[0xFF05] = 0x00;
-    m_Rom[0xFF06] = 0x00;
-    m_Rom[0xFF07] = 0x00;
-    m_Rom[0xFF10] = 0x80;
-    m_Rom[0xFF11] = 0xBF;
-    m_Rom[0xFF12] = 0xF3;
-    m_Rom[0xFF14] = 0xBF;
-    m_Rom[0xFF16] = 0x3F;
-    m_Rom[0xFF17] = 0x00;
-    m_Rom[0xFF19] = 0xBF;
-    m_Rom[0xFF1A] = 0x7F;
-    m_Rom[0xFF1B] = 0xFF;
-    m_Rom[0xFF1C] = 0x9F;
-    m_Rom[0xFF1E] = 0xBF;
-    m_Rom[0xFF20] = 0xFF;
-    m_Rom[0xFF21] = 0x00;
-    m_Rom[0xFF22] = 0x00;
-    m_Rom[0xFF23] = 0xBF;
-    m_Rom[0xFF24] = 0x77;
-    m_Rom[0xFF25] = 0xF3;
-    m_Rom[0xFF26] = 0xF1;
-    m_Rom[0xFF40] = 0x91;
-    m_Rom[0xFF42] = 0x00;
-    m_Rom[0xFF43] = 0x00;
-    m_Rom[0xFF45] = 0x00;
-    m_Rom[0xFF47] = 0xFC;
-    m_Rom[0xFF48] = 0xFF;
-    m_Rom[0xFF49] = 0xFF;
-    m_Rom[0xFF4A] = 0x00;
-    m_Rom[0xFF4B] = 0x00;
-    m_Rom[0xFFFF] = 0x00;
-
-    // load a cartridge into memory
-    memset(m_CartridgeMemory, 0, sizeof(m_CartridgeMemory));
-
-    FILE *in;
-    in = fopen("Tetris.gb", "rb");
-    fread(m_CartridgeMemory, 1, 0x200000, in);
-    fclose(in);
-
-    // detect rom bank mode
-    m_MBC1 = false;
-    m_MBC2 = false;
-    m_ROMBanking = false;
-    switch(m_CartridgeMemory[0x147]) {
-        case 1 : m_MBC1 = true; break;
-        case 2 : m_MBC1 = true; break;
-        case 3 : m_MBC1 = true; break;
-        case 5 : m_MBC2 = true; break;
-        case 6 : m_MBC2 = true; break;
-        default : break;
-    }
-
-    // specify which rom bank is loaded into internal memory
-    m_CurrentROMBank = 1;
+    m_Memory.Write(0xFF05, 0x00);
+    m_Memory.Write(0xFF06, 0x00);
+    m_Memory.Write(0xFF07, 0x00);
+    m_Memory.Write(0xFF10, 0x80);
+    m_Memory.Write(0xFF11, 0xBF);
+    m_Memory.Write(0xFF12, 0xF3);
+    m_Memory.Write(0xFF14, 0xBF);
+    m_Memory.Write(0xFF16, 0x3F);
+    m_Memory.Write(0xFF17, 0x00);
+    m_Memory.Write(0xFF19, 0xBF);
+    m_Memory.Write(0xFF1A, 0x7F);
+    m_Memory.Write(0xFF1B, 0xFF);
+    m_Memory.Write(0xFF1C, 0x9F);
+    m_Memory.Write(0xFF1E, 0xBF);
+    m_Memory.Write(0xFF20, 0xFF);
+    m_Memory.Write(0xFF21, 0x00);
+    m_Memory.Write(0xFF22, 0x00);
+    m_Memory.Write(0xFF23, 0xBF);
+    m_Memory.Write(0xFF24, 0x77);
+    m_Memory.Write(0xFF25, 0xF3);
+    m_Memory.Write(0xFF26, 0xF1);
+    m_Memory.Write(0xFF40, 0x91);
+    m_Memory.Write(0xFF42, 0x00);
+    m_Memory.Write(0xFF43, 0x00);
+    m_Memory.Write(0xFF45, 0x00);
+    m_Memory.Write(0xFF47, 0xFC);
+    m_Memory.Write(0xFF48, 0xFF);
+    m_Memory.Write(0xFF49, 0xFF);
+    m_Memory.Write(0xFF4A, 0x00);
+    m_Memory.Write(0xFF4B, 0x00);
+    m_Memory.Write(0xFFFF, 0x00);
+
+    // load a cartridge into memory, the image is shared with every fork
+    m_CartridgeMemory = m_Memory.Cartridge();
+    LoadCartridge("Tetris.gb");
 
     // initialize ram banking
     m_UsingMemoryModel16_8 = true;
     m_EnableRAM = false;
-    memset(&m_RAMBanks, 0, sizeof(m_RAMBanks));
     m_CurrentRAMBank = 0;
 
     // initialize timer
@@ -92,6 +71,8 @@ Emulator::Emulator() {
     m_DividerRegister = 0;
     m_CurrentClockSpeed = 1024;
     m_CyclesThisUpdate = 0;
+    m_FrameStart = 0;
+    m_TotalOpcodes = 0;
     m_Halted = false;
 
     // initialize interrupts
@@ -101,28 +82,321 @@ Emulator::Emulator() {
 
     // initialize scanline
     m_ScanlineCounter = 0;
+    m_Headless = false;
+    memset(m_ScreenShades, 0, sizeof(m_ScreenShades));
 
     // joypad
     m_JoypadState = 0xFF;
 
+    // no observers
+    memset(&m_Sink, 0, sizeof(m_Sink));
+    m_MutedEvents = 0;
+
+}
+
+/**
+ * Load a rom image, only valid before the emulator has been forked since
+ * the image is shared
+ */
+bool Emulator::LoadCartridge(const char *path) {
+    memset(m_CartridgeMemory, 0, CARTRIDGE_SIZE);
+
+    FILE *in = fopen(path, "rb");
+    size_t size = 0;
+    if(in != NULL) {
+        size = fread(m_CartridgeMemory, 1, CARTRIDGE_SIZE, in);
+        fclose(in);
+    }
+
+    CartridgeLoaded();
+    return size > 0;
+}
+
+/**
+ * Load a rom image from memory, anything past 2MB is dropped
+ */
+bool Emulator::LoadCartridge(const BYTE *data, size_t size) {
+    if(size > CARTRIDGE_SIZE)
+        size = CARTRIDGE_SIZE;
+
+    memset(m_CartridgeMemory, 0, CARTRIDGE_SIZE);
+    memcpy(m_CartridgeMemory, data, size);
+
+    CartridgeLoaded();
+    return size > 0;
+}
+
+/**
+ * Set up the mapper for the image now in m_CartridgeMemory
+ */
+void Emulator::CartridgeLoaded() {
+    m_Memory.ClearROMPatches();
+
+    // detect rom bank mode
+    m_MBC1 = false;
+    m_MBC2 = false;
+    m_ROMBanking = false;
+    switch(m_CartridgeMemory[0x147]) {
+        case 1 : m_MBC1 = true; break;
+        case 2 : m_MBC1 = true; break;
+        case 3 : m_MBC1 = true; break;
+        case 5 : m_MBC2 = true; break;
+        case 6 : m_MBC2 = true; break;
+        default : break;
+    }
+
+    // specify which rom bank is loaded into internal memory
+    m_CurrentROMBank = 1;
+    m_Memory.MapROM(m_CurrentROMBank);
+
+    // color cartridges start in color mode at normal speed, the boot rom
+    // leaves 0x11 in A so games can tell they are on a color game boy
+    m_CGB = (m_CartridgeMemory[0x143] & 0x80) != 0;
+    m_SpeedShift = 0;
+    m_DMAStall = 0;
+    m_HDMAActive = false;
+    m_HDMASource = 0;
+    m_HDMADestination = 0x8000;
+    m_HDMABlocks = 0;
+    m_Memory.MapVRAM(0);
+    m_Memory.MapWRAM(1);
+    if(m_CGB) {
+        m_RegisterAF.hi = 0x11;
+        m_Memory.Write(0xFF4D, 0x7E);
+        m_Memory.Write(0xFF4F, 0xFE);
+        m_Memory.Write(0xFF55, 0xFF);
+        m_Memory.Write(0xFF70, 0xF9);
+    }
+}
+
+/**
+ * Copy of this emulator that shares all memory pages copy-on-write, so it
+ * costs the pages either side writes afterwards instead of a full copy.
+ * Forking takes away this emulator's write access to its pages, so it
+ * must not be running on another thread meanwhile. Once Fork returns the
+ * two can run on different threads
+ */
+Emulator *Emulator::Fork() const {
+    return new Emulator(*this);
 }
 
 /**
  * Emulation loop
  */
 void Emulator::Update() {
-    const int MAX_CYCLES = 69905;
+    RunCycles(FRAME_CYCLES);
+    EndFrame();
+
+    // RenderScreen();
+}
+
+/**
+ * Synthesize the sound since the last EndFrame in one go and hand the
+ * sound and the screen to the observers. Update does this itself, callers
+ * stepping with the Run functions call it once a frame
+ */
+void Emulator::EndFrame() {
+    int samples = m_APU.SamplesAvailable();
+    int end = m_APU.EndFrame(m_CyclesThisUpdate);
+    m_CyclesThisUpdate -= end;
+    m_FrameStart += end;
+    m_Memory.Write(0xFF26, (m_Memory.Read(0xFF26) & 0x80) | 0x70 | m_APU.ChannelStatus());
+
+    if(m_APU.SamplesAvailable() > samples)
+        Notify(EVENT_AUDIO, m_APU.SamplesAvailable() - samples);
+    Notify(EVENT_FRAME, 0);
+}
+
+/**
+ * Execute the next opcode and return the cpu cycles it took, any dma stall
+ * included. Handlers that don't count their own cycles still take a
+ * machine cycle
+ */
+int Emulator::ExecuteInstruction() {
+    int before = m_CyclesThisUpdate;
+    ExecuteNextOpcode();
+
+    int cycles = m_CyclesThisUpdate - before;
+    return ChargeCycles(before, (cycles < 4) ? 4 : cycles);
+}
+
+/**
+ * Add any dma stall to an instruction that started at cycle before and
+ * took cycles on the cpu clock, and move m_CyclesThisUpdate on by the
+ * time that really passed. The timers run on the cycles returned, the
+ * rest of the machine on FrameCycles of them
+ */
+int Emulator::ChargeCycles(int before, int cycles) {
+    if((m_DMAStall == 0) && (m_SpeedShift == 0))
+        return cycles;
+
+    cycles += m_DMAStall;
+    m_CyclesThisUpdate = before + FrameCycles((m_CyclesThisUpdate - before) + m_DMAStall);
+    m_DMAStall = 0;
+    return cycles;
+}
+
+/**
+ * Run one instruction and everything clocked by it, returns the cycles it
+ * took on the frame clock
+ */
+int Emulator::Step() {
+    int cycles = ExecuteInstruction();
+    UpdateTimers(cycles);
+    cycles = FrameCycles(cycles);
+    UpdateGraphics(cycles);
+    DoInterrupts();
+    return cycles;
+}
+
+/**
+ * Run whole instructions until at least the given number of cycles have
+ * passed, the last one can go past by its own length
+ */
+RunResult Emulator::RunCycles(int cycles) {
+    RunResult result;
+    result.cycles = 0;
+
+    while(result.cycles < cycles)
+        result.cycles += Step();
+
+    result.overshoot = result.cycles - cycles;
+    result.reached = true;
+    return result;
+}
+
+/**
+ * Run until LY moves on to the given line, line 144 being the start of
+ * VBlank. Overshoot is how far into the line the last instruction ran.
+ * Gives up after maxCycles, the line never comes while the lcd is off
+ */
+RunResult Emulator::RunUntilLine(BYTE line, int maxCycles) {
+    RunResult result;
+    result.cycles = 0;
+    result.overshoot = 0;
+    result.reached = false;
+
+    while(result.cycles < maxCycles) {
+        BYTE lineBefore = m_Memory.Read(0xFF44);
+        int counterBefore = m_ScanlineCounter;
+        int cycles = Step();
+        result.cycles += cycles;
+
+        if((m_Memory.Read(0xFF44) == line) && (lineBefore != line)) {
+            result.overshoot = (cycles > counterBefore) ? cycles - counterBefore : 0;
+            result.reached = true;
+            break;
+        }
+    }
+
+    return result;
+}
+
+RunResult Emulator::RunUntilVBlank(int maxCycles) {
+    return RunUntilLine(144, maxCycles);
+}
+
+/**
+ * Run until the next instruction to execute is at pc. At least one
+ * instruction runs, so calling it again goes round a loop once more
+ */
+RunResult Emulator::RunUntilPC(WORD pc, int maxCycles) {
+    RunResult result;
+    result.cycles = 0;
+    result.overshoot = 0;
+    result.reached = false;
+
+    while(result.cycles < maxCycles) {
+        result.cycles += Step();
+        if(m_ProgramCounter == pc) {
+            result.reached = true;
+            break;
+        }
+    }
+
+    return result;
+}
+
+/**
+ * Stop RunUntilWatch when a write to address meets the condition. Cartridge
+ * ram is watched in the bank selected now, rom can't be watched since
+ * writes to it never reach memory. Returns the watch's id or -1
+ */
+int Emulator::AddWatch(WORD address, MemoryMap::WATCH kind, BYTE value, BYTE mask) {
+    if(address < 0x8000)
+        return -1;
+
+    if((address >= 0xA000) && (address < 0xC000)) {
+        int offset = (address - 0xA000) + (m_CurrentRAMBank * 0x2000);
+        return m_Memory.AddWatch(NUM_ADDRESS_PAGES + (offset >> PAGE_SHIFT), offset & PAGE_MASK, kind, value, mask);
+    }
+
+    return m_Memory.AddWatch(address >> PAGE_SHIFT, address & PAGE_MASK, kind, value, mask);
+}
+
+void Emulator::RemoveWatch(int id) {
+    m_Memory.RemoveWatch(id);
+}
+
+/**
+ * Run until a write meets one of the watches, stopping after the
+ * instruction that made it. m_Memory.FiredWatch() says which one
+ */
+RunResult Emulator::RunUntilWatch(int maxCycles) {
+    RunResult result;
+    result.cycles = 0;
+    result.overshoot = 0;
+    result.reached = false;
+
+    m_Memory.ResetFiredWatch();
+    while(result.cycles < maxCycles) {
+        result.cycles += Step();
+        if(m_Memory.FiredWatch() >= 0) {
+            result.reached = true;
+            break;
+        }
+    }
+
+    return result;
+}
+
+/**
+ * Update with the host time of every subsystem added to times. Reading the
+ * clock around each step costs about as much as the step itself, so only
+ * use this on a sample of frames and compare the shares
+ */
+void Emulator::UpdateTimed(SubsystemTimes &times) {
+    typedef std::chrono::steady_clock Clock;
     int cyclesThisUpdate = 0;
 
-    while(cyclesThisUpdate < MAX_CYCLES) {
-        int cycles = ExecuteNextOpcode();
-        cyclesThisUpdate += cycles;
+    Clock::time_point last = Clock::now();
+    while(cyclesThisUpdate < FRAME_CYCLES) {
+        int cycles = ExecuteInstruction();
+        Clock::time_point now = Clock::now();
+        times.cpu += std::chrono::duration<double>(now - last).count();
+        last = now;
+
         UpdateTimers(cycles);
+        now = Clock::now();
+        times.timers += std::chrono::duration<double>(now - last).count();
+        last = now;
+
+        cycles = FrameCycles(cycles);
+        cyclesThisUpdate += cycles;
+
         UpdateGraphics(cycles);
+        now = Clock::now();
+        times.graphics += std::chrono::duration<double>(now - last).count();
+        last = now;
+
         DoInterrupts();
+        now = Clock::now();
+        times.interrupts += std::chrono::duration<double>(now - last).count();
+        last = now;
     }
 
-    // RenderScreen();
+    EndFrame();
+    times.sound += std::chrono::duration<double>(Clock::now() - last).count();
 }
 
 /**
@@ -136,17 +410,17 @@ void Emulator::WriteMemory(WORD address, BYTE data) {
     } else if((address >= 0xA000) && (address < 0xC000)) {
         if(m_EnableRAM) {
             WORD newAddress = address - 0xA000;
-            m_RAMBanks[newAddress + (m_CurrentRAMBank * 0x2000)] = data;
+            m_Memory.WriteRAM(newAddress + (m_CurrentRAMBank * 0x2000), data);
         }
     } else if((address >= 0xE000) && (address < 0xFE00)) {
         // writing to ECHO ram also writes in RAM
-        m_Rom[address] = data;
+        m_Memory.Write(address, data);
         WriteMemory(address - 0x2000, data);
     } else if((address >= 0xFEA0) && (address < 0xFEFF)) {
         // this area is restricted
     } else if(TMC == address) {
         BYTE currentFreq = GetClockFreq();
-        m_CartridgeMemory[TMC] = data;
+        m_Memory.Write(TMC, data);
         BYTE newFreq = GetClockFreq();
 
         if(currentFreq != newFreq) {
@@ -154,13 +428,18 @@ void Emulator::WriteMemory(WORD address, BYTE data) {
         }
     } else if(0xFF04 == address) {
         // trap the divider register
-        m_Rom[0xFF04] = 0;
+        m_Memory.Write(0xFF04, 0);
+        m_DividerCounter = 0;
     } else if(address == 0xFF44) {
-        m_Rom[address] = 0;
+        m_Memory.Write(address, 0);
     } else if(address == 0xFF46) {
         DoDMATransfer(data);
+    } else if((address >= 0xFF10) && (address < 0xFF40)) {
+        // sound registers, the apu catches up to now before taking the write
+        m_Memory.Write(address, data);
+        m_APU.Write(address, data, m_CyclesThisUpdate);
     } else {
-        m_Rom[address] = data;
+        m_Memory.Write(address, data);
     }
 
 }
@@ -169,20 +448,17 @@ void Emulator::WriteMemory(WORD address, BYTE data) {
  * Safely read from available memory
  */
 BYTE Emulator::ReadMemory(WORD address) const {
-    if((address >= 0x4000) && (address <= 0x7FFF)) {
-        // reading from rom memory bank
-        WORD newAddress = address - 0x4000;
-        return m_CartridgeMemory[newAddress + (m_CurrentROMBank * 0x4000)];
-    } else if((address >= 0xA000) && (address <= 0xBFFF)) {
+    // the rom banks are mapped into memory
+    if((address >= 0xA000) && (address <= 0xBFFF)) {
         // reading from ram memory bank
         WORD newAddress = address - 0xA000;
-        return m_RAMBanks[newAddress + (m_CurrentRAMBank * 0x2000)];
+        return m_Memory.ReadRAM(newAddress + (m_CurrentRAMBank * 0x2000));
     } else if(0xFF00 == address) {
         return GetJoypadState();
     }
 
     // else, return memory
-    return m_Rom[address];
+    return m_Memory.Read(address);
 }
 
 /**
@@ -238,6 +514,7 @@ void Emulator::DoChangeLoROMBank(BYTE data) {
     if(m_MBC2) {
         m_CurrentROMBank = data & 0xF;
         if(m_CurrentROMBank == 0) m_CurrentROMBank++;
+        m_Memory.MapROM(m_CurrentROMBank);
         return;
     }
 
@@ -245,6 +522,7 @@ void Emulator::DoChangeLoROMBank(BYTE data) {
     m_CurrentROMBank &= 224;
     m_CurrentROMBank |= lower5;
     if(m_CurrentROMBank == 0) m_CurrentROMBank++;
+    m_Memory.MapROM(m_CurrentROMBank);
 }
 
 /**
@@ -258,6 +536,7 @@ void Emulator::DoChangeHiRomBank(BYTE data) {
     data &= 224;
     m_CurrentROMBank |= data;
     if(m_CurrentROMBank == 0) m_CurrentROMBank++;
+    m_Memory.MapROM(m_CurrentROMBank);
 }
 
 /**
@@ -331,23 +610,27 @@ void Emulator::SetClockFreq() {
 }
 
 /**
- * Divider register
+ * Divider register, counts up once every 256 cycles
  */
 void Emulator::DoDividerRegister(int cycles) {
-    m_DividerRegister += cycles;
-    if(m_DividerCounter >= 255) {
-        m_DividerCounter = 0;
-        m_Rom[0xFF04]++;
+    m_DividerCounter += cycles;
+    while(m_DividerCounter >= 256) {
+        m_DividerCounter -= 256;
+        m_Memory.Write(0xFF04, m_Memory.Read(0xFF04) + 1);
     }
 }
 
 /**
- * Requesting an interrupt
+ * Requesting an interrupt, sinks only hear of it when the IF bit goes
+ * from 0 to 1, not again for a request that is still pending
  */
 void Emulator::RequestInterrupt(int id) {
     BYTE req = ReadMemory(0xFF0F);
+    bool pending = TestBit(req, id);
     req = BitSet(req, id);
-    WriteMemory(0xFF0F, id);
+    WriteMemory(0xFF0F, req);
+    if(!pending)
+        Notify(EVENT_INTERRUPT, id);
 }
 
 /**
@@ -359,9 +642,10 @@ void Emulator::DoInterrupts() {
         BYTE enabled = ReadMemory(0xFFFF);
         if(req > 0) {
             for(int i = 0; i < 5; i++) {
-                if(TestBit(req, i) == true) {
-                    if(TestBit(enabled, i))
-                        ServiceInterrupt(i);
+                // only the highest priority one, servicing it disables the rest
+                if(TestBit(req, i) && TestBit(enabled, i)) {
+                    ServiceInterrupt(i);
+                    return;
                 }
             }
         }
@@ -372,6 +656,12 @@ void Emulator::DoInterrupts() {
  * Process the current interrupt
  */
 void Emulator::ServiceInterrupt(int interrupt) {
+#ifdef GB_TRACE
+    TraceRecord record = {(unsigned)Cycles(), m_ProgramCounter, m_RegisterAF.reg, m_RegisterBC.reg, m_RegisterDE.reg,
+        m_RegisterHL.reg, m_StackPointer.reg, m_CurrentROMBank, 0, TraceRing::TRACE_INTERRUPT, (BYTE)interrupt};
+    m_Trace.Record(record);
+#endif
+
     m_InterruptMaster = false;
     BYTE req = ReadMemory(0xFF0F);
     req = BitReset(req, interrupt);
@@ -384,6 +674,7 @@ void Emulator::ServiceInterrupt(int interrupt) {
         case 0: m_ProgramCounter = 0x40; break;
         case 1: m_ProgramCounter = 0x48; break;
         case 2: m_ProgramCounter = 0x50; break;
+        case 3: m_ProgramCounter = 0x58; break;
         case 4: m_ProgramCounter = 0x60; break;
     }
 }
@@ -399,21 +690,27 @@ void Emulator::UpdateGraphics(int cycles) {
     else
         return;
 
+    // the pixel fifo tier clocks mode 3 up to the current dot
+    m_PPU.Step(*this, 456 - m_ScanlineCounter);
+
     if(m_ScanlineCounter <= 0) {
         // move onto the next scanline
-        m_Rom[0xFF44]++;
+        m_Memory.Write(0xFF44, m_Memory.Read(0xFF44) + 1);
         BYTE currentLine = ReadMemory(0xFF44);
 
         m_ScanlineCounter = 456;
 
         
-        if(currentLine == 144)
+        if(currentLine == 144) {
             // we have entered vertical blank period
             RequestInterrupt(0);
-        else if(currentLine > 153)
+            Notify(EVENT_VBLANK, 0);
+            if(!m_RAMPatches.empty())
+                ApplyRAMPatches();
+        } else if(currentLine > 153)
             // if gone past scanline 153 reset to 0
-            m_Rom[0xFF44] = 0;
-        else if(currentLine < 144)
+            m_Memory.Write(0xFF44, 0);
+        else if((currentLine < 144) && !PPUPolicy::PIXEL_FIFO && !m_Headless)
             // draw the current scan line
             DrawScanLine();
     }
@@ -424,10 +721,10 @@ void Emulator::UpdateGraphics(int cycles) {
  */
 void Emulator::SetLCDStatus() {
     BYTE status = ReadMemory(0xFF41);
-    if(false == IsClockEnabled()) {
+    if(false == IsLCDEnabled()) {
         // set the mode to 1 during lcd disabled and reset scanline
         m_ScanlineCounter = 456;
-        m_Rom[0xFF44] = 0;
+        m_Memory.Write(0xFF44, 0);
         status &= 252;
         status = BitSet(status, 0);
         WriteMemory(0xFF41, status);
@@ -448,7 +745,7 @@ void Emulator::SetLCDStatus() {
         reqInt = TestBit(status, 4);
     } else {
         int mode2bounds = 456 - 80;
-        int mode3bounds = mode2bounds - 172;
+        int mode3bounds = mode2bounds - m_PPU.Mode3Length();
 
         if(m_ScanlineCounter >= mode2bounds) {
             // mode 2
@@ -470,6 +767,10 @@ void Emulator::SetLCDStatus() {
         }
     }
 
+    // hblank dma copies a block as each hblank starts
+    if((mode == 0) && (currentMode != 0) && m_HDMAActive)
+        DoHDMABlock();
+
     // just entered a mnew mode so request interrupt
     if(reqInt && (mode != currentMode))
         RequestInterrupt(1);
@@ -495,15 +796,107 @@ bool Emulator::IsLCDEnabled() const {
 }
 
 /**
- * DMA transfer
+ * OAM DMA, the 160 bytes at data * 0x100 go to 0xFE00 in one run. The cpu
+ * goes on while the real one copies, games wait it out in hram
  */
 void Emulator::DoDMATransfer(BYTE data) {
-    WORD address = data << 8; // source address is data * 100
-    for(int i = 0; i < 0xA0; i++) {
-        WriteMemory(0xFE00 + i, ReadMemory(address + i));
+    DMACopy(0xFE00, data << 8, 0xA0);
+}
+
+/**
+ * Where a dma reads address from, cartridge ram in the selected bank and
+ * echo ram in the work ram it mirrors
+ */
+const BYTE *Emulator::DMASource(WORD address) const {
+    if((address >= 0xA000) && (address < 0xC000)) {
+        int offset = (address - 0xA000) + (m_CurrentRAMBank * 0x2000);
+        return m_Memory.PageData(NUM_ADDRESS_PAGES + (offset >> PAGE_SHIFT)) + (offset & PAGE_MASK);
+    }
+
+    if((address >= 0xE000) && (address < 0xFE00))
+        address -= 0x2000;
+    return m_Memory.PageData(address >> PAGE_SHIFT) + (address & PAGE_MASK);
+}
+
+/**
+ * Copy between mapped pages in runs that stay within a page on both sides
+ */
+void Emulator::DMACopy(WORD destination, WORD source, int length) {
+    while(length > 0) {
+        int run = PAGE_SIZE - (source & PAGE_MASK);
+        int room = PAGE_SIZE - (destination & PAGE_MASK);
+        if(room < run)
+            run = room;
+        if(length < run)
+            run = length;
+
+        m_Memory.Copy(destination, DMASource(source), run);
+        destination += run;
+        source += run;
+        length -= run;
+    }
+}
+
+/**
+ * A write to HDMA5. With bit 7 clear everything is copied now and the cpu
+ * waits for it, with bit 7 set a 16 byte block goes every hblank. Writing
+ * bit 7 clear while an hblank dma runs stops it instead
+ */
+void Emulator::DoHDMATransfer(BYTE data) {
+    if(m_HDMAActive && !TestBit(data, 7)) {
+        m_HDMAActive = false;
+        m_Memory.Write(0xFF55, 0x80 | (m_HDMABlocks - 1));
+        return;
+    }
+
+    m_HDMASource = ((m_Memory.Read(0xFF51) << 8) | m_Memory.Read(0xFF52)) & 0xFFF0;
+    m_HDMADestination = 0x8000 | (((m_Memory.Read(0xFF53) << 8) | m_Memory.Read(0xFF54)) & 0x1FF0);
+    m_HDMABlocks = (data & 0x7F) + 1;
+
+    if(TestBit(data, 7)) {
+        m_HDMAActive = true;
+        m_Memory.Write(0xFF55, data & 0x7F);
+        return;
+    }
+
+    // 8 machine cycles a block, twice as many cpu cycles in double speed
+    DMACopy(m_HDMADestination, m_HDMASource, m_HDMABlocks * 16);
+    m_DMAStall += (m_HDMABlocks * 32) << m_SpeedShift;
+    m_HDMABlocks = 0;
+    m_Memory.Write(0xFF55, 0xFF);
+}
+
+/**
+ * Copy the next block of an hblank dma, the cpu waits for it like it
+ * waits for a general one
+ */
+void Emulator::DoHDMABlock() {
+    DMACopy(m_HDMADestination, m_HDMASource, 16);
+    m_HDMASource += 16;
+    m_HDMADestination = 0x8000 | ((m_HDMADestination + 16) & 0x1FF0);
+    m_DMAStall += 32 << m_SpeedShift;
+
+    m_HDMABlocks--;
+    if(m_HDMABlocks == 0) {
+        m_HDMAActive = false;
+        m_Memory.Write(0xFF55, 0xFF);
+    } else {
+        m_Memory.Write(0xFF55, m_HDMABlocks - 1);
     }
 }
 
+/**
+ * STOP with a switch armed in KEY1 changes the cpu speed of a color game
+ * boy, KEY1 bit 7 then reads the new speed
+ */
+void Emulator::DoSpeedSwitch() {
+    if(!m_CGB || !TestBit(m_Memory.Read(0xFF4D), 0))
+        return;
+
+    m_SpeedShift ^= 1;
+    m_Memory.Write(0xFF4D, 0x7E | (m_SpeedShift << 7));
+}
+
 /**
  * Draw a single scanline
  */
@@ -644,6 +1037,7 @@ void Emulator::RenderTiles(BYTE lcdControl) {
         m_ScreenData[pixel][finally][0] = red;
         m_ScreenData[pixel][finally][1] = green;
         m_ScreenData[pixel][finally][2] = blue;
+        m_ScreenShades[finally][pixel] = col;
     } 
 }
 
@@ -729,6 +1123,7 @@ void Emulator::RenderSprites(BYTE lcdControl) {
          m_ScreenData[pixel][scanline][0] = red;
          m_ScreenData[pixel][scanline][1] = green;
          m_ScreenData[pixel][scanline][2] = blue;
+         m_ScreenShades[scanline][pixel] = col;
        }
      }
    }
@@ -785,7 +1180,7 @@ void Emulator::KeyPressed(int key) {
     else // directional button
         button = false;
 
-    BYTE keyReq = m_Rom[0xFF00];
+    BYTE keyReq = m_Memory.Read(0xFF00);
     bool requestInterrupt = false;
 
     // only request interrupt if the button just pressed
@@ -811,7 +1206,7 @@ void Emulator::KeyReleased(int key) {
  * Get current joypad state
  */
 BYTE Emulator::GetJoypadState() const {
-    BYTE res = m_Rom[0xFF00];
+    BYTE res = m_Memory.Read(0xFF00);
     // flip all the bits
     res ^= 0xFF;
 
@@ -836,13 +1231,19 @@ BYTE Emulator::GetJoypadState() const {
 BYTE Emulator::ExecuteNextOpcode( )
 {
 
-	BYTE opcode = m_Rom[m_ProgramCounter] ;
+	BYTE opcode = m_Memory.Read(m_ProgramCounter) ;
 
-	if ((m_ProgramCounter >= 0x4000 && m_ProgramCounter <= 0x7FFF) || (m_ProgramCounter >= 0xA000 && m_ProgramCounter <= 0xBFFF))
+	if (m_ProgramCounter >= 0xA000 && m_ProgramCounter <= 0xBFFF)
 		opcode = ReadMemory(m_ProgramCounter) ;
 
 	if (!m_Halted)
 	{
+#ifdef GB_TRACE
+		TraceRecord record = {(unsigned)Cycles(), m_ProgramCounter, m_RegisterAF.reg, m_RegisterBC.reg, m_RegisterDE.reg,
+			m_RegisterHL.reg, m_StackPointer.reg, m_CurrentROMBank, opcode, TraceRing::TRACE_INSTRUCTION, 0} ;
+		m_Trace.Record(record) ;
+#endif
+
 		m_ProgramCounter++ ;
 		m_TotalOpcodes++ ;
 
@@ -886,6 +1287,7 @@ void Emulator::CPU_8BIT_LOAD( BYTE& reg ) {
     BYTE n = ReadMemory(m_ProgramCounter);
     m_ProgramCounter++;
     reg = n;
+    m_CyclesThisUpdate += 8;
 }
 
 /**
@@ -893,6 +1295,7 @@ void Emulator::CPU_8BIT_LOAD( BYTE& reg ) {
  */
 void Emulator::CPU_8BIT_ADD(BYTE &reg, BYTE toAdd, int cycles, bool useImmediate, bool addCarry)
 {
+    m_CyclesThisUpdate += cycles;
     BYTE before = reg;
     BYTE adding = 0;
 
@@ -934,6 +1337,7 @@ void Emulator::CPU_8BIT_ADD(BYTE &reg, BYTE toAdd, int cycles, bool useImmediate
  */
 void Emulator::CPU_8BIT_SUB(BYTE &reg, BYTE subtracting, int cycles, bool useImmediate, bool subCarry)
 {
+    m_CyclesThisUpdate += cycles;
     BYTE before = reg;
     BYTE toSubtract = 0;
 
@@ -973,6 +1377,7 @@ void Emulator::CPU_8BIT_SUB(BYTE &reg, BYTE subtracting, int cycles, bool useImm
  * 8bit xor
  */
 void Emulator::CPU_8BIT_XOR(BYTE& reg, BYTE toXOr, int cycles, bool useImmediate) {
+    m_CyclesThisUpdate += cycles;
     BYTE myxor = 0;
 
     if(useImmediate) {
@@ -997,12 +1402,15 @@ void Emulator::CPU_8BIT_XOR(BYTE& reg, BYTE toXOr, int cycles, bool useImmediate
 void Emulator::CPU_JUMP_IMMEDIATE(bool useCondition, int flag, bool condition)
 {
     SIGNED_BYTE n = (SIGNED_BYTE)ReadMemory(m_ProgramCounter);
+    m_CyclesThisUpdate += 8;
 
     if (!useCondition) {
         m_ProgramCounter += n;
+        m_CyclesThisUpdate += 4;
     }
     else if (TestBit(m_RegisterAF.lo, flag) == condition) {
         m_ProgramCounter += n;
+        m_CyclesThisUpdate += 4;
     }
 
     m_ProgramCounter++;
@@ -1015,11 +1423,13 @@ void Emulator::CPU_CALL(bool useCondition, int flag, bool condition)
 {
    WORD nn = ReadWord( ) ;
    m_ProgramCounter += 2;
+   m_CyclesThisUpdate += 12;
 
    if (!useCondition)
    {
      PushWordOntoStack(m_ProgramCounter) ;
      m_ProgramCounter = nn ;
+     m_CyclesThisUpdate += 12;
      return ;
    }
 
@@ -1027,6 +1437,7 @@ void Emulator::CPU_CALL(bool useCondition, int flag, bool condition)
    {
      PushWordOntoStack(m_ProgramCounter) ;
      m_ProgramCounter = nn ;
+     m_CyclesThisUpdate += 12;
    }
 }
 
@@ -1045,11 +1456,14 @@ WORD Emulator::PopWordOffStack( )
 void Emulator::CPU_RETURN(bool useCondition, int flag, bool condition) {
     if(!useCondition) {
         m_ProgramCounter = PopWordOffStack();
+        m_CyclesThisUpdate += 16;
         return;
     }
 
+    m_CyclesThisUpdate += 8;
     if(TestBit(m_RegisterAF.lo, flag) == condition) {
         m_ProgramCounter = PopWordOffStack();
+        m_CyclesThisUpdate += 12;
     }
 }
 
@@ -1058,6 +1472,7 @@ void Emulator::CPU_RETURN(bool useCondition, int flag, bool condition) {
  */
 void Emulator::CPU_RRC(BYTE &reg)
 {
+    m_CyclesThisUpdate += 8;
     bool isLSBSet = TestBit(reg, 0);
 
     m_RegisterAF.lo = 0;
@@ -1078,6 +1493,7 @@ void Emulator::CPU_RRC(BYTE &reg)
  */
 void Emulator::CPU_TEST_BIT(BYTE reg, int bit, int cycles)
 {
+    m_CyclesThisUpdate += cycles;
     if (TestBit(reg, bit))
         m_RegisterAF.lo = BitReset(m_RegisterAF.lo, FLAG_Z);
     else
@@ -1087,6 +1503,459 @@ void Emulator::CPU_TEST_BIT(BYTE reg, int bit, int cycles)
     m_RegisterAF.lo = BitSet(m_RegisterAF.lo, FLAG_H);
 }
 
+/**
+ * 16bit loads
+ */
+void Emulator::CPU_16BIT_LOAD(WORD &reg) {
+    reg = ReadWord();
+    m_ProgramCounter += 2;
+    m_CyclesThisUpdate += 12;
+}
+
+/**
+ * Register loads
+ */
+void Emulator::CPU_REG_LOAD(BYTE &reg, BYTE load, int cycles) {
+    m_CyclesThisUpdate += cycles;
+    reg = load;
+}
+
+/**
+ * Register loads from memory
+ */
+void Emulator::CPU_REG_LOAD_ROM(BYTE &reg, WORD address) {
+    m_CyclesThisUpdate += 8;
+    reg = ReadMemory(address);
+}
+
+/**
+ * 8bit and
+ */
+void Emulator::CPU_8BIT_AND(BYTE &reg, BYTE toAnd, int cycles, bool useImmediate) {
+    m_CyclesThisUpdate += cycles;
+    BYTE myand = 0;
+
+    if (useImmediate) {
+        BYTE n = ReadMemory(m_ProgramCounter);
+        m_ProgramCounter++;
+        myand = n;
+    } else {
+        myand = toAnd;
+    }
+
+    reg &= myand;
+    m_RegisterAF.lo = 0;
+
+    if (reg == 0)
+        m_RegisterAF.lo = BitSet(m_RegisterAF.lo, FLAG_Z);
+
+    m_RegisterAF.lo = BitSet(m_RegisterAF.lo, FLAG_H);
+}
+
+/**
+ * 8bit or
+ */
+void Emulator::CPU_8BIT_OR(BYTE &reg, BYTE toOr, int cycles, bool useImmediate) {
+    m_CyclesThisUpdate += cycles;
+    BYTE myor = 0;
+
+    if (useImmediate) {
+        BYTE n = ReadMemory(m_ProgramCounter);
+        m_ProgramCounter++;
+        myor = n;
+    } else {
+        myor = toOr;
+    }
+
+    reg |= myor;
+    m_RegisterAF.lo = 0;
+
+    if (reg == 0)
+        m_RegisterAF.lo = BitSet(m_RegisterAF.lo, FLAG_Z);
+}
+
+/**
+ * 8bit compare
+ */
+void Emulator::CPU_8BIT_COMPARE(BYTE reg, BYTE subtracting, int cycles, bool useImmediate) {
+    m_CyclesThisUpdate += cycles;
+    BYTE before = reg;
+    BYTE toSubtract = 0;
+
+    if (useImmediate) {
+        BYTE n = ReadMemory(m_ProgramCounter);
+        m_ProgramCounter++;
+        toSubtract = n;
+    } else {
+        toSubtract = subtracting;
+    }
+
+    reg -= toSubtract;
+    m_RegisterAF.lo = 0;
+
+    if (reg == 0)
+        m_RegisterAF.lo = BitSet(m_RegisterAF.lo, FLAG_Z);
+
+    m_RegisterAF.lo = BitSet(m_RegisterAF.lo, FLAG_N);
+
+    if (before < toSubtract)
+        m_RegisterAF.lo = BitSet(m_RegisterAF.lo, FLAG_C);
+
+    SIGNED_WORD htest = (before & 0xF);
+    htest -= (toSubtract & 0xF);
+
+    if (htest < 0)
+        m_RegisterAF.lo = BitSet(m_RegisterAF.lo, FLAG_H);
+}
+
+/**
+ * 8bit increments, carry is left alone
+ */
+void Emulator::CPU_8BIT_INC(BYTE &reg, int cycles) {
+    m_CyclesThisUpdate += cycles;
+    reg++;
+
+    m_RegisterAF.lo &= FLAG_MASK_C;
+
+    if (reg == 0)
+        m_RegisterAF.lo = BitSet(m_RegisterAF.lo, FLAG_Z);
+
+    if ((reg & 0xF) == 0)
+        m_RegisterAF.lo = BitSet(m_RegisterAF.lo, FLAG_H);
+}
+
+/**
+ * 8bit decrements, carry is left alone
+ */
+void Emulator::CPU_8BIT_DEC(BYTE &reg, int cycles) {
+    m_CyclesThisUpdate += cycles;
+    reg--;
+
+    m_RegisterAF.lo &= FLAG_MASK_C;
+    m_RegisterAF.lo = BitSet(m_RegisterAF.lo, FLAG_N);
+
+    if (reg == 0)
+        m_RegisterAF.lo = BitSet(m_RegisterAF.lo, FLAG_Z);
+
+    if ((reg & 0xF) == 0xF)
+        m_RegisterAF.lo = BitSet(m_RegisterAF.lo, FLAG_H);
+}
+
+/**
+ * 8bit increments of memory
+ */
+void Emulator::CPU_8BIT_MEMORY_INC(WORD address, int cycles) {
+    BYTE reg = ReadMemory(address);
+    CPU_8BIT_INC(reg, cycles);
+    WriteByte(address, reg);
+}
+
+/**
+ * 8bit decrements of memory
+ */
+void Emulator::CPU_8BIT_MEMORY_DEC(WORD address, int cycles) {
+    BYTE reg = ReadMemory(address);
+    CPU_8BIT_DEC(reg, cycles);
+    WriteByte(address, reg);
+}
+
+/**
+ * Restarts
+ */
+void Emulator::CPU_RESTARTS(BYTE n) {
+    PushWordOntoStack(m_ProgramCounter);
+    m_CyclesThisUpdate += 16;
+    m_ProgramCounter = n;
+}
+
+/**
+ * 16bit decrements
+ */
+void Emulator::CPU_16BIT_DEC(WORD &word, int cycles) {
+    m_CyclesThisUpdate += cycles;
+    word--;
+}
+
+/**
+ * 16bit increments
+ */
+void Emulator::CPU_16BIT_INC(WORD &word, int cycles) {
+    m_CyclesThisUpdate += cycles;
+    word++;
+}
+
+/**
+ * 16bit adds, zero is left alone
+ */
+void Emulator::CPU_16BIT_ADD(WORD &reg, WORD toAdd, int cycles) {
+    m_CyclesThisUpdate += cycles;
+    WORD before = reg;
+
+    reg += toAdd;
+
+    m_RegisterAF.lo &= FLAG_MASK_Z;
+
+    if ((before & 0xFFF) + (toAdd & 0xFFF) > 0xFFF)
+        m_RegisterAF.lo = BitSet(m_RegisterAF.lo, FLAG_H);
+
+    if ((before + toAdd) > 0xFFFF)
+        m_RegisterAF.lo = BitSet(m_RegisterAF.lo, FLAG_C);
+}
+
+/**
+ * Jumps
+ */
+void Emulator::CPU_JUMP(bool useCondition, int flag, bool condition) {
+    WORD nn = ReadWord();
+    m_ProgramCounter += 2;
+    m_CyclesThisUpdate += 12;
+
+    if (!useCondition || TestBit(m_RegisterAF.lo, flag) == condition) {
+        m_ProgramCounter = nn;
+        m_CyclesThisUpdate += 4;
+    }
+}
+
+/**
+ * Decimal adjust after an add or subtract
+ */
+void Emulator::CPU_DAA() {
+    m_CyclesThisUpdate += 4;
+    BYTE reg = m_RegisterAF.hi;
+    BYTE correction = 0;
+    bool carry = false;
+    bool subtract = TestBit(m_RegisterAF.lo, FLAG_N);
+
+    if (TestBit(m_RegisterAF.lo, FLAG_H) || (!subtract && (reg & 0xF) > 9))
+        correction |= 0x06;
+
+    if (TestBit(m_RegisterAF.lo, FLAG_C) || (!subtract && reg > 0x99)) {
+        correction |= 0x60;
+        carry = true;
+    }
+
+    reg = subtract ? reg - correction : reg + correction;
+    m_RegisterAF.hi = reg;
+
+    m_RegisterAF.lo &= FLAG_MASK_N;
+
+    if (reg == 0)
+        m_RegisterAF.lo = BitSet(m_RegisterAF.lo, FLAG_Z);
+
+    if (carry)
+        m_RegisterAF.lo = BitSet(m_RegisterAF.lo, FLAG_C);
+}
+
+/**
+ * Rotate left, bit 7 goes to carry and bit 0
+ */
+void Emulator::CPU_RLC(BYTE &reg) {
+    m_CyclesThisUpdate += 8;
+    bool isMSBSet = TestBit(reg, 7);
+
+    m_RegisterAF.lo = 0;
+
+    reg <<= 1;
+
+    if (isMSBSet) {
+        m_RegisterAF.lo = BitSet(m_RegisterAF.lo, FLAG_C);
+        reg = BitSet(reg, 0);
+    }
+    if (reg == 0)
+        m_RegisterAF.lo = BitSet(m_RegisterAF.lo, FLAG_Z);
+}
+
+void Emulator::CPU_RLC_MEMORY(WORD address) {
+    BYTE reg = ReadMemory(address);
+    CPU_RLC(reg);
+    m_CyclesThisUpdate += 8;
+    WriteByte(address, reg);
+}
+
+void Emulator::CPU_RRC_MEMORY(WORD address) {
+    BYTE reg = ReadMemory(address);
+    CPU_RRC(reg);
+    m_CyclesThisUpdate += 8;
+    WriteByte(address, reg);
+}
+
+/**
+ * Rotate left through carry
+ */
+void Emulator::CPU_RL(BYTE &reg) {
+    m_CyclesThisUpdate += 8;
+    bool isCarrySet = TestBit(m_RegisterAF.lo, FLAG_C);
+    bool isMSBSet = TestBit(reg, 7);
+
+    m_RegisterAF.lo = 0;
+
+    reg <<= 1;
+
+    if (isMSBSet)
+        m_RegisterAF.lo = BitSet(m_RegisterAF.lo, FLAG_C);
+    if (isCarrySet)
+        reg = BitSet(reg, 0);
+    if (reg == 0)
+        m_RegisterAF.lo = BitSet(m_RegisterAF.lo, FLAG_Z);
+}
+
+void Emulator::CPU_RL_MEMORY(WORD address) {
+    BYTE reg = ReadMemory(address);
+    CPU_RL(reg);
+    m_CyclesThisUpdate += 8;
+    WriteByte(address, reg);
+}
+
+/**
+ * Rotate right through carry
+ */
+void Emulator::CPU_RR(BYTE &reg) {
+    m_CyclesThisUpdate += 8;
+    bool isCarrySet = TestBit(m_RegisterAF.lo, FLAG_C);
+    bool isLSBSet = TestBit(reg, 0);
+
+    m_RegisterAF.lo = 0;
+
+    reg >>= 1;
+
+    if (isLSBSet)
+        m_RegisterAF.lo = BitSet(m_RegisterAF.lo, FLAG_C);
+    if (isCarrySet)
+        reg = BitSet(reg, 7);
+    if (reg == 0)
+        m_RegisterAF.lo = BitSet(m_RegisterAF.lo, FLAG_Z);
+}
+
+void Emulator::CPU_RR_MEMORY(WORD address) {
+    BYTE reg = ReadMemory(address);
+    CPU_RR(reg);
+    m_CyclesThisUpdate += 8;
+    WriteByte(address, reg);
+}
+
+/**
+ * Shift left into carry
+ */
+void Emulator::CPU_SLA(BYTE &reg) {
+    m_CyclesThisUpdate += 8;
+    bool isMSBSet = TestBit(reg, 7);
+
+    reg <<= 1;
+
+    m_RegisterAF.lo = 0;
+
+    if (isMSBSet)
+        m_RegisterAF.lo = BitSet(m_RegisterAF.lo, FLAG_C);
+    if (reg == 0)
+        m_RegisterAF.lo = BitSet(m_RegisterAF.lo, FLAG_Z);
+}
+
+void Emulator::CPU_SLA_MEMORY(WORD address) {
+    BYTE reg = ReadMemory(address);
+    CPU_SLA(reg);
+    m_CyclesThisUpdate += 8;
+    WriteByte(address, reg);
+}
+
+/**
+ * Arithmetic shift right into carry, bit 7 is kept
+ */
+void Emulator::CPU_SRA(BYTE &reg) {
+    m_CyclesThisUpdate += 8;
+    bool isLSBSet = TestBit(reg, 0);
+    bool isMSBSet = TestBit(reg, 7);
+
+    reg >>= 1;
+
+    if (isMSBSet)
+        reg = BitSet(reg, 7);
+
+    m_RegisterAF.lo = 0;
+
+    if (isLSBSet)
+        m_RegisterAF.lo = BitSet(m_RegisterAF.lo, FLAG_C);
+    if (reg == 0)
+        m_RegisterAF.lo = BitSet(m_RegisterAF.lo, FLAG_Z);
+}
+
+void Emulator::CPU_SRA_MEMORY(WORD address) {
+    BYTE reg = ReadMemory(address);
+    CPU_SRA(reg);
+    m_CyclesThisUpdate += 8;
+    WriteByte(address, reg);
+}
+
+/**
+ * Logical shift right into carry
+ */
+void Emulator::CPU_SRL(BYTE &reg) {
+    m_CyclesThisUpdate += 8;
+    bool isLSBSet = TestBit(reg, 0);
+
+    reg >>= 1;
+
+    m_RegisterAF.lo = 0;
+
+    if (isLSBSet)
+        m_RegisterAF.lo = BitSet(m_RegisterAF.lo, FLAG_C);
+    if (reg == 0)
+        m_RegisterAF.lo = BitSet(m_RegisterAF.lo, FLAG_Z);
+}
+
+void Emulator::CPU_SRL_MEMORY(WORD address) {
+    BYTE reg = ReadMemory(address);
+    CPU_SRL(reg);
+    m_CyclesThisUpdate += 8;
+    WriteByte(address, reg);
+}
+
+/**
+ * Swap nibbles
+ */
+void Emulator::CPU_SWAP_NIBBLES(BYTE &reg) {
+    m_CyclesThisUpdate += 8;
+    reg = (reg << 4) | (reg >> 4);
+
+    m_RegisterAF.lo = 0;
+
+    if (reg == 0)
+        m_RegisterAF.lo = BitSet(m_RegisterAF.lo, FLAG_Z);
+}
+
+void Emulator::CPU_SWAP_NIB_MEM(WORD address) {
+    BYTE reg = ReadMemory(address);
+    CPU_SWAP_NIBBLES(reg);
+    m_CyclesThisUpdate += 8;
+    WriteByte(address, reg);
+}
+
+/**
+ * Set and reset bits, flags are left alone
+ */
+void Emulator::CPU_SET_BIT(BYTE &reg, int bit) {
+    m_CyclesThisUpdate += 8;
+    reg = BitSet(reg, bit);
+}
+
+void Emulator::CPU_SET_BIT_MEMORY(WORD address, int bit) {
+    BYTE reg = ReadMemory(address);
+    CPU_SET_BIT(reg, bit);
+    m_CyclesThisUpdate += 8;
+    WriteByte(address, reg);
+}
+
+void Emulator::CPU_RESET_BIT(BYTE &reg, int bit) {
+    m_CyclesThisUpdate += 8;
+    reg = BitReset(reg, bit);
+}
+
+void Emulator::CPU_RESET_BIT_MEMORY(WORD address, int bit) {
+    BYTE reg = ReadMemory(address);
+    CPU_RESET_BIT(reg, bit);
+    m_CyclesThisUpdate += 8;
+    WriteByte(address, reg);
+}
+
 void Emulator::WriteByte(WORD address, BYTE data)
 {
 	// writing to memory address 0x0 to 0x1FFF this disables writing to the ram bank. 0 disables, 0xA enables
@@ -1128,12 +1997,14 @@ void Emulator::WriteByte(WORD address, BYTE data)
 
 			// Combine the written data with the register.
 			m_CurrentROMBank |= data;
+			m_Memory.MapROM(m_CurrentROMBank) ;
 
 		}
 		else if (m_MBC2)
 		{
             data &= 0xF ;
             m_CurrentROMBank = data ;
+            m_Memory.MapROM(m_CurrentROMBank) ;
 		}
 	}
 
@@ -1161,6 +2032,7 @@ void Emulator::WriteByte(WORD address, BYTE data)
 
 				// Combine the written data with the register.
 				m_CurrentROMBank |= data;
+				m_Memory.MapROM(m_CurrentROMBank) ;
 			}
 			else
 			{
@@ -1195,13 +2067,13 @@ void Emulator::WriteByte(WORD address, BYTE data)
  		    if (m_MBC1)
  		    {
                 WORD newAddress = address - 0xA000 ;
-                m_RAMBanks[newAddress + (m_CurrentRAMBank * 0x2000)] = data;
+                m_Memory.WriteRAM(newAddress + (m_CurrentRAMBank * 0x2000), data);
  		    }
  		}
  		else if (m_MBC2 && (address < 0xA200))
  		{
  		    WORD newAddress = address - 0xA000 ;
-            m_RAMBanks[newAddress + (m_CurrentRAMBank * 0x2000)] = data;
+            m_Memory.WriteRAM(newAddress + (m_CurrentRAMBank * 0x2000), data);
  		}
 
  	}
@@ -1210,14 +2082,14 @@ void Emulator::WriteByte(WORD address, BYTE data)
 	// we're right to internal RAM, remember that it needs to echo it
 	else if ( (address >= 0xC000) && (address <= 0xDFFF) )
 	{
-		m_Rom[address] = data ;
+		m_Memory.Write(address, data) ;
 	}
 
 	// echo memory. Writes here and into the internal ram. Same as above
 	else if ( (address >= 0xE000) && (address <= 0xFDFF) )
 	{
-		m_Rom[address] = data ;
-		m_Rom[address -0x2000] = data ; // echo data into ram address
+		m_Memory.Write(address, data) ;
+		m_Memory.Write(address -0x2000, data) ; // echo data into ram address
 	}
 
 	// This area is restricted.
@@ -1228,14 +2100,14 @@ void Emulator::WriteByte(WORD address, BYTE data)
 	// reset the divider register
 	else if (address == 0xFF04)
 	{
-		m_Rom[0xFF04] = 0 ;
+		m_Memory.Write(0xFF04, 0) ;
 		m_DividerCounter = 0 ;
 	}
 
 	// not sure if this is correct
 	else if (address == 0xFF07)
 	{
-		m_Rom[address] = data ;
+		m_Memory.Write(address, data) ;
 
 		int timerVal = data & 0x03 ;
 
@@ -1261,21 +2133,70 @@ void Emulator::WriteByte(WORD address, BYTE data)
 	// FF44 shows which horizontal scanline is currently being draw. Writing here resets it
 	else if (address == 0xFF44)
 	{
-		m_Rom[0xFF44] = 0 ;
+		m_Memory.Write(0xFF44, 0) ;
 	}
 
 	else if (address == 0xFF45)
 	{
-		m_Rom[address] = data ;
+		m_Memory.Write(address, data) ;
 	}
-	// DMA transfer
-	else if (address == 0xFF46)
+
+	// sound registers, the apu catches up to now before taking the write
+	else if ((address >= 0xFF10) && (address <= 0xFF3F))
+	{
+		m_Memory.Write(address, data) ;
+		m_APU.Write(address, data, m_CyclesThisUpdate) ;
+	}
+
+	// serial transfer, with nothing on the other end of the link a transfer
+	// on the internal clock is over at once and shifts in 0xFF
+	else if (address == 0xFF02)
 	{
-	    WORD newAddress = (data << 8) ;
-		for (int i = 0; i < 0xA0; i++)
+		if ((data & 0x81) == 0x81)
 		{
-			m_Rom[0xFE00 + i] = ReadMemory(newAddress + i);
+			Notify(EVENT_SERIAL, m_Memory.Read(0xFF01)) ;
+			m_Memory.Write(0xFF01, 0xFF) ;
+			m_Memory.Write(address, data & 0x7F) ;
+			RequestInterrupt(3) ;
 		}
+		else
+			m_Memory.Write(address, data) ;
+	}
+
+	// DMA transfer
+	else if (address == 0xFF46)
+	{
+		DoDMATransfer(data) ;
+	}
+
+	// color game boy speed switch, only bit 0 can be written
+	else if (m_CGB && (address == 0xFF4D))
+	{
+		m_Memory.Write(address, (m_Memory.Read(address) & 0x80) | 0x7E | (data & 1)) ;
+	}
+
+	// color game boy vram bank
+	else if (m_CGB && (address == 0xFF4F))
+	{
+		m_Memory.MapVRAM(data & 1) ;
+		m_Memory.Write(address, 0xFE | (data & 1)) ;
+	}
+
+	// color game boy dma source and destination, then the length that starts it
+	else if (m_CGB && (address >= 0xFF51) && (address <= 0xFF54))
+	{
+		m_Memory.Write(address, data) ;
+	}
+	else if (m_CGB && (address == 0xFF55))
+	{
+		DoHDMATransfer(data) ;
+	}
+
+	// color game boy work ram bank, bank 0 selects bank 1
+	else if (m_CGB && (address == 0xFF70))
+	{
+		m_Memory.MapWRAM(((data & 7) == 0) ? 1 : (data & 7)) ;
+		m_Memory.Write(address, 0xF8 | (data & 7)) ;
 	}
 
 	// This area is restricted.
@@ -1287,7 +2208,7 @@ void Emulator::WriteByte(WORD address, BYTE data)
 	// I guess we're ok to write to memory... gulp
 	else
 	{
-		m_Rom[address] = data ;
+		m_Memory.Write(address, data) ;
 	}
 }
 
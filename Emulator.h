@@ -1,11 +1,12 @@
 #ifndef EMULATOR_H
 #define EMULATOR_H
 
-// Type definitions for the Gameboy's data types
-typedef unsigned char BYTE ;
-typedef char SIGNED_BYTE ;
-typedef unsigned short WORD ;
-typedef signed short SIGNED_WORD ;
+#include "Config.h"
+#include "PPU.h"
+#include "APU.h"
+#include "MemoryMap.h"
+#include "Trace.h"
+#include "EventSink.h"
 
 #define FLAG_MASK_Z 128
 #define FLAG_MASK_N 64
@@ -16,6 +17,39 @@ typedef signed short SIGNED_WORD ;
 #define FLAG_H 5
 #define FLAG_C 4
 
+// cpu clock in cycles per second
+#define CLOCKSPEED 4194304
+
+// cycles in one frame, 4194304 / 60
+#define FRAME_CYCLES 69905
+
+// bump whenever the save state layout changes
+#define SAVE_STATE_VERSION 4
+
+// host seconds spent in each part of the emulation loop
+struct SubsystemTimes {
+    double cpu;
+    double timers;
+    double graphics;
+    double interrupts;
+    double sound;
+};
+
+// what a Run call did: the cycles it ran, how far the last instruction went
+// past the stopping point and whether that point was reached at all
+struct RunResult {
+    int cycles;
+    int overshoot;
+    bool reached;
+};
+
+// a gameshark code, written to ram at the start of every vblank
+struct RAMPatch {
+    WORD address;
+    BYTE value;
+    int bank;
+};
+
 class Emulator {
     public:
         // color
@@ -28,7 +62,22 @@ class Emulator {
 
         // methods
         Emulator();
+        bool LoadCartridge(const char *path);
+        bool LoadCartridge(const BYTE *data, size_t size);
+        void CartridgeLoaded();
+        Emulator *Fork() const;
         void Update();
+        void UpdateTimed(SubsystemTimes &times);
+        void EndFrame();
+        int ExecuteInstruction();
+        int Step();
+        RunResult RunCycles(int cycles);
+        RunResult RunUntilLine(BYTE line, int maxCycles = 2 * FRAME_CYCLES);
+        RunResult RunUntilVBlank(int maxCycles = 2 * FRAME_CYCLES);
+        RunResult RunUntilPC(WORD pc, int maxCycles = 2 * FRAME_CYCLES);
+        int AddWatch(WORD address, MemoryMap::WATCH kind, BYTE value = 0, BYTE mask = 0xFF);
+        void RemoveWatch(int id);
+        RunResult RunUntilWatch(int maxCycles = 2 * FRAME_CYCLES);
         void WriteMemory(WORD address, BYTE data);
         BYTE ReadMemory(WORD address) const;
         void HandleBanking(WORD address, BYTE data);
@@ -49,6 +98,18 @@ class Emulator {
         void SetLCDStatus();
         bool IsLCDEnabled() const;
         void DoDMATransfer(BYTE data);
+        const BYTE *DMASource(WORD address) const;
+        void DMACopy(WORD destination, WORD source, int length);
+        void DoHDMATransfer(BYTE data);
+        void DoHDMABlock();
+        void DoSpeedSwitch();
+        int ChargeCycles(int before, int cycles);
+        int FrameCycles(int cycles) const {
+            return cycles >> m_SpeedShift;
+        }
+        unsigned long long Cycles() const {
+            return m_FrameStart + m_CyclesThisUpdate;
+        }
         void DrawScanLine();
         void RenderTiles(BYTE lcdControl);
         void RenderSprites(BYTE lcdControl);
@@ -118,16 +179,31 @@ class Emulator {
         void PushWordOntoStack(WORD word);
         WORD ReadWord() const;
         WORD PopWordOffStack();
+        size_t SaveStateSize() const;
+        size_t SaveState(BYTE *arena, size_t capacity, bool withScreen = false) const;
+        bool LoadState(const BYTE *arena, size_t size);
+        bool AddGameGenie(const char *code);
+        bool AddGameShark(const char *code);
+        void ClearCheats();
+        void ApplyRAMPatches();
+        void Notify(int kind, int value);
         ~Emulator() = default;
 
-        // game cartridge memory
-        BYTE m_CartridgeMemory[0x200000];
+        // game cartridge memory, owned by m_Memory
+        BYTE *m_CartridgeMemory;
 
         // screen resolution emulation
-        BYTE m_ScreenData[160][140][3];
+        BYTE m_ScreenData[160][144][3];
+
+        // the COLOR of every pixel of the screen, rows first, for the
+        // observation kernels in Observation.h
+        BYTE m_ScreenShades[144][160];
 
-        // main memory
-        BYTE m_Rom[0x10000];
+        // skip drawing the screen, timing and every other state still runs
+        bool m_Headless;
+
+        // main memory and cartridge ram banks
+        MemoryMap m_Memory;
         bool m_UsingMemoryModel16_8 ;
         unsigned long long m_TotalOpcodes;
         bool m_Halted;
@@ -158,7 +234,6 @@ class Emulator {
 
         // ram banks
         bool m_EnableRAM;
-        BYTE m_RAMBanks[0x8000];
         BYTE m_CurrentRAMBank;
 
         // timer
@@ -168,16 +243,54 @@ class Emulator {
         int m_CurrentClockSpeed;
         int m_CyclesThisUpdate;
 
+        // cycles before the current frame, EndFrame moves m_CyclesThisUpdate
+        // back to the start of the frame and adds what it took off here
+        unsigned long long m_FrameStart;
+
         // interrupts
         bool m_InterruptMaster;
         bool m_PendingInteruptDisabled;
 		bool m_PendingInteruptEnabled;
 
+        // color game boy, in double speed mode the cpu and timers run on
+        // twice the clock everything else does
+        bool m_CGB;
+        int m_SpeedShift;
+
+        // cpu cycles a dma took the bus for, the next instruction waits
+        int m_DMAStall;
+
+        // hblank dma, a 16 byte block at the start of every hblank
+        bool m_HDMAActive;
+        WORD m_HDMASource;
+        WORD m_HDMADestination;
+        int m_HDMABlocks;
+
         // scanlines
         int m_ScanlineCounter;
+        PPUPolicy m_PPU;
 
         // joypad
         BYTE m_JoypadState;
+
+        // gameshark codes, rom patches live in m_Memory
+        std::vector<RAMPatch> m_RAMPatches;
+
+        // sound
+        APU m_APU;
+
+        // observers, callbacks and the queue a host can drain instead
+        EventSink m_Sink;
+        EventQueue m_Events;
+
+        // kinds Notify leaves out, one bit per EVENT_KIND, while frames
+        // are run that the host should not hear about
+        unsigned m_MutedEvents;
+
+#ifdef GB_TRACE
+        // the last instructions and interrupts, see Trace.h
+        TraceRing m_Trace;
+#endif
 };
 
 #endif
\ No newline at end of file
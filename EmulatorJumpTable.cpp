@@ -446,6 +446,7 @@ void Emulator::ExecuteOpcode(BYTE opcode)
 		{
 			m_ProgramCounter++ ;
 			m_CyclesThisUpdate+= 4 ;
+			DoSpeedSwitch() ;
 		}break ;
 
 		default: assert(false); break;
@@ -456,9 +457,9 @@ void Emulator::ExecuteOpcode(BYTE opcode)
 
 void Emulator::ExecuteExtendedOpcode( )
 {
-	BYTE opcode = m_Rom[m_ProgramCounter] ;
+	BYTE opcode = m_Memory.Read(m_ProgramCounter) ;
 
-	if ((m_ProgramCounter >= 0x4000 && m_ProgramCounter <= 0x7FFF) || (m_ProgramCounter >= 0xA000 && m_ProgramCounter <= 0xBFFF))
+	if (m_ProgramCounter >= 0xA000 && m_ProgramCounter <= 0xBFFF)
 		opcode = ReadMemory(m_ProgramCounter) ;
 
 	m_ProgramCounter++ ;
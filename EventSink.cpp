@@ -0,0 +1,70 @@
+#include "Config.h"
+#include "EventSink.h"
+#include "Emulator.h"
+
+EventQueue::EventQueue() {
+    m_Count = 0;
+    m_Dropped = 0;
+    m_Kinds = 0;
+}
+
+void EventQueue::Keep(int kind, bool keep) {
+    assert((kind >= 0) && (kind < NUM_EVENT_KINDS));
+    if(keep)
+        m_Kinds |= 1u << kind;
+    else
+        m_Kinds &= ~(1u << kind);
+}
+
+const Event *EventQueue::Events() const {
+    return m_Events;
+}
+
+int EventQueue::Count() const {
+    return m_Count;
+}
+
+int EventQueue::Dropped() const {
+    return m_Dropped;
+}
+
+void EventQueue::Clear() {
+    m_Count = 0;
+    m_Dropped = 0;
+}
+
+/**
+ * Report an event to the sink and queue it if the host keeps its kind.
+ * For audio, value is how many frames at the end of the apu's buffer are
+ * new. Muted kinds are dropped
+ */
+void Emulator::Notify(int kind, int value) {
+    if((m_MutedEvents & (1u << kind)) != 0)
+        return;
+
+    if(m_Events.Keeps(kind))
+        m_Events.Push(kind, value, (unsigned)Cycles());
+
+    switch(kind) {
+        case EVENT_FRAME :
+            if(m_Sink.frame != NULL)
+                m_Sink.frame(m_Sink.context, m_ScreenData);
+            break;
+        case EVENT_AUDIO :
+            if(m_Sink.audio != NULL)
+                m_Sink.audio(m_Sink.context, m_APU.Samples() + ((m_APU.SamplesAvailable() - value) * 2), value);
+            break;
+        case EVENT_SERIAL :
+            if(m_Sink.serial != NULL)
+                m_Sink.serial(m_Sink.context, (BYTE)value);
+            break;
+        case EVENT_VBLANK :
+            if(m_Sink.vblank != NULL)
+                m_Sink.vblank(m_Sink.context);
+            break;
+        case EVENT_INTERRUPT :
+            if(m_Sink.interrupt != NULL)
+                m_Sink.interrupt(m_Sink.context, value);
+            break;
+    }
+}
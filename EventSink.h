@@ -0,0 +1,97 @@
+#ifndef EVENT_SINK_H
+#define EVENT_SINK_H
+
+#include "Config.h"
+
+// what the emulator reports to a sink and keeps for a host to drain
+enum EVENT_KIND {
+    EVENT_FRAME,
+    EVENT_AUDIO,
+    EVENT_SERIAL,
+    EVENT_VBLANK,
+    EVENT_INTERRUPT,
+    NUM_EVENT_KINDS
+};
+
+// events kept between two drains of the queue
+#define EVENT_QUEUE_SIZE 256
+
+// every kind, as a mask for Emulator::m_MutedEvents
+#define EVENT_ALL ((1u << NUM_EVENT_KINDS) - 1)
+
+/**
+ * Callbacks for what happens inside a step, any of them can be NULL. They
+ * run on the emulation thread in the middle of the step and must not step
+ * the emulator themselves.
+ *
+ * Buffers are the emulator's own and only lent for the length of the
+ * call. The frame is m_ScreenData as EndFrame leaves it, audio is the
+ * block of stereo frames the apu just made, which stays in the apu for
+ * whoever reads it afterwards.
+ *
+ * Frames the host is not meant to see are muted, neither called back nor
+ * queued: the frames RunAhead runs past the real one and the frames
+ * MovieReader::Seek replays. RunAhead reports the frame it draws once the
+ * state is restored, in place of the real frame's, which isn't drawn.
+ */
+struct EventSink {
+    void *context;
+    void (*frame)(void *context, const BYTE (*screen)[144][3]);
+    void (*audio)(void *context, const short *frames, int count);
+    void (*serial)(void *context, BYTE data);
+    void (*vblank)(void *context);
+    void (*interrupt)(void *context, int id);   // on the IF bit going 0 to 1
+};
+
+// value is the serial byte, the interrupt id or the audio frames made,
+// cycle is the low 32 bits of Emulator::Cycles
+struct Event {
+    unsigned cycle;
+    int kind;
+    int value;
+};
+
+/**
+ * Events kept for a host that would rather drain them after a step than
+ * take callbacks, batch hosts stepping many emulators in particular. Only
+ * the kinds asked for with Keep are queued, none by default. Events past
+ * EVENT_QUEUE_SIZE are counted and dropped until the next Clear.
+ *
+ * The queue holds no buffers. A frame event means m_ScreenData holds the
+ * frame, an audio event that the apu holds its samples, until the next
+ * step.
+ */
+class EventQueue {
+    public:
+        EventQueue();
+        void Keep(int kind, bool keep);
+
+        bool Keeps(int kind) const {
+            return (m_Kinds & (1u << kind)) != 0;
+        }
+
+        void Push(int kind, int value, unsigned cycle) {
+            if(m_Count == EVENT_QUEUE_SIZE) {
+                m_Dropped++;
+                return;
+            }
+
+            Event &event = m_Events[m_Count++];
+            event.cycle = cycle;
+            event.kind = kind;
+            event.value = value;
+        }
+
+        const Event *Events() const;
+        int Count() const;
+        int Dropped() const;
+        void Clear();
+
+    private:
+        Event m_Events[EVENT_QUEUE_SIZE];
+        int m_Count;
+        int m_Dropped;
+        unsigned m_Kinds;
+};
+
+#endif
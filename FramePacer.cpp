@@ -0,0 +1,105 @@
+#include "Config.h"
+#include "FramePacer.h"
+#include <thread>
+
+// frames behind schedule before the schedule is moved up to now
+#define PACER_MAX_LAG 4
+
+// bounds on the spin margin, in microseconds
+#define PACER_MIN_MARGIN 100
+#define PACER_MAX_MARGIN 4000
+
+FramePacer::FramePacer(double speed) {
+    m_SpinMargin = std::chrono::microseconds(1000);
+    m_LateFrames = 0;
+    m_Spun = Clock::duration::zero();
+    SetSpeed(speed);
+}
+
+/**
+ * Run at speed times the real frame rate, 0 runs unlimited. The schedule
+ * starts over from now
+ */
+void FramePacer::SetSpeed(double speed) {
+    assert((speed == 0) || (speed >= PACER_MIN_SPEED));
+    m_Speed = speed;
+    if(speed > 0)
+        m_Period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / (FRAME_RATE * speed)));
+    else
+        m_Period = Clock::duration::zero();
+    Reset();
+}
+
+double FramePacer::Speed() const {
+    return m_Speed;
+}
+
+/**
+ * Start the schedule from now, after a pause or a seek
+ */
+void FramePacer::Reset() {
+    m_Start = Clock::now();
+    m_Frame = 0;
+}
+
+/**
+ * Block until the end of the current frame's time slot. Returns false if
+ * the frame was already late, so the caller can skip presenting it
+ */
+bool FramePacer::Wait() {
+    if(m_Speed == 0)
+        return true;
+
+    m_Frame++;
+    Clock::time_point deadline = m_Start + (m_Period * m_Frame);
+    Clock::time_point now = Clock::now();
+
+    if(now >= deadline) {
+        m_LateFrames++;
+        if(now - deadline > m_Period * PACER_MAX_LAG)
+            Reset();
+        return false;
+    }
+
+    if(deadline - now > m_SpinMargin) {
+        Clock::time_point wake = deadline - m_SpinMargin;
+        std::this_thread::sleep_until(wake);
+        now = Clock::now();
+
+        // widen the margin quickly when a sleep overshoots, narrow it slowly
+        Clock::duration oversleep = now - wake;
+        Clock::duration target = oversleep + (oversleep / 2);
+        if(target > m_SpinMargin)
+            m_SpinMargin = target;
+        else
+            m_SpinMargin -= (m_SpinMargin - target) / 16;
+
+        if(m_SpinMargin < std::chrono::microseconds(PACER_MIN_MARGIN))
+            m_SpinMargin = std::chrono::microseconds(PACER_MIN_MARGIN);
+        else if(m_SpinMargin > std::chrono::microseconds(PACER_MAX_MARGIN))
+            m_SpinMargin = std::chrono::microseconds(PACER_MAX_MARGIN);
+    }
+
+    Clock::time_point spinStart = now;
+    while(now < deadline) {
+        std::this_thread::yield();
+        now = Clock::now();
+    }
+    m_Spun += now - spinStart;
+
+    return true;
+}
+
+/**
+ * Frames that missed their deadline since construction
+ */
+int FramePacer::LateFrames() const {
+    return m_LateFrames;
+}
+
+/**
+ * Host time spent spinning rather than asleep since construction
+ */
+double FramePacer::SpinSeconds() const {
+    return std::chrono::duration<double>(m_Spun).count();
+}
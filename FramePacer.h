@@ -0,0 +1,52 @@
+#ifndef FRAME_PACER_H
+#define FRAME_PACER_H
+
+#include "Config.h"
+#include "Emulator.h"
+#include <chrono>
+
+// frames per second, paced by the cycles each emulated frame runs
+#define FRAME_RATE ((double)CLOCKSPEED / FRAME_CYCLES)
+
+// slowest speed multiplier, 0 is unlimited
+#define PACER_MIN_SPEED 0.25
+
+/**
+ * Keeps emulated frames in step with wall-clock time.
+ *
+ * Frame deadlines are laid out on a fixed schedule from the last reset, so
+ * rounding and late wakeups in one frame are made up in the next instead
+ * of adding up. Waiting sleeps until shortly before the deadline and spins
+ * with yields for the rest. The spin margin follows how late the sleeps
+ * have been waking, so a host with a precise timer spins for almost
+ * nothing and the thread is asleep whenever the emulator is ahead.
+ *
+ * Falling more than a few frames behind gives the lost time up rather than
+ * running flat out to catch up.
+ */
+class FramePacer {
+    public:
+        typedef std::chrono::steady_clock Clock;
+
+        explicit FramePacer(double speed = 1.0);
+        void SetSpeed(double speed);
+        double Speed() const;
+        void Reset();
+        bool Wait();
+        int LateFrames() const;
+        double SpinSeconds() const;
+
+    private:
+        Clock::time_point m_Start;
+        long long m_Frame;
+        Clock::duration m_Period;
+        double m_Speed;
+
+        // how much earlier than the deadline sleeping stops
+        Clock::duration m_SpinMargin;
+
+        int m_LateFrames;
+        Clock::duration m_Spun;
+};
+
+#endif
@@ -0,0 +1,132 @@
+#include "Config.h"
+#include "GbApi.h"
+#include "Emulator.h"
+#include "Movie.h"
+#include "Observation.h"
+
+static Emulator *Get(GbEmulator *gb) {
+    return reinterpret_cast<Emulator *>(gb);
+}
+
+static const Emulator *Get(const GbEmulator *gb) {
+    return reinterpret_cast<const Emulator *>(gb);
+}
+
+/**
+ * A new emulator running rom, NULL if the rom is empty
+ */
+GbEmulator *gb_create(const unsigned char *rom, size_t size) {
+    Emulator *emulator = new Emulator();
+    if(!emulator->LoadCartridge(rom, size)) {
+        delete emulator;
+        return NULL;
+    }
+    return reinterpret_cast<GbEmulator *>(emulator);
+}
+
+void gb_destroy(GbEmulator *gb) {
+    delete Get(gb);
+}
+
+/**
+ * Skip drawing the screen, for steps whose frames nobody looks at
+ */
+void gb_set_headless(GbEmulator *gb, int headless) {
+    Get(gb)->m_Headless = headless != 0;
+}
+
+/**
+ * Hold the keys in input and run frames frames
+ */
+void gb_step(GbEmulator *gb, unsigned input, int frames) {
+    Emulator *emulator = Get(gb);
+    MovieReader::ApplyInput(*emulator, (BYTE)~input);
+    for(int i = 0; i < frames; i++)
+        emulator->Update();
+}
+
+/**
+ * Run frames frames holding the keys of inputs[i] in frame i
+ */
+void gb_step_inputs(GbEmulator *gb, const unsigned char *inputs, int frames) {
+    Emulator *emulator = Get(gb);
+    for(int i = 0; i < frames; i++) {
+        MovieReader::ApplyInput(*emulator, (BYTE)~inputs[i]);
+        emulator->Update();
+    }
+}
+
+size_t gb_state_size(const GbEmulator *gb) {
+    return Get(gb)->SaveStateSize();
+}
+
+/**
+ * Save into buffer, returns the bytes used or 0 if capacity is below
+ * gb_state_size
+ */
+size_t gb_save_state(const GbEmulator *gb, unsigned char *buffer, size_t capacity) {
+    return Get(gb)->SaveState(buffer, capacity, true);
+}
+
+/**
+ * Returns 1 if the state was loaded, 0 leaves the emulator as it was
+ */
+int gb_load_state(GbEmulator *gb, const unsigned char *buffer, size_t size) {
+    return Get(gb)->LoadState(buffer, size) ? 1 : 0;
+}
+
+/**
+ * The screen as GB_SCREEN_WIDTH columns of GB_SCREEN_HEIGHT rgb pixels,
+ * x major like m_ScreenData
+ */
+unsigned char *gb_framebuffer(GbEmulator *gb) {
+    return &Get(gb)->m_ScreenData[0][0][0];
+}
+
+/**
+ * Fill pages with the GB_WRAM_PAGES pages of 0xC000 - 0xDFFF. Memory is
+ * kept in pages that are not contiguous, and each one is unshared first
+ * so writes through it land in this emulator only
+ */
+int gb_wram_pages(GbEmulator *gb, unsigned char **pages) {
+    Emulator *emulator = Get(gb);
+    for(int i = 0; i < GB_WRAM_PAGES; i++)
+        pages[i] = emulator->m_Memory.WritablePage((0xC000 >> PAGE_SHIFT) + i);
+    return GB_WRAM_PAGES;
+}
+
+/**
+ * Read and write the way the cpu does, banking and registers included
+ */
+unsigned char gb_read(const GbEmulator *gb, unsigned short address) {
+    return Get(gb)->ReadMemory(address);
+}
+
+void gb_write(GbEmulator *gb, unsigned short address, unsigned char value) {
+    Get(gb)->WriteByte(address, value);
+}
+
+/**
+ * A grayscale observation of a crop of the screen scaled to width x
+ * height, NULL if it doesn't fit the screen or is larger than the crop
+ */
+GbObservation *gb_observation_create(int width, int height, int filter, int top, int left, int crop_height, int crop_width) {
+    if((top < 0) || (left < 0) || (crop_height <= 0) || (crop_width <= 0) || ((top + crop_height) > GB_SCREEN_HEIGHT) ||
+       ((left + crop_width) > GB_SCREEN_WIDTH) || (width <= 0) || (height <= 0) || (width > crop_width) || (height > crop_height))
+        return NULL;
+
+    Observation::FILTER kind = (filter == GB_AREA) ? Observation::AREA : Observation::NEAREST;
+    return reinterpret_cast<GbObservation *>(new Observation(width, height, kind, top, left, crop_height, crop_width));
+}
+
+void gb_observation_destroy(GbObservation *observation) {
+    delete reinterpret_cast<Observation *>(observation);
+}
+
+/**
+ * Write width * height gray bytes of the current screen to out, rows
+ * first. out is usually the next slot of a frame stack
+ */
+void gb_observe(const GbEmulator *gb, const GbObservation *observation, unsigned char *out) {
+    reinterpret_cast<const Observation *>(observation)->Render(*Get(gb), out);
+}
@@ -0,0 +1,62 @@
+#ifndef GB_API_H
+#define GB_API_H
+
+#include <stddef.h>
+
+/*
+ * Flat C interface for embedding the emulator in other languages, built
+ * into libgameboy.so. Only the functions below are exported and their
+ * signatures only ever grow new functions, so bindings built against one
+ * version keep working with the next.
+ *
+ * Inputs are a byte per frame with a bit set for every key held, bit 0 to
+ * 3 being right, left, up and down and bit 4 to 7 being a, b, select and
+ * start. Pointers into the emulator are writable and stay valid until the
+ * emulator is destroyed, except the work ram pages of a color game, whose
+ * 0xD000 half moves with the bank register.
+ */
+
+#if defined(_WIN32)
+#define GB_API __declspec(dllexport)
+#else
+#define GB_API __attribute__((visibility("default")))
+#endif
+
+#define GB_SCREEN_WIDTH 160
+#define GB_SCREEN_HEIGHT 144
+#define GB_PAGE_SIZE 256
+#define GB_WRAM_PAGES 32
+
+/* observation filters, as Observation::FILTER */
+#define GB_NEAREST 0
+#define GB_AREA 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct GbEmulator GbEmulator;
+typedef struct GbObservation GbObservation;
+
+GB_API GbEmulator *gb_create(const unsigned char *rom, size_t size);
+GB_API void gb_destroy(GbEmulator *gb);
+GB_API void gb_set_headless(GbEmulator *gb, int headless);
+GB_API void gb_step(GbEmulator *gb, unsigned input, int frames);
+GB_API void gb_step_inputs(GbEmulator *gb, const unsigned char *inputs, int frames);
+GB_API size_t gb_state_size(const GbEmulator *gb);
+GB_API size_t gb_save_state(const GbEmulator *gb, unsigned char *buffer, size_t capacity);
+GB_API int gb_load_state(GbEmulator *gb, const unsigned char *buffer, size_t size);
+GB_API unsigned char *gb_framebuffer(GbEmulator *gb);
+GB_API int gb_wram_pages(GbEmulator *gb, unsigned char **pages);
+GB_API unsigned char gb_read(const GbEmulator *gb, unsigned short address);
+GB_API void gb_write(GbEmulator *gb, unsigned short address, unsigned char value);
+
+GB_API GbObservation *gb_observation_create(int width, int height, int filter, int top, int left, int crop_height, int crop_width);
+GB_API void gb_observation_destroy(GbObservation *observation);
+GB_API void gb_observe(const GbEmulator *gb, const GbObservation *observation, unsigned char *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
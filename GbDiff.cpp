@@ -0,0 +1,147 @@
+#include "Config.h"
+#include "DiffHarness.h"
+#include "Movie.h"
+#include <cstring>
+#include <cstdlib>
+
+static void Usage() {
+    fprintf(stderr,
+        "usage: gb-diff ROM [options]\n"
+        "       gb-diff --fuzz SEEDS [options]\n"
+        "  --frames N          run N frames (default 600)\n"
+        "  --movie FILE        take input from a recorded movie\n"
+        "  --compare EVERY     instruction, block (default) or frame\n"
+        "  --fuzz SEEDS        fuzz seeds 1 to SEEDS instead of running a rom\n"
+        "  --instructions N    instructions per fuzz seed (default 1000000)\n");
+}
+
+static bool ReadFile(const char *path, std::vector<BYTE> &data) {
+    FILE *in = fopen(path, "rb");
+    if(in == NULL)
+        return false;
+
+    BYTE buffer[65536];
+    size_t read;
+    while((read = fread(buffer, 1, sizeof(buffer), in)) > 0)
+        data.insert(data.end(), buffer, buffer + read);
+    fclose(in);
+    return !data.empty();
+}
+
+static bool ParseCount(const char *text, long long &value) {
+    char *end = NULL;
+    value = strtoll(text, &end, 10);
+    return (end != text) && (*end == '\0') && (value >= 0);
+}
+
+/**
+ * Runs a rom, or random instruction streams, on the reference core and
+ * the lockstep core side by side and reports the first divergence.
+ * Exits with 1 when there is one
+ */
+int main(int argc, char **argv) {
+    const char *rom = NULL;
+    const char *moviePath = NULL;
+    long long frames = 600;
+    long long seeds = 0;
+    long long instructions = 1000000;
+    DiffHarness::GRANULARITY granularity = DiffHarness::DIFF_BLOCK;
+
+    for(int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        if(arg[0] != '-') {
+            if(rom != NULL) {
+                Usage();
+                return 2;
+            }
+            rom = arg;
+            continue;
+        }
+
+        const char *value = (i + 1 < argc) ? argv[++i] : NULL;
+        if(value == NULL) {
+            Usage();
+            return 2;
+        }
+
+        if(strcmp(arg, "--frames") == 0) {
+            if(!ParseCount(value, frames)) {
+                Usage();
+                return 2;
+            }
+        } else if(strcmp(arg, "--movie") == 0) {
+            moviePath = value;
+        } else if(strcmp(arg, "--fuzz") == 0) {
+            // seeds are unsigned, 0 would mean no fuzzing
+            if(!ParseCount(value, seeds) || (seeds == 0) || (seeds > 0xFFFFFFFFLL)) {
+                Usage();
+                return 2;
+            }
+        } else if(strcmp(arg, "--instructions") == 0) {
+            if(!ParseCount(value, instructions)) {
+                Usage();
+                return 2;
+            }
+        } else if(strcmp(arg, "--compare") == 0) {
+            if(strcmp(value, "instruction") == 0)
+                granularity = DiffHarness::DIFF_INSTRUCTION;
+            else if(strcmp(value, "block") == 0)
+                granularity = DiffHarness::DIFF_BLOCK;
+            else if(strcmp(value, "frame") == 0)
+                granularity = DiffHarness::DIFF_FRAME;
+            else {
+                Usage();
+                return 2;
+            }
+        } else {
+            Usage();
+            return 2;
+        }
+    }
+
+    if((rom == NULL) == (seeds == 0)) {
+        Usage();
+        return 2;
+    }
+
+    DiffHarness *harness = new DiffHarness();
+    harness->SetGranularity(granularity);
+
+    if(seeds > 0) {
+        for(long long seed = 1; seed <= seeds; seed++) {
+            if(!harness->Fuzz((unsigned)seed, instructions)) {
+                printf("seed %lld ", seed);
+                harness->WriteReport(stdout);
+                delete harness;
+                return 1;
+            }
+        }
+        printf("%lld seeds of %lld instructions, no divergence\n", seeds, instructions);
+        delete harness;
+        return 0;
+    }
+
+    std::vector<BYTE> data;
+    if(!ReadFile(rom, data)) {
+        fprintf(stderr, "gb-diff: cannot load %s\n", rom);
+        return 1;
+    }
+    harness->Load(&data[0], data.size());
+
+    MovieReader movie;
+    if((moviePath != NULL) && !movie.Open(moviePath)) {
+        fprintf(stderr, "gb-diff: cannot open movie %s\n", moviePath);
+        return 1;
+    }
+
+    for(long long frame = 0; (frame < frames) && !harness->Diverged(); frame++) {
+        if(frame < movie.Frames())
+            harness->SetInput(movie.Input((int)frame));
+        harness->Run(1);
+    }
+
+    harness->WriteReport(stdout);
+    int status = harness->Diverged() ? 1 : 0;
+    delete harness;
+    return status;
+}
@@ -0,0 +1,634 @@
+#include "Config.h"
+#include "Emulator.h"
+#include "Movie.h"
+#include "RunAhead.h"
+#include "FramePacer.h"
+#include "Profiler.h"
+#include "PerfCounters.h"
+#include "AudioOutput.h"
+#include "AudioFileSink.h"
+#include "BatchRunner.h"
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+
+typedef std::chrono::steady_clock Clock;
+
+// lowest rate --audio-rate takes, the highest is the apu's own
+#define MIN_AUDIO_RATE 8000
+
+// frames a batch runs per step, the pool syncs once a step
+#define BATCH_STEP_FRAMES 60
+
+struct Options {
+    const char *rom;
+    long long frames;
+    long long cycles;
+    const char *inputScript;
+    const char *movie;
+    const char *record;
+    const char *framePrefix;
+    int frameEvery;
+    const char *statePath;
+    int profileEvery;
+    int runAhead;
+    double speed;
+    const char *guestProfile;
+    const char *trace;
+    const char *traceText;
+    const char *counters;
+    const char *wav;
+    const char *raw;
+    int audioRate;
+    int batch;
+    int threads;
+};
+
+struct ScriptEntry {
+    long long frame;
+    BYTE joypad;
+};
+
+static const char *KEY_NAMES[8] = {"RIGHT", "LEFT", "UP", "DOWN", "A", "B", "SELECT", "START"};
+
+static void Usage() {
+    fprintf(stderr,
+        "usage: gb-run ROM [options]\n"
+        "  --frames N          run N frames (default 600)\n"
+        "  --cycles N          run N guest cycles, the last frame is cut short\n"
+        "  --input FILE        input script, lines of \"frame KEY KEY ...\"\n"
+        "  --movie FILE        take input from a recorded movie\n"
+        "  --record FILE       record the input of every frame run to a movie\n"
+        "  --dump-frames PATH  write frames as PATH000000.ppm ...\n"
+        "  --dump-every N      only dump every Nth frame (default 1)\n"
+        "  --dump-state FILE   write a save state at exit\n"
+        "  --profile N         time subsystems on every Nth frame (default 64, 0 is off)\n"
+        "  --run-ahead N       run N frames ahead of the input (0 - 4)\n"
+        "  --speed X           pace to X times real time, 0 is unlimited (default)\n"
+        "  --guest-profile FILE\n"
+        "                      write a profile of the guest code to FILE, turns --profile off,\n"
+        "                      not with --run-ahead\n"
+        "  --counters FILE     host hardware counters of every frame to FILE as csv, sampled\n"
+        "                      frames count per subsystem instead of timing\n"
+        "  --wav FILE          record the sound to FILE as a wav\n"
+        "  --raw FILE          record the sound to FILE as raw 16-bit stereo pcm\n"
+        "  --audio-rate HZ     sample rate of the recording (default 48000)\n"
+        "  --batch N           run N instances at once and report their combined throughput,\n"
+        "                      only --frames and --threads apply\n"
+        "  --threads N         threads for --batch (default one per core)\n"
+#ifdef GB_TRACE
+        "  --trace FILE        write the last instructions run as a chrome trace\n"
+        "  --trace-text FILE   write the last instructions run as text\n"
+#endif
+        );
+}
+
+static bool ParseCount(const char *text, long long &value) {
+    char *end = NULL;
+    value = strtoll(text, &end, 10);
+    return (end != text) && (*end == '\0') && (value >= 0);
+}
+
+static bool ParseOptions(int argc, char **argv, Options &options) {
+    memset(&options, 0, sizeof(options));
+    options.frames = 600;
+    options.frameEvery = 1;
+    options.profileEvery = 64;
+    options.audioRate = 48000;
+
+    for(int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = (i + 1 < argc) ? argv[i + 1] : NULL;
+        long long count = 0;
+
+        if(arg[0] != '-') {
+            if(options.rom != NULL)
+                return false;
+            options.rom = arg;
+            continue;
+        }
+
+        if(value == NULL)
+            return false;
+        i++;
+
+        if(strcmp(arg, "--frames") == 0) {
+            if(!ParseCount(value, options.frames))
+                return false;
+            options.cycles = 0;
+        } else if(strcmp(arg, "--cycles") == 0) {
+            if(!ParseCount(value, options.cycles))
+                return false;
+            options.frames = 0;
+        } else if(strcmp(arg, "--input") == 0) {
+            options.inputScript = value;
+        } else if(strcmp(arg, "--movie") == 0) {
+            options.movie = value;
+        } else if(strcmp(arg, "--record") == 0) {
+            options.record = value;
+        } else if(strcmp(arg, "--dump-frames") == 0) {
+            options.framePrefix = value;
+        } else if(strcmp(arg, "--dump-every") == 0) {
+            if(!ParseCount(value, count) || (count == 0))
+                return false;
+            options.frameEvery = (int)count;
+        } else if(strcmp(arg, "--dump-state") == 0) {
+            options.statePath = value;
+        } else if(strcmp(arg, "--profile") == 0) {
+            if(!ParseCount(value, count))
+                return false;
+            options.profileEvery = (int)count;
+        } else if(strcmp(arg, "--run-ahead") == 0) {
+            if(!ParseCount(value, count) || (count > RUN_AHEAD_MAX_FRAMES))
+                return false;
+            options.runAhead = (int)count;
+        } else if(strcmp(arg, "--speed") == 0) {
+            char *end = NULL;
+            options.speed = strtod(value, &end);
+            if((end == value) || (*end != '\0') || ((options.speed != 0) && (options.speed < PACER_MIN_SPEED)))
+                return false;
+        } else if(strcmp(arg, "--guest-profile") == 0) {
+            options.guestProfile = value;
+        } else if(strcmp(arg, "--counters") == 0) {
+            options.counters = value;
+        } else if(strcmp(arg, "--wav") == 0) {
+            options.wav = value;
+        } else if(strcmp(arg, "--raw") == 0) {
+            options.raw = value;
+        } else if(strcmp(arg, "--audio-rate") == 0) {
+            if(!ParseCount(value, count) || (count < MIN_AUDIO_RATE) || (count > APU_SAMPLE_RATE))
+                return false;
+            options.audioRate = (int)count;
+        } else if(strcmp(arg, "--batch") == 0) {
+            if(!ParseCount(value, count) || (count == 0) || (count > 65536))
+                return false;
+            options.batch = (int)count;
+        } else if(strcmp(arg, "--threads") == 0) {
+            if(!ParseCount(value, count) || (count > 1024))
+                return false;
+            options.threads = (int)count;
+#ifdef GB_TRACE
+        } else if(strcmp(arg, "--trace") == 0) {
+            options.trace = value;
+        } else if(strcmp(arg, "--trace-text") == 0) {
+            options.traceText = value;
+#endif
+        } else {
+            return false;
+        }
+    }
+
+    // sampled frames would be missing from the guest profile, and the
+    // profiler runs plain frames so there is no running ahead
+    if(options.guestProfile != NULL)
+        options.profileEvery = 0;
+    if((options.guestProfile != NULL) && (options.runAhead > 0))
+        return false;
+
+    // one recording at a time
+    if((options.wav != NULL) && (options.raw != NULL))
+        return false;
+
+    // a batch runs whole frames
+    if((options.batch > 0) && (options.cycles > 0))
+        return false;
+
+    return options.rom != NULL;
+}
+
+/**
+ * Read an input script. Each line is a frame number followed by the keys
+ * held from that frame on, a line with no keys releases everything.
+ * Anything after a # is ignored
+ */
+static bool LoadScript(const char *path, std::vector<ScriptEntry> &script) {
+    FILE *in = fopen(path, "r");
+    if(in == NULL)
+        return false;
+
+    char line[256];
+    int number = 0;
+    bool ok = true;
+    while(ok && (fgets(line, sizeof(line), in) != NULL)) {
+        number++;
+        char *comment = strchr(line, '#');
+        if(comment != NULL)
+            *comment = '\0';
+
+        char *token = strtok(line, " \t\r\n");
+        if(token == NULL)
+            continue;
+
+        ScriptEntry entry;
+        entry.joypad = 0xFF;
+        if(!ParseCount(token, entry.frame) || (!script.empty() && (entry.frame < script.back().frame))) {
+            fprintf(stderr, "%s:%d: bad frame number\n", path, number);
+            ok = false;
+            break;
+        }
+
+        while((token = strtok(NULL, " \t\r\n")) != NULL) {
+            int key = 0;
+            while((key < 8) && (strcmp(token, KEY_NAMES[key]) != 0))
+                key++;
+            if(key == 8) {
+                fprintf(stderr, "%s:%d: unknown key %s\n", path, number, token);
+                ok = false;
+                break;
+            }
+            entry.joypad = BitReset(entry.joypad, key);
+        }
+
+        script.push_back(entry);
+    }
+
+    fclose(in);
+    return ok;
+}
+
+static bool ReadFile(const char *path, std::vector<BYTE> &data) {
+    FILE *in = fopen(path, "rb");
+    if(in == NULL)
+        return false;
+
+    BYTE buffer[65536];
+    size_t read;
+    while((read = fread(buffer, 1, sizeof(buffer), in)) > 0)
+        data.insert(data.end(), buffer, buffer + read);
+    fclose(in);
+    return !data.empty();
+}
+
+static bool DumpFrame(const Emulator &emulator, const char *prefix, long long frame) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s%06lld.ppm", prefix, frame);
+
+    FILE *out = fopen(path, "wb");
+    if(out == NULL)
+        return false;
+
+    BYTE row[160 * 3];
+    bool ok = fprintf(out, "P6\n160 144\n255\n") > 0;
+    for(int y = 0; ok && (y < 144); y++) {
+        for(int x = 0; x < 160; x++)
+            memcpy(row + (x * 3), emulator.m_ScreenData[x][y], 3);
+        ok = fwrite(row, 1, sizeof(row), out) == sizeof(row);
+    }
+
+    return (fclose(out) == 0) && ok;
+}
+
+static bool DumpState(const Emulator &emulator, const char *path) {
+    std::vector<BYTE> state(emulator.SaveStateSize());
+    size_t size = emulator.SaveState(&state[0], state.size(), true);
+    if(size == 0)
+        return false;
+
+    FILE *out = fopen(path, "wb");
+    if(out == NULL)
+        return false;
+
+    bool ok = fwrite(&state[0], 1, size, out) == size;
+    return (fclose(out) == 0) && ok;
+}
+
+/**
+ * Resample the sound of the frame just run and write it out. The file
+ * drains the ring straight away so it never fills
+ */
+static bool RecordAudio(Emulator &emulator, AudioOutput &audio, AudioFileSink &file) {
+    audio.Push(emulator.m_APU);
+
+    short block[1024 * 2];
+    int count;
+    while((count = audio.Pull(block, 1024)) > 0) {
+        if(!file.Write(block, count))
+            return false;
+    }
+    return true;
+}
+
+static bool WriteGuestProfile(const Profiler &profiler, const char *path) {
+    FILE *out = fopen(path, "w");
+    if(out == NULL)
+        return false;
+
+    profiler.WriteProfile(out);
+    fprintf(out, "\nannotated disassembly\n");
+    profiler.WriteAnnotated(out);
+    return fclose(out) == 0;
+}
+
+#ifdef GB_TRACE
+static bool WriteTrace(const Emulator &emulator, const char *path, bool chrome) {
+    FILE *out = fopen(path, "w");
+    if(out == NULL)
+        return false;
+
+    if(chrome)
+        WriteChromeTrace(emulator.m_Trace, emulator, out);
+    else
+        WriteTraceText(emulator.m_Trace, emulator, out);
+    return (ferror(out) == 0) & (fclose(out) == 0);
+}
+#endif
+
+static void ReportSubsystem(const char *name, double seconds, double total, long long frames) {
+    printf("  %-12s %9.3f ms/frame %6.1f%%\n", name, (seconds * 1000.0) / frames, (total > 0) ? (100.0 * seconds / total) : 0.0);
+}
+
+static const char *SUBSYSTEM_NAMES[NUM_PERF_SUBSYSTEMS] = {"cpu", "timers", "graphics", "interrupts", "sound"};
+
+static void ReportCounts(const char *name, const PerfCounters &perf, const PerfCounts &counts, long long frames) {
+    printf("  %-12s", name);
+    for(int i = 0; i < NUM_PERF_EVENTS; i++) {
+        if(perf.Available((PERF_EVENT)i))
+            printf(" %14.0f", (double)counts.events[i] / frames);
+        else
+            printf(" %14s", "-");
+    }
+
+    unsigned long long instructions = counts.events[PERF_INSTRUCTIONS];
+    if(counts.events[PERF_CYCLES] > 0)
+        printf("  %5.2f IPC", (double)instructions / counts.events[PERF_CYCLES]);
+    printf("\n");
+}
+
+static void ReportCounters(const PerfCounters &perf, const PerfCounts &total, long long frames,
+                           const SubsystemCounts &subsystems, long long sampledFrames) {
+    printf("host counters per frame, %lld frames:\n  %-12s", frames, "");
+    for(int i = 0; i < NUM_PERF_EVENTS; i++)
+        printf(" %14s", PerfCounters::EventName((PERF_EVENT)i));
+    printf("\n");
+    ReportCounts("frame", perf, total, frames);
+
+    if(sampledFrames == 0)
+        return;
+
+    printf("host counters per subsystem, %lld sampled frames:\n", sampledFrames);
+    for(int i = 0; i < NUM_PERF_SUBSYSTEMS; i++)
+        ReportCounts(SUBSYSTEM_NAMES[i], perf, subsystems.subsystems[i], sampledFrames);
+}
+
+/**
+ * Run --batch instances of the rom together on a BatchRunner for --frames
+ * frames each and report the frames/sec of all of them together
+ */
+static int RunBatch(const Options &options) {
+    std::vector<BYTE> rom;
+    if(!ReadFile(options.rom, rom)) {
+        fprintf(stderr, "gb-run: cannot load %s\n", options.rom);
+        return 1;
+    }
+
+    BatchRunner batch(&rom[0], rom.size(), options.batch, options.threads);
+
+    Clock::time_point start = Clock::now();
+    for(long long frames = 0; frames < options.frames; frames += BATCH_STEP_FRAMES) {
+        long long left = options.frames - frames;
+        batch.Step(NULL, NULL, (left < BATCH_STEP_FRAMES) ? (int)left : BATCH_STEP_FRAMES);
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    unsigned long long opcodes = 0;
+    for(int i = 0; i < batch.Size(); i++)
+        opcodes += batch.Instance(i).m_TotalOpcodes;
+
+    long long total = options.frames * batch.Size();
+    printf("rom          %s\n", options.rom);
+    printf("instances    %d on %d threads\n", batch.Size(), batch.Threads());
+    printf("frames       %lld each, %lld in all\n", options.frames, total);
+    printf("wall time    %.3f s\n", seconds);
+    if(seconds > 0) {
+        double fps = total / seconds;
+        printf("frames/sec   %.1f (%.1fx real time)\n", fps, fps / FRAME_RATE);
+        printf("guest MIPS   %.2f\n", (opcodes / seconds) / 1000000.0);
+    }
+
+    return 0;
+}
+
+/**
+ * Headless driver: runs a rom as fast as it will go and reports how fast
+ * that was. Throughput only counts frames run through the plain Update,
+ * the subsystem breakdown comes from the sampled frames run through
+ * UpdateTimed
+ */
+int main(int argc, char **argv) {
+    Options options;
+    if(!ParseOptions(argc, argv, options)) {
+        Usage();
+        return 2;
+    }
+
+    if(options.batch > 0)
+        return RunBatch(options);
+
+    Emulator *emulator = new Emulator();
+    if(!emulator->LoadCartridge(options.rom)) {
+        fprintf(stderr, "gb-run: cannot load %s\n", options.rom);
+        return 1;
+    }
+
+    // recording plays nothing, so rate control has no ring level to hold
+    const char *audioPath = (options.wav != NULL) ? options.wav : options.raw;
+    AudioOutput audio(options.audioRate, APU_MAX_SAMPLES, APU_MAX_SAMPLES / 2);
+    AudioFileSink audioFile;
+    audio.SetRateControl(false);
+    if((audioPath != NULL) && !audioFile.Open(audioPath, options.audioRate, (options.wav != NULL) ? AudioFileSink::WAV : AudioFileSink::RAW)) {
+        fprintf(stderr, "gb-run: cannot write %s\n", audioPath);
+        return 1;
+    }
+
+    std::vector<ScriptEntry> script;
+    if((options.inputScript != NULL) && !LoadScript(options.inputScript, script))
+        return 1;
+
+    MovieReader movie;
+    if((options.movie != NULL) && !movie.Open(options.movie)) {
+        fprintf(stderr, "gb-run: cannot open movie %s\n", options.movie);
+        return 1;
+    }
+
+    MovieWriter recorder;
+    if((options.record != NULL) && !recorder.Open(options.record, *emulator)) {
+        fprintf(stderr, "gb-run: cannot write movie %s\n", options.record);
+        return 1;
+    }
+
+    RunAhead runAhead(*emulator, options.runAhead);
+    FramePacer pacer(options.speed);
+    Profiler profiler(*emulator);
+
+    SubsystemTimes times;
+    memset(&times, 0, sizeof(times));
+
+    PerfCounters perf;
+    PerfCounts frameCounts;
+    SubsystemCounts subsystemCounts;
+    memset(&frameCounts, 0, sizeof(frameCounts));
+    memset(&subsystemCounts, 0, sizeof(subsystemCounts));
+
+    FILE *counters = NULL;
+    if(options.counters != NULL) {
+        counters = fopen(options.counters, "w");
+        if(counters == NULL) {
+            fprintf(stderr, "gb-run: cannot write %s\n", options.counters);
+            return 1;
+        }
+        if(!perf.Open())
+            fprintf(stderr, "gb-run: host counters are not available, they will all read 0\n");
+
+        fprintf(counters, "frame,sampled");
+        for(int i = 0; i < NUM_PERF_EVENTS; i++)
+            fprintf(counters, ",%s", PerfCounters::EventName((PERF_EVENT)i));
+        fprintf(counters, "\n");
+    }
+
+    long long frames = 0;
+    long long timedFrames = 0;
+    long long cycles = 0;
+    unsigned long long opcodes = 0;
+    unsigned long long timedOpcodes = 0;
+    double seconds = 0;
+    size_t nextEntry = 0;
+
+    Clock::time_point wallStart = Clock::now();
+    while((options.cycles > 0) ? (cycles < options.cycles) : (frames < options.frames)) {
+        while((nextEntry < script.size()) && (script[nextEntry].frame <= frames))
+            MovieReader::ApplyInput(*emulator, script[nextEntry++].joypad);
+        if(frames < movie.Frames())
+            MovieReader::ApplyInput(*emulator, movie.Input((int)frames));
+        if((options.record != NULL) && !recorder.Frame(*emulator)) {
+            fprintf(stderr, "gb-run: cannot write movie %s\n", options.record);
+            return 1;
+        }
+
+        unsigned long long cyclesBefore = emulator->Cycles();
+        unsigned long long opcodesBefore = emulator->m_TotalOpcodes;
+        long long timedBefore = timedFrames;
+
+        PerfCounts countsBefore;
+        perf.Read(countsBefore);
+
+        if((options.cycles > 0) && (options.cycles - cycles < FRAME_CYCLES)) {
+            // the last part of a cycle budget is a partial frame
+            Clock::time_point start = Clock::now();
+            emulator->RunCycles((int)(options.cycles - cycles));
+            emulator->EndFrame();
+            seconds += std::chrono::duration<double>(Clock::now() - start).count();
+            opcodes += emulator->m_TotalOpcodes - opcodesBefore;
+        } else if((options.profileEvery > 0) && ((frames % options.profileEvery) == options.profileEvery - 1)) {
+            if(counters != NULL)
+                perf.Update(*emulator, subsystemCounts);
+            else
+                emulator->UpdateTimed(times);
+            timedFrames++;
+            timedOpcodes += emulator->m_TotalOpcodes - opcodesBefore;
+        } else {
+            Clock::time_point start = Clock::now();
+            if(options.guestProfile != NULL)
+                profiler.Update<true>();
+            else if(!runAhead.Update(*emulator)) {
+                fprintf(stderr, "gb-run: cannot run ahead, the state did not restore\n");
+                return 1;
+            }
+            seconds += std::chrono::duration<double>(Clock::now() - start).count();
+            opcodes += emulator->m_TotalOpcodes - opcodesBefore;
+        }
+
+        cycles += (long long)(emulator->Cycles() - cyclesBefore);
+
+        if(counters != NULL) {
+            PerfCounts countsAfter;
+            perf.Read(countsAfter);
+            PerfCounters::Accumulate(frameCounts, countsAfter, countsBefore);
+
+            fprintf(counters, "%lld,%d", frames, (timedFrames != timedBefore) ? 1 : 0);
+            for(int i = 0; i < NUM_PERF_EVENTS; i++)
+                fprintf(counters, ",%llu", countsAfter.events[i] - countsBefore.events[i]);
+            fprintf(counters, "\n");
+        }
+
+        if((audioPath != NULL) && !RecordAudio(*emulator, audio, audioFile)) {
+            fprintf(stderr, "gb-run: cannot write %s\n", audioPath);
+            return 1;
+        }
+
+        if((options.framePrefix != NULL) && ((frames % options.frameEvery) == 0) &&
+           !DumpFrame(*emulator, options.framePrefix, frames)) {
+            fprintf(stderr, "gb-run: cannot write frame %lld\n", frames);
+            return 1;
+        }
+
+        pacer.Wait();
+        frames++;
+    }
+    double wall = std::chrono::duration<double>(Clock::now() - wallStart).count();
+
+    if((options.statePath != NULL) && !DumpState(*emulator, options.statePath)) {
+        fprintf(stderr, "gb-run: cannot write state to %s\n", options.statePath);
+        return 1;
+    }
+
+    if((options.record != NULL) && !recorder.Close()) {
+        fprintf(stderr, "gb-run: cannot write movie %s\n", options.record);
+        return 1;
+    }
+
+    if((audioPath != NULL) && !audioFile.Close()) {
+        fprintf(stderr, "gb-run: cannot write %s\n", audioPath);
+        return 1;
+    }
+
+    if((options.guestProfile != NULL) && !WriteGuestProfile(profiler, options.guestProfile)) {
+        fprintf(stderr, "gb-run: cannot write guest profile to %s\n", options.guestProfile);
+        return 1;
+    }
+
+#ifdef GB_TRACE
+    if(((options.trace != NULL) && !WriteTrace(*emulator, options.trace, true)) ||
+       ((options.traceText != NULL) && !WriteTrace(*emulator, options.traceText, false))) {
+        fprintf(stderr, "gb-run: cannot write trace\n");
+        return 1;
+    }
+#endif
+
+    long long plainFrames = frames - timedFrames;
+    printf("rom          %s\n", options.rom);
+    printf("frames       %lld\n", frames);
+    printf("guest cycles %lld\n", cycles);
+    printf("instructions %llu\n", opcodes + timedOpcodes);
+    printf("wall time    %.3f s\n", wall);
+
+    if((plainFrames > 0) && (seconds > 0)) {
+        double fps = plainFrames / seconds;
+        printf("frames/sec   %.1f (%.1fx real time)\n", fps, fps / FRAME_RATE);
+        printf("guest MIPS   %.2f\n", (opcodes / seconds) / 1000000.0);
+    }
+
+    if(options.speed > 0)
+        printf("paced        %.2fx, %d late frames, %.3f s spinning\n", options.speed, pacer.LateFrames(), pacer.SpinSeconds());
+
+    if(audioPath != NULL)
+        printf("audio        %lld frames at %d Hz to %s\n", audioFile.FramesWritten(), options.audioRate, audioPath);
+
+    if(counters != NULL) {
+        if(fclose(counters) != 0) {
+            fprintf(stderr, "gb-run: cannot write %s\n", options.counters);
+            return 1;
+        }
+        ReportCounters(perf, frameCounts, frames, subsystemCounts, timedFrames);
+    } else if(timedFrames > 0) {
+        double total = times.cpu + times.timers + times.graphics + times.interrupts + times.sound;
+        printf("host time per subsystem, %lld sampled frames:\n", timedFrames);
+        ReportSubsystem("cpu", times.cpu, total, timedFrames);
+        ReportSubsystem("timers", times.timers, total, timedFrames);
+        ReportSubsystem("graphics", times.graphics, total, timedFrames);
+        ReportSubsystem("interrupts", times.interrupts, total, timedFrames);
+        ReportSubsystem("sound", times.sound, total, timedFrames);
+    }
+
+    delete emulator;
+    return 0;
+}
@@ -0,0 +1,490 @@
+#include "Config.h"
+#include "LockstepCore.h"
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#if defined(__AVX2__)
+
+typedef __m256i LaneVector;
+
+static inline LaneVector Load(const WORD *p) { return _mm256_load_si256((const __m256i *)p); }
+static inline void Store(WORD *p, LaneVector v) { _mm256_store_si256((__m256i *)p, v); }
+static inline LaneVector Splat(int v) { return _mm256_set1_epi16((short)v); }
+static inline LaneVector Add(LaneVector a, LaneVector b) { return _mm256_add_epi16(a, b); }
+static inline LaneVector Sub(LaneVector a, LaneVector b) { return _mm256_sub_epi16(a, b); }
+static inline LaneVector And(LaneVector a, LaneVector b) { return _mm256_and_si256(a, b); }
+static inline LaneVector Or(LaneVector a, LaneVector b) { return _mm256_or_si256(a, b); }
+static inline LaneVector Xor(LaneVector a, LaneVector b) { return _mm256_xor_si256(a, b); }
+static inline LaneVector ShiftLeft(LaneVector a, int n) { return _mm256_sll_epi16(a, _mm_cvtsi32_si128(n)); }
+static inline LaneVector ShiftRight(LaneVector a, int n) { return _mm256_srl_epi16(a, _mm_cvtsi32_si128(n)); }
+static inline LaneVector Equal(LaneVector a, LaneVector b) { return _mm256_cmpeq_epi16(a, b); }
+static inline LaneVector Select(LaneVector mask, LaneVector a, LaneVector b) { return _mm256_blendv_epi8(b, a, mask); }
+
+#else
+
+// plain arrays for builds without AVX2, the compiler vectorizes what it can
+struct LaneVector {
+    WORD v[LOCKSTEP_LANES];
+};
+
+static inline LaneVector Load(const WORD *p) { LaneVector r; memcpy(r.v, p, sizeof(r.v)); return r; }
+static inline void Store(WORD *p, LaneVector v) { memcpy(p, v.v, sizeof(v.v)); }
+static inline LaneVector Splat(int v) { LaneVector r; for(int i = 0; i < LOCKSTEP_LANES; i++) r.v[i] = (WORD)v; return r; }
+static inline LaneVector Add(LaneVector a, LaneVector b) { for(int i = 0; i < LOCKSTEP_LANES; i++) a.v[i] += b.v[i]; return a; }
+static inline LaneVector Sub(LaneVector a, LaneVector b) { for(int i = 0; i < LOCKSTEP_LANES; i++) a.v[i] -= b.v[i]; return a; }
+static inline LaneVector And(LaneVector a, LaneVector b) { for(int i = 0; i < LOCKSTEP_LANES; i++) a.v[i] &= b.v[i]; return a; }
+static inline LaneVector Or(LaneVector a, LaneVector b) { for(int i = 0; i < LOCKSTEP_LANES; i++) a.v[i] |= b.v[i]; return a; }
+static inline LaneVector Xor(LaneVector a, LaneVector b) { for(int i = 0; i < LOCKSTEP_LANES; i++) a.v[i] ^= b.v[i]; return a; }
+static inline LaneVector ShiftLeft(LaneVector a, int n) { for(int i = 0; i < LOCKSTEP_LANES; i++) a.v[i] <<= n; return a; }
+static inline LaneVector ShiftRight(LaneVector a, int n) { for(int i = 0; i < LOCKSTEP_LANES; i++) a.v[i] >>= n; return a; }
+static inline LaneVector Equal(LaneVector a, LaneVector b) { for(int i = 0; i < LOCKSTEP_LANES; i++) a.v[i] = (a.v[i] == b.v[i]) ? 0xFFFF : 0; return a; }
+static inline LaneVector Select(LaneVector mask, LaneVector a, LaneVector b) { for(int i = 0; i < LOCKSTEP_LANES; i++) a.v[i] = (a.v[i] & mask.v[i]) | (b.v[i] & ~mask.v[i]); return a; }
+
+#endif
+
+// all ones in the lanes where (v & bits) is not zero
+static inline LaneVector Test(LaneVector v, int bits) {
+    return Xor(Equal(And(v, Splat(bits)), Splat(0)), Splat(0xFFFF));
+}
+
+static inline LaneVector IsZero8(LaneVector v) {
+    return Equal(And(v, Splat(0xFF)), Splat(0));
+}
+
+// the flag bits in the lanes where cond is set
+static inline LaneVector Flag(LaneVector cond, int flag) {
+    return And(cond, Splat(flag));
+}
+
+static inline LaneVector Get8(const WORD *pair, bool high) {
+    LaneVector v = Load(pair);
+    return high ? ShiftRight(v, 8) : And(v, Splat(0xFF));
+}
+
+static inline void Set8(WORD *pair, bool high, LaneVector value, LaneVector mask) {
+    LaneVector v = Load(pair);
+    LaneVector result;
+    if(high)
+        result = Or(And(v, Splat(0x00FF)), ShiftLeft(value, 8));
+    else
+        result = Or(And(v, Splat(0xFF00)), And(value, Splat(0xFF)));
+    Store(pair, Select(mask, result, v));
+}
+
+static inline void Set16(WORD *reg, LaneVector value, LaneVector mask) {
+    Store(reg, Select(mask, value, Load(reg)));
+}
+
+// register pair and half for the 3-bit register field of an opcode, 6 is (HL)
+static const int s_Pair8[8] = {
+    LockstepCore::BC, LockstepCore::BC, LockstepCore::DE, LockstepCore::DE,
+    LockstepCore::HL, LockstepCore::HL, -1, LockstepCore::AF
+};
+static const bool s_High8[8] = { true, false, true, false, true, false, false, true };
+
+// register pair for the 2-bit pair field of an opcode
+static const int s_Pair16[4] = { LockstepCore::BC, LockstepCore::DE, LockstepCore::HL, LockstepCore::SP };
+
+/**
+ * Bytes of immediate data after the opcodes the vector path handles
+ */
+static int ImmediateLength(BYTE opcode) {
+    if(((opcode & 0xC7) == 0x06) || ((opcode & 0xC7) == 0xC6))
+        return 1;
+    if((opcode == 0x18) || ((opcode & 0xE7) == 0x20))
+        return 1;
+    if((opcode & 0xCF) == 0x01)
+        return 2;
+    return 0;
+}
+
+LockstepCore::LockstepCore(int lanes) {
+    assert((lanes > 0) && (lanes <= LOCKSTEP_LANES));
+
+    m_NumLanes = lanes;
+    for(int i = 0; i < LOCKSTEP_LANES; i++) {
+        m_Lanes[i] = (i < lanes) ? new Emulator() : NULL;
+        m_FrameCycles[i] = 0;
+    }
+
+    memset(m_Registers, 0, sizeof(m_Registers));
+    memset(m_Immediate, 0, sizeof(m_Immediate));
+    memset(m_Cycles, 0, sizeof(m_Cycles));
+
+    m_Issued = 0;
+    m_Retired = 0;
+    m_VectorRetired = 0;
+}
+
+LockstepCore::~LockstepCore() {
+    for(int i = 0; i < m_NumLanes; i++)
+        delete m_Lanes[i];
+}
+
+int LockstepCore::Lanes() const {
+    return m_NumLanes;
+}
+
+/**
+ * The emulator behind a lane. Its registers are only current between
+ * Update calls
+ */
+Emulator &LockstepCore::Lane(int lane) {
+    return *m_Lanes[lane];
+}
+
+const Emulator &LockstepCore::Lane(int lane) const {
+    return *m_Lanes[lane];
+}
+
+/**
+ * Average number of lanes retired per issued instruction
+ */
+double LockstepCore::Occupancy() const {
+    return (m_Issued > 0) ? (double)m_Retired / m_Issued : 0.0;
+}
+
+/**
+ * Share of lane instructions that went down the vector path
+ */
+double LockstepCore::VectorShare() const {
+    return (m_Retired > 0) ? (double)m_VectorRetired / m_Retired : 0.0;
+}
+
+/**
+ * Run one frame on every lane
+ */
+void LockstepCore::Update() {
+    for(int i = 0; i < m_NumLanes; i++) {
+        Gather(i);
+        m_FrameCycles[i] = 0;
+    }
+
+    while(Issue())
+        ;
+
+    for(int i = 0; i < m_NumLanes; i++) {
+        Scatter(i);
+        m_Lanes[i]->EndFrame();
+    }
+}
+
+/**
+ * Issue a single instruction group, every lane at the first lane's PC
+ * runs one instruction. With one lane this steps that lane by exactly an
+ * instruction. Frames are left to the caller, who calls EndFrame on the
+ * lanes
+ */
+void LockstepCore::Step() {
+    for(int i = 0; i < m_NumLanes; i++) {
+        Gather(i);
+        m_FrameCycles[i] = 0;
+    }
+
+    Issue();
+
+    for(int i = 0; i < m_NumLanes; i++)
+        Scatter(i);
+}
+
+/**
+ * Run the next instruction group of the frame, false once every lane has
+ * finished the frame
+ */
+bool LockstepCore::Issue() {
+    // the lane furthest behind leads, which keeps lanes in step and lets
+    // the ones that branched apart meet again
+    int leader = -1;
+    for(int i = 0; i < m_NumLanes; i++) {
+        if(m_FrameCycles[i] >= FRAME_CYCLES)
+            continue;
+        if((leader < 0) || (m_FrameCycles[i] < m_FrameCycles[leader]))
+            leader = i;
+    }
+
+    if(leader < 0)
+        return false;
+
+    BYTE opcode = 0;
+    int group = SelectGroup(leader, opcode);
+
+    if(!m_Lanes[leader]->m_Halted && ExecuteVector(opcode, group)) {
+        m_Issued++;
+
+        for(int lane = 0; lane < m_NumLanes; lane++) {
+            if(!TestBit(group, lane))
+                continue;
+
+            Emulator &emulator = *m_Lanes[lane];
+            WORD pc = m_Registers[PC][lane];
+            int before = emulator.m_CyclesThisUpdate;
+            emulator.m_TotalOpcodes++;
+            emulator.m_CyclesThisUpdate += m_Cycles[lane];
+
+            // same delayed DI and EI handling as ExecuteNextOpcode
+            if(emulator.m_PendingInteruptDisabled && (emulator.ReadMemory(pc - 1) != 0xF3)) {
+                emulator.m_PendingInteruptDisabled = false;
+                emulator.m_InterruptMaster = false;
+            }
+            if(emulator.m_PendingInteruptEnabled && (emulator.ReadMemory(pc - 1) != 0xFB)) {
+                emulator.m_PendingInteruptEnabled = false;
+                emulator.m_InterruptMaster = true;
+            }
+
+            FinishInstruction(lane, emulator.ChargeCycles(before, m_Cycles[lane]));
+            m_Retired++;
+            m_VectorRetired++;
+        }
+    } else {
+        for(int lane = 0; lane < m_NumLanes; lane++) {
+            if(!TestBit(group, lane))
+                continue;
+
+            FinishInstruction(lane, ExecuteScalar(lane));
+            m_Issued++;
+            m_Retired++;
+        }
+    }
+
+    return true;
+}
+
+void LockstepCore::Gather(int lane) {
+    Emulator &emulator = *m_Lanes[lane];
+    m_Registers[AF][lane] = emulator.m_RegisterAF.reg;
+    m_Registers[BC][lane] = emulator.m_RegisterBC.reg;
+    m_Registers[DE][lane] = emulator.m_RegisterDE.reg;
+    m_Registers[HL][lane] = emulator.m_RegisterHL.reg;
+    m_Registers[SP][lane] = emulator.m_StackPointer.reg;
+    m_Registers[PC][lane] = emulator.m_ProgramCounter;
+}
+
+void LockstepCore::Scatter(int lane) {
+    Emulator &emulator = *m_Lanes[lane];
+    emulator.m_RegisterAF.reg = m_Registers[AF][lane];
+    emulator.m_RegisterBC.reg = m_Registers[BC][lane];
+    emulator.m_RegisterDE.reg = m_Registers[DE][lane];
+    emulator.m_RegisterHL.reg = m_Registers[HL][lane];
+    emulator.m_StackPointer.reg = m_Registers[SP][lane];
+    emulator.m_ProgramCounter = m_Registers[PC][lane];
+}
+
+/**
+ * Collect the running lanes that are at the leader's PC and see the same
+ * opcode there, a lane can sit on the same address in another bank. A
+ * halted leader runs alone. Immediate operands are read per lane
+ */
+int LockstepCore::SelectGroup(int leader, BYTE &opcode) {
+    WORD pc = m_Registers[PC][leader];
+    opcode = m_Lanes[leader]->ReadMemory(pc);
+
+    if(m_Lanes[leader]->m_Halted)
+        return 1 << leader;
+
+    int length = ImmediateLength(opcode);
+    int group = 0;
+
+    for(int lane = 0; lane < m_NumLanes; lane++) {
+        Emulator &emulator = *m_Lanes[lane];
+
+        if((m_FrameCycles[lane] >= FRAME_CYCLES) || (m_Registers[PC][lane] != pc) || emulator.m_Halted)
+            continue;
+        if(emulator.ReadMemory(pc) != opcode)
+            continue;
+
+        group |= 1 << lane;
+
+        if(length == 1)
+            m_Immediate[lane] = emulator.ReadMemory(pc + 1);
+        else if(length == 2)
+            m_Immediate[lane] = emulator.ReadMemory(pc + 1) | (emulator.ReadMemory(pc + 2) << 8);
+    }
+
+    return group;
+}
+
+/**
+ * Execute a register-only opcode for every lane in the group. Returns
+ * false, having changed nothing, for opcodes that need the scalar core
+ */
+bool LockstepCore::ExecuteVector(BYTE opcode, int group) {
+    alignas(32) WORD bits[LOCKSTEP_LANES];
+    for(int i = 0; i < LOCKSTEP_LANES; i++)
+        bits[i] = TestBit(group, i) ? 0xFFFF : 0;
+    LaneVector mask = Load(bits);
+
+    WORD *af = m_Registers[AF];
+    LaneVector a = Get8(af, true);
+    LaneVector f = Get8(af, false);
+    LaneVector imm = Load(m_Immediate);
+    LaneVector pc = Load(m_Registers[PC]);
+    int length = 1 + ImmediateLength(opcode);
+    int cycles = 4;
+
+    if(opcode == 0x00) {
+        // nop
+    } else if((opcode >= 0x40) && (opcode < 0x80)) {
+        // ld r, r
+        int dst = (opcode >> 3) & 7;
+        int src = opcode & 7;
+        if((dst == 6) || (src == 6))
+            return false;
+
+        LaneVector value = Get8(m_Registers[s_Pair8[src]], s_High8[src]);
+        Set8(m_Registers[s_Pair8[dst]], s_High8[dst], value, mask);
+    } else if(((opcode >= 0x80) && (opcode < 0xC0)) || ((opcode & 0xC7) == 0xC6)) {
+        // alu a, r and alu a, n. adc and sbc keep the scalar carry handling
+        int op = (opcode >> 3) & 7;
+        int src = opcode & 7;
+        if((op == 1) || (op == 3))
+            return false;
+
+        LaneVector b;
+        if(opcode >= 0xC0) {
+            b = And(imm, Splat(0xFF));
+            cycles = 8;
+        } else if(src == 6) {
+            return false;
+        } else {
+            b = Get8(m_Registers[s_Pair8[src]], s_High8[src]);
+        }
+
+        LaneVector result;
+        LaneVector flags;
+        switch(op) {
+            case 0:
+                result = Add(a, b);
+                flags = Or(Flag(Test(Add(And(a, Splat(0xF)), And(b, Splat(0xF))), 0x10), FLAG_MASK_H),
+                           Flag(Test(result, 0x100), FLAG_MASK_C));
+                break;
+            case 2:
+            case 7:
+                result = Sub(a, b);
+                flags = Or(Splat(FLAG_MASK_N),
+                           Or(Flag(Test(Sub(And(a, Splat(0xF)), And(b, Splat(0xF))), 0x8000), FLAG_MASK_H),
+                              Flag(Test(result, 0x8000), FLAG_MASK_C)));
+                break;
+            case 4:
+                result = And(a, b);
+                flags = Splat(FLAG_MASK_H);
+                break;
+            case 5:
+                result = Xor(a, b);
+                flags = Splat(0);
+                break;
+            default:
+                result = Or(a, b);
+                flags = Splat(0);
+                break;
+        }
+
+        flags = Or(flags, Flag(IsZero8(result), FLAG_MASK_Z));
+        if(op != 7)
+            Set8(af, true, result, mask);
+        Set8(af, false, flags, mask);
+    } else if(((opcode & 0xC7) == 0x04) || ((opcode & 0xC7) == 0x05)) {
+        // inc r and dec r leave carry alone
+        int reg = (opcode >> 3) & 7;
+        if(reg == 6)
+            return false;
+
+        WORD *pair = m_Registers[s_Pair8[reg]];
+        LaneVector value = Get8(pair, s_High8[reg]);
+        LaneVector flags = And(f, Splat(FLAG_MASK_C));
+
+        if(opcode & 1) {
+            value = Sub(value, Splat(1));
+            flags = Or(flags, Splat(FLAG_MASK_N));
+            flags = Or(flags, Flag(Equal(And(value, Splat(0xF)), Splat(0xF)), FLAG_MASK_H));
+        } else {
+            value = Add(value, Splat(1));
+            flags = Or(flags, Flag(Equal(And(value, Splat(0xF)), Splat(0)), FLAG_MASK_H));
+        }
+
+        flags = Or(flags, Flag(IsZero8(value), FLAG_MASK_Z));
+        Set8(pair, s_High8[reg], value, mask);
+        Set8(af, false, flags, mask);
+    } else if((opcode & 0xC7) == 0x06) {
+        // ld r, n
+        int reg = (opcode >> 3) & 7;
+        if(reg == 6)
+            return false;
+
+        Set8(m_Registers[s_Pair8[reg]], s_High8[reg], imm, mask);
+        cycles = 8;
+    } else if(((opcode & 0xCF) == 0x03) || ((opcode & 0xCF) == 0x0B)) {
+        // inc rr and dec rr
+        WORD *pair = m_Registers[s_Pair16[(opcode >> 4) & 3]];
+        LaneVector step = (opcode & 0x08) ? Splat(0xFFFF) : Splat(1);
+        Set16(pair, Add(Load(pair), step), mask);
+        cycles = 8;
+    } else if((opcode & 0xCF) == 0x01) {
+        // ld rr, nn
+        Set16(m_Registers[s_Pair16[(opcode >> 4) & 3]], imm, mask);
+        cycles = 12;
+    } else if(opcode == 0x2F) {
+        // cpl
+        Set8(af, true, Xor(a, Splat(0xFF)), mask);
+        Set8(af, false, Or(f, Splat(FLAG_MASK_N | FLAG_MASK_H)), mask);
+    } else if((opcode == 0x37) || (opcode == 0x3F)) {
+        // scf and ccf
+        LaneVector carry = (opcode == 0x37) ? Or(f, Splat(FLAG_MASK_C)) : Xor(f, Splat(FLAG_MASK_C));
+        Set8(af, false, And(carry, Splat(~(FLAG_MASK_N | FLAG_MASK_H) & 0xFF)), mask);
+    } else if((opcode == 0x18) || ((opcode & 0xE7) == 0x20)) {
+        // jr e and jr cc, e, the only control flow done here since taken
+        // and not taken lanes just get different PCs
+        LaneVector offset = Sub(Xor(And(imm, Splat(0xFF)), Splat(0x80)), Splat(0x80));
+        LaneVector next = Add(pc, Splat(2));
+        LaneVector taken = Splat(0xFFFF);
+
+        if(opcode != 0x18) {
+            int flag = (opcode & 0x10) ? FLAG_MASK_C : FLAG_MASK_Z;
+            taken = Test(f, flag);
+            if(!(opcode & 0x08))
+                taken = Xor(taken, Splat(0xFFFF));
+        }
+
+        Set16(m_Registers[PC], Select(taken, Add(next, offset), next), mask);
+        Store(m_Cycles, Select(taken, Splat(12), Splat(8)));
+        return true;
+    } else {
+        return false;
+    }
+
+    Set16(m_Registers[PC], Add(pc, Splat(length)), mask);
+    Store(m_Cycles, Splat(cycles));
+    return true;
+}
+
+/**
+ * Run one instruction of a lane on its own Emulator
+ */
+int LockstepCore::ExecuteScalar(int lane) {
+    Scatter(lane);
+    int cycles = m_Lanes[lane]->ExecuteInstruction();
+    Gather(lane);
+    return cycles;
+}
+
+/**
+ * Advance the rest of the lane's machine past an instruction. Servicing an
+ * interrupt moves PC and SP, so those two go through the Emulator
+ */
+void LockstepCore::FinishInstruction(int lane, int cycles) {
+    Emulator &emulator = *m_Lanes[lane];
+
+    emulator.m_ProgramCounter = m_Registers[PC][lane];
+    emulator.m_StackPointer.reg = m_Registers[SP][lane];
+
+    emulator.UpdateTimers(cycles);
+    cycles = emulator.FrameCycles(cycles);
+    emulator.UpdateGraphics(cycles);
+    emulator.DoInterrupts();
+
+    m_Registers[PC][lane] = emulator.m_ProgramCounter;
+    m_Registers[SP][lane] = emulator.m_StackPointer.reg;
+    m_FrameCycles[lane] += cycles;
+}
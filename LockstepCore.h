@@ -0,0 +1,74 @@
+#ifndef LOCKSTEP_CORE_H
+#define LOCKSTEP_CORE_H
+
+#include "Config.h"
+#include "Emulator.h"
+
+// one 256-bit vector of 16-bit registers
+#define LOCKSTEP_LANES 16
+
+/**
+ * Runs up to LOCKSTEP_LANES instances of the same cartridge in lockstep.
+ *
+ * The CPU registers of every lane live in structure-of-arrays form, one
+ * vector per register. Each step picks the lane that is furthest behind,
+ * gathers every lane sitting on the same PC and opcode into a mask and, if
+ * the opcode only touches registers, executes it for the whole group at
+ * once with masked blends. Anything that touches memory, the stack or
+ * interrupt state falls back to that lane's own Emulator. Lanes whose PC
+ * diverges simply end up in different groups and merge again as soon as
+ * they reach the same address.
+ *
+ * Timers, graphics and interrupts still run per lane, so the speedup comes
+ * from the share of instructions that are register-only.
+ */
+class LockstepCore {
+    public:
+        enum REGISTER {
+            AF,
+            BC,
+            DE,
+            HL,
+            SP,
+            PC,
+            NUM_REGISTERS
+        };
+
+        explicit LockstepCore(int lanes);
+        ~LockstepCore();
+        int Lanes() const;
+        Emulator &Lane(int lane);
+        const Emulator &Lane(int lane) const;
+        void Update();
+        void Step();
+        double Occupancy() const;
+        double VectorShare() const;
+
+    private:
+        LockstepCore(const LockstepCore &);
+        LockstepCore &operator=(const LockstepCore &);
+
+        bool Issue();
+        void Gather(int lane);
+        void Scatter(int lane);
+        int SelectGroup(int leader, BYTE &opcode);
+        bool ExecuteVector(BYTE opcode, int group);
+        int ExecuteScalar(int lane);
+        void FinishInstruction(int lane, int cycles);
+
+        Emulator *m_Lanes[LOCKSTEP_LANES];
+        int m_NumLanes;
+
+        // registers, immediates and cycle counts of every lane
+        alignas(32) WORD m_Registers[NUM_REGISTERS][LOCKSTEP_LANES];
+        alignas(32) WORD m_Immediate[LOCKSTEP_LANES];
+        alignas(32) WORD m_Cycles[LOCKSTEP_LANES];
+        int m_FrameCycles[LOCKSTEP_LANES];
+
+        // instructions issued and lane-instructions retired
+        unsigned long long m_Issued;
+        unsigned long long m_Retired;
+        unsigned long long m_VectorRetired;
+};
+
+#endif
@@ -0,0 +1,424 @@
+#include "Config.h"
+#include "MemoryMap.h"
+#include <cstring>
+
+static void ReleasePage(MemoryPage *page) {
+    if(page->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        delete page;
+}
+
+MemoryMap::MemoryMap() {
+    for(int i = 0; i < NUM_PAGES; i++) {
+        m_Pages[i] = new MemoryPage;
+        m_Pages[i]->refs.store(1, std::memory_order_relaxed);
+        memset(m_Pages[i]->data, 0, PAGE_SIZE);
+        m_ReadMap[i] = m_Pages[i]->data;
+        m_WriteMap[i] = m_Pages[i]->data;
+    }
+
+    m_Cartridge = new SharedCartridge;
+    m_Cartridge->refs.store(1, std::memory_order_relaxed);
+    memset(m_Cartridge->data, 0, CARTRIDGE_SIZE);
+
+    m_PagesCopied = 0;
+    m_ROMBank = 1;
+    m_VRAMBank = 0;
+    m_WRAMBank = 1;
+
+    memset(m_WatchCount, 0, sizeof(m_WatchCount));
+    m_NextWatch = 0;
+    m_FiredWatch = -1;
+
+    MapROM(m_ROMBank);
+}
+
+/**
+ * Share all of other's pages, both sides copy on their next write. That
+ * clears other's write map too, so nothing may be using other meanwhile
+ */
+MemoryMap::MemoryMap(const MemoryMap &other) {
+    for(int i = 0; i < NUM_PAGES; i++) {
+        m_Pages[i] = other.m_Pages[i];
+        m_Pages[i]->refs.fetch_add(1, std::memory_order_relaxed);
+        m_ReadMap[i] = other.m_ReadMap[i];
+        m_WriteMap[i] = NULL;
+        other.m_WriteMap[i] = NULL;
+    }
+
+    m_Cartridge = other.m_Cartridge;
+    m_Cartridge->refs.fetch_add(1, std::memory_order_relaxed);
+
+    m_PagesCopied = 0;
+
+    m_Overlays = other.m_Overlays;
+    for(size_t i = 0; i < m_Overlays.size(); i++)
+        m_Overlays[i].page->refs.fetch_add(1, std::memory_order_relaxed);
+    m_ROMBank = other.m_ROMBank;
+    m_VRAMBank = other.m_VRAMBank;
+    m_WRAMBank = other.m_WRAMBank;
+
+    m_Watches = other.m_Watches;
+    memcpy(m_WatchCount, other.m_WatchCount, sizeof(m_WatchCount));
+    m_NextWatch = other.m_NextWatch;
+    m_FiredWatch = other.m_FiredWatch;
+}
+
+MemoryMap::~MemoryMap() {
+    for(int i = 0; i < NUM_PAGES; i++)
+        ReleasePage(m_Pages[i]);
+    for(size_t i = 0; i < m_Overlays.size(); i++)
+        ReleasePage(m_Overlays[i].page);
+
+    if(m_Cartridge->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        delete m_Cartridge;
+}
+
+const BYTE *MemoryMap::PageData(int index) const {
+    return m_ReadMap[index];
+}
+
+/**
+ * A page this map owns outright, copied first if it is shared
+ */
+BYTE *MemoryMap::WritablePage(int index) {
+    if(m_WriteMap[index] != NULL)
+        return m_WriteMap[index];
+
+    MemoryPage *page = m_Pages[index];
+    if(page->refs.load(std::memory_order_acquire) > 1) {
+        MemoryPage *copy = new MemoryPage;
+        copy->refs.store(1, std::memory_order_relaxed);
+        memcpy(copy->data, page->data, PAGE_SIZE);
+
+        ReleasePage(page);
+        m_Pages[index] = copy;
+        m_PagesCopied++;
+    }
+
+    // watched pages stay off the write map so their writes come through
+    // WriteSlow
+    m_ReadMap[index] = m_Pages[index]->data;
+    m_WriteMap[index] = (m_WatchCount[index] == 0) ? m_Pages[index]->data : NULL;
+    return m_Pages[index]->data;
+}
+
+/**
+ * Write a run of bytes that stays within one page, a page at a time
+ * instead of a byte at a time. Watched pages still check every byte
+ */
+void MemoryMap::Copy(WORD address, const BYTE *data, int length) {
+    int index = address >> PAGE_SHIFT;
+    int offset = address & PAGE_MASK;
+    assert((offset + length) <= PAGE_SIZE);
+
+    if(m_WatchCount[index] > 0) {
+        for(int i = 0; i < length; i++)
+            WriteSlow(index, offset + i, data[i]);
+        return;
+    }
+
+    // data can be in this very page, or in the shared copy of it
+    memmove(WritablePage(index) + offset, data, length);
+}
+
+/**
+ * The cartridge image, only written while loading before any copy exists
+ */
+BYTE *MemoryMap::Cartridge() const {
+    return m_Cartridge->data;
+}
+
+/**
+ * Pages copied since this map was made
+ */
+int MemoryMap::PagesCopied() const {
+    return m_PagesCopied;
+}
+
+/**
+ * Map bank 0 at 0x0000 and the given bank at 0x4000, overlays included.
+ * Rom pages are never on the write map, writes there are mapper writes
+ * and don't reach memory
+ */
+void MemoryMap::MapROM(int bank) {
+    const BYTE *rom = m_Cartridge->data + ((bank * 0x4000) % CARTRIDGE_SIZE);
+    for(int i = 0; i < NUM_ROM_PAGES / 2; i++) {
+        m_ReadMap[i] = m_Cartridge->data + (i << PAGE_SHIFT);
+        m_ReadMap[(NUM_ROM_PAGES / 2) + i] = rom + (i << PAGE_SHIFT);
+        m_WriteMap[i] = NULL;
+        m_WriteMap[(NUM_ROM_PAGES / 2) + i] = NULL;
+    }
+
+    for(size_t i = 0; i < m_Overlays.size(); i++) {
+        const Overlay &overlay = m_Overlays[i];
+        if(overlay.index < NUM_ROM_PAGES / 2) {
+            if(overlay.bank == 0)
+                m_ReadMap[overlay.index] = overlay.page->data;
+        } else if(overlay.bank == bank) {
+            m_ReadMap[overlay.index] = overlay.page->data;
+        }
+    }
+
+    m_ROMBank = bank;
+}
+
+/**
+ * Patch a byte of a rom bank, address being where the byte shows up in
+ * the address space. The cartridge image itself is left alone
+ */
+void MemoryMap::PatchROM(int bank, WORD address, BYTE value) {
+    assert(address < 0x8000);
+    int index = address >> PAGE_SHIFT;
+    if(index < NUM_ROM_PAGES / 2)
+        bank = 0;
+
+    Overlay *overlay = NULL;
+    for(size_t i = 0; i < m_Overlays.size(); i++) {
+        if((m_Overlays[i].bank == bank) && (m_Overlays[i].index == index))
+            overlay = &m_Overlays[i];
+    }
+
+    if(overlay == NULL) {
+        Overlay created;
+        created.bank = bank;
+        created.index = index;
+        created.page = new MemoryPage;
+        created.page->refs.store(1, std::memory_order_relaxed);
+
+        int offset = ((bank * 0x4000) + ((index % (NUM_ROM_PAGES / 2)) << PAGE_SHIFT)) % CARTRIDGE_SIZE;
+        memcpy(created.page->data, m_Cartridge->data + offset, PAGE_SIZE);
+        m_Overlays.push_back(created);
+        overlay = &m_Overlays.back();
+    } else if(overlay->page->refs.load(std::memory_order_acquire) > 1) {
+        // a copy still maps this overlay
+        MemoryPage *copy = new MemoryPage;
+        copy->refs.store(1, std::memory_order_relaxed);
+        memcpy(copy->data, overlay->page->data, PAGE_SIZE);
+        ReleasePage(overlay->page);
+        overlay->page = copy;
+    }
+
+    overlay->page->data[address & PAGE_MASK] = value;
+    MapROM(m_ROMBank);
+}
+
+void MemoryMap::ClearROMPatches() {
+    for(size_t i = 0; i < m_Overlays.size(); i++)
+        ReleasePage(m_Overlays[i].page);
+    m_Overlays.clear();
+    MapROM(m_ROMBank);
+}
+
+/**
+ * Map vram bank 0 or 1 at 0x8000, the other one goes to the pages past
+ * the cartridge ram
+ */
+void MemoryMap::MapVRAM(int bank) {
+    assert((bank == 0) || (bank == 1));
+    if(bank == m_VRAMBank)
+        return;
+
+    for(int i = 0; i < NUM_VRAM_BANK_PAGES; i++)
+        SwapPages((0x8000 >> PAGE_SHIFT) + i, FIRST_VRAM_BANK_PAGE + i);
+    MoveWatches(bank, m_WRAMBank);
+    m_VRAMBank = bank;
+}
+
+/**
+ * Map work ram bank 1 to 7 at 0xD000. The bank going out takes its own
+ * slot and the one coming in leaves an unused page set in its slot
+ */
+void MemoryMap::MapWRAM(int bank) {
+    assert((bank >= 1) && (bank <= NUM_WRAM_BANKS));
+    if(bank == m_WRAMBank)
+        return;
+
+    int in = FIRST_WRAM_BANK_PAGE + ((bank - 1) * NUM_WRAM_BANK_PAGES);
+    int out = FIRST_WRAM_BANK_PAGE + ((m_WRAMBank - 1) * NUM_WRAM_BANK_PAGES);
+    for(int i = 0; i < NUM_WRAM_BANK_PAGES; i++) {
+        SwapPages((0xD000 >> PAGE_SHIFT) + i, in + i);
+        SwapPages(in + i, out + i);
+    }
+    MoveWatches(m_VRAMBank, bank);
+    m_WRAMBank = bank;
+}
+
+int MemoryMap::VRAMBank() const {
+    return m_VRAMBank;
+}
+
+int MemoryMap::WRAMBank() const {
+    return m_WRAMBank;
+}
+
+/**
+ * Take the banks a save state was made with, its pages are already where
+ * those banks put them
+ */
+void MemoryMap::RestoreBanks(int vramBank, int wramBank) {
+    MoveWatches(vramBank, wramBank);
+    m_VRAMBank = vramBank;
+    m_WRAMBank = wramBank;
+}
+
+/**
+ * Watch a byte of a page, returns the watch's id. A page of the color
+ * banks is watched in the bank that holds it now, wherever that bank goes
+ */
+int MemoryMap::AddWatch(int index, int offset, WATCH kind, BYTE value, BYTE mask) {
+    assert((index >= 0) && (index < NUM_PAGES) && (offset >= 0) && (offset < PAGE_SIZE));
+    assert(m_WatchCount[index] < 255);
+
+    Watch watch;
+    watch.id = m_NextWatch++;
+    watch.index = index;
+    watch.offset = offset;
+    watch.kind = kind;
+    watch.value = value & mask;
+    watch.mask = mask;
+    m_Watches.push_back(watch);
+
+    m_WatchCount[index]++;
+    m_WriteMap[index] = NULL;
+    return watch.id;
+}
+
+void MemoryMap::RemoveWatch(int id) {
+    for(size_t i = 0; i < m_Watches.size(); i++) {
+        if(m_Watches[i].id != id)
+            continue;
+
+        // the page goes back on the write map with its next write
+        m_WatchCount[m_Watches[i].index]--;
+        m_Watches.erase(m_Watches.begin() + i);
+        return;
+    }
+}
+
+void MemoryMap::ClearWatches() {
+    for(size_t i = 0; i < m_Watches.size(); i++)
+        m_WatchCount[m_Watches[i].index] = 0;
+    m_Watches.clear();
+    m_FiredWatch = -1;
+}
+
+/**
+ * Id of the first watch that fired since the last reset, -1 if none has
+ */
+int MemoryMap::FiredWatch() const {
+    return m_FiredWatch;
+}
+
+void MemoryMap::ResetFiredWatch() {
+    m_FiredWatch = -1;
+}
+
+void MemoryMap::WriteSlow(int index, int offset, BYTE data) {
+    BYTE *page = WritablePage(index);
+    BYTE before = page[offset];
+    page[offset] = data;
+
+    if(m_WatchCount[index] > 0)
+        CheckWatches(index, offset, before, data);
+}
+
+/**
+ * Swap the pages at two indexes. Both take their next write through the
+ * slow path, which puts them back on the write map unless watched
+ */
+void MemoryMap::SwapPages(int a, int b) {
+    MemoryPage *page = m_Pages[a];
+    m_Pages[a] = m_Pages[b];
+    m_Pages[b] = page;
+
+    m_ReadMap[a] = m_Pages[a]->data;
+    m_ReadMap[b] = m_Pages[b]->data;
+    m_WriteMap[a] = NULL;
+    m_WriteMap[b] = NULL;
+}
+
+/**
+ * Where the page at index is once vramBank and wramBank are mapped, index
+ * being where it is with the banks mapped now
+ */
+int MemoryMap::BankedIndex(int index, int vramBank, int wramBank) const {
+    const int vram = 0x8000 >> PAGE_SHIFT;
+    const int wram = 0xD000 >> PAGE_SHIFT;
+
+    if(vramBank != m_VRAMBank) {
+        if((index >= vram) && (index < vram + NUM_VRAM_BANK_PAGES))
+            return FIRST_VRAM_BANK_PAGE + (index - vram);
+        if((index >= FIRST_VRAM_BANK_PAGE) && (index < FIRST_WRAM_BANK_PAGE))
+            return vram + (index - FIRST_VRAM_BANK_PAGE);
+    }
+
+    if(wramBank != m_WRAMBank) {
+        int bank;
+        int page;
+        if((index >= wram) && (index < wram + NUM_WRAM_BANK_PAGES)) {
+            bank = m_WRAMBank;
+            page = index - wram;
+        } else if(index >= FIRST_WRAM_BANK_PAGE) {
+            bank = ((index - FIRST_WRAM_BANK_PAGE) / NUM_WRAM_BANK_PAGES) + 1;
+            page = (index - FIRST_WRAM_BANK_PAGE) % NUM_WRAM_BANK_PAGES;
+
+            // the unused set in the mapped bank's slot moves to the new one's
+            if(bank == m_WRAMBank)
+                bank = wramBank;
+            else if(bank == wramBank)
+                return wram + page;
+        } else {
+            return index;
+        }
+        return FIRST_WRAM_BANK_PAGE + ((bank - 1) * NUM_WRAM_BANK_PAGES) + page;
+    }
+
+    return index;
+}
+
+/**
+ * Keep every watch on the page it was set on across a bank switch to
+ * vramBank and wramBank, called before the new banks are recorded
+ */
+void MemoryMap::MoveWatches(int vramBank, int wramBank) {
+    if(m_Watches.empty())
+        return;
+
+    memset(m_WatchCount, 0, sizeof(m_WatchCount));
+    for(size_t i = 0; i < m_Watches.size(); i++) {
+        int index = BankedIndex(m_Watches[i].index, vramBank, wramBank);
+        m_Watches[i].index = index;
+        m_WatchCount[index]++;
+        m_WriteMap[index] = NULL;
+    }
+}
+
+void MemoryMap::CheckWatches(int index, int offset, BYTE before, BYTE after) {
+    if(m_FiredWatch >= 0)
+        return;
+
+    for(size_t i = 0; i < m_Watches.size(); i++) {
+        const Watch &watch = m_Watches[i];
+        if((watch.index != index) || (watch.offset != offset))
+            continue;
+
+        BYTE was = before & watch.mask;
+        BYTE now = after & watch.mask;
+        bool fired = false;
+        switch(watch.kind) {
+            case WATCH_WRITE : fired = true; break;
+            case WATCH_CHANGE : fired = (now != was); break;
+            case WATCH_EQUAL : fired = (now == watch.value); break;
+            case WATCH_NOT_EQUAL : fired = (now != watch.value); break;
+            case WATCH_GREATER : fired = (now > watch.value); break;
+            case WATCH_LESS : fired = (now < watch.value); break;
+            case WATCH_INCREASE : fired = (now > was); break;
+            case WATCH_DECREASE : fired = (now < was); break;
+        }
+
+        if(fired) {
+            m_FiredWatch = watch.id;
+            return;
+        }
+    }
+}
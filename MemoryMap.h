@@ -0,0 +1,183 @@
+#ifndef MEMORY_MAP_H
+#define MEMORY_MAP_H
+
+#include "Config.h"
+#include <atomic>
+#include <vector>
+
+// memory is handled in 256 byte pages
+#define PAGE_SHIFT 8
+#define PAGE_SIZE (1 << PAGE_SHIFT)
+#define PAGE_MASK (PAGE_SIZE - 1)
+
+// the 64k address space followed by the 32k of cartridge ram banks
+#define NUM_ADDRESS_PAGES (0x10000 >> PAGE_SHIFT)
+#define NUM_ROM_PAGES (0x8000 >> PAGE_SHIFT)
+#define NUM_RAM_PAGES (0x8000 >> PAGE_SHIFT)
+
+// the color game boy's vram bank 1 and switchable work ram banks 1 to 7,
+// kept past the cartridge ram while they aren't mapped in
+#define NUM_VRAM_BANK_PAGES (0x2000 >> PAGE_SHIFT)
+#define NUM_WRAM_BANK_PAGES (0x1000 >> PAGE_SHIFT)
+#define NUM_WRAM_BANKS 7
+#define FIRST_VRAM_BANK_PAGE (NUM_ADDRESS_PAGES + NUM_RAM_PAGES)
+#define FIRST_WRAM_BANK_PAGE (FIRST_VRAM_BANK_PAGE + NUM_VRAM_BANK_PAGES)
+#define NUM_PAGES (FIRST_WRAM_BANK_PAGE + (NUM_WRAM_BANKS * NUM_WRAM_BANK_PAGES))
+
+#define CARTRIDGE_SIZE 0x200000
+
+struct MemoryPage {
+    std::atomic<int> refs;
+    BYTE data[PAGE_SIZE];
+};
+
+struct SharedCartridge {
+    std::atomic<int> refs;
+    BYTE data[CARTRIDGE_SIZE];
+};
+
+/**
+ * Owns the emulator's main memory and cartridge ram as refcounted pages
+ * reached through a read map and a write map.
+ *
+ * Copying a MemoryMap shares every page between the two copies and the
+ * cartridge image as well, so a copy costs a few pointer tables no matter
+ * how much memory there is. Shared pages have no entry in either side's
+ * write map, the first write to one goes down the slow path, which copies
+ * the page if someone else still holds it and then maps it writable again.
+ * Pages are only ever written by their sole owner, so copies can live on
+ * different threads.
+ *
+ * The rom half of the address space is mapped straight onto the cartridge
+ * image, bank 0 and whichever bank MapROM was last given. A patched rom
+ * page is an overlay, a copy of the cartridge page with the patch applied
+ * that is mapped in its place whenever its bank is. Overlays are shared
+ * between copies like any other page, and unpatched pages cost nothing.
+ *
+ * Color vram and work ram banks are switched by swapping the pages behind
+ * 0x8000 - 0x9FFF or 0xD000 - 0xDFFF with the ones kept for the bank past
+ * the cartridge ram, so reads and writes there never look at the bank.
+ * The index of a page in those ranges is always the mapped bank's page.
+ *
+ * Write watches use the same slow path. A page with a watch on it is kept
+ * out of the write map, so only writes to that page pay for the check and
+ * every other page is written exactly as before. Watches are copied along
+ * with the map. A watch on a banked range stays on the bank that was in
+ * when it was added and moves with that bank's pages, so it only fires
+ * while that bank is mapped.
+ */
+class MemoryMap {
+    public:
+        // what a write has to do for a watch to fire, values are compared
+        // after masking
+        enum WATCH {
+            WATCH_WRITE,
+            WATCH_CHANGE,
+            WATCH_EQUAL,
+            WATCH_NOT_EQUAL,
+            WATCH_GREATER,
+            WATCH_LESS,
+            WATCH_INCREASE,
+            WATCH_DECREASE
+        };
+
+        MemoryMap();
+        MemoryMap(const MemoryMap &other);
+        ~MemoryMap();
+
+        BYTE Read(WORD address) const {
+            return m_ReadMap[address >> PAGE_SHIFT][address & PAGE_MASK];
+        }
+
+        void Write(WORD address, BYTE data) {
+            BYTE *page = m_WriteMap[address >> PAGE_SHIFT];
+            if(page != NULL)
+                page[address & PAGE_MASK] = data;
+            else
+                WriteSlow(address >> PAGE_SHIFT, address & PAGE_MASK, data);
+        }
+
+        BYTE ReadRAM(int offset) const {
+            return m_ReadMap[NUM_ADDRESS_PAGES + (offset >> PAGE_SHIFT)][offset & PAGE_MASK];
+        }
+
+        void WriteRAM(int offset, BYTE data) {
+            int index = NUM_ADDRESS_PAGES + (offset >> PAGE_SHIFT);
+            BYTE *page = m_WriteMap[index];
+            if(page != NULL)
+                page[offset & PAGE_MASK] = data;
+            else
+                WriteSlow(index, offset & PAGE_MASK, data);
+        }
+
+        const BYTE *PageData(int index) const;
+        BYTE *WritablePage(int index);
+        void Copy(WORD address, const BYTE *data, int length);
+        BYTE *Cartridge() const;
+        int PagesCopied() const;
+
+        void MapROM(int bank);
+        void PatchROM(int bank, WORD address, BYTE value);
+        void ClearROMPatches();
+
+        void MapVRAM(int bank);
+        void MapWRAM(int bank);
+        int VRAMBank() const;
+        int WRAMBank() const;
+        void RestoreBanks(int vramBank, int wramBank);
+
+        int AddWatch(int index, int offset, WATCH kind, BYTE value, BYTE mask);
+        void RemoveWatch(int id);
+        void ClearWatches();
+        int FiredWatch() const;
+        void ResetFiredWatch();
+
+    private:
+        MemoryMap &operator=(const MemoryMap &);
+
+        struct Overlay {
+            int bank;
+            int index;
+            MemoryPage *page;
+        };
+
+        struct Watch {
+            int id;
+            int index;
+            int offset;
+            WATCH kind;
+            BYTE value;
+            BYTE mask;
+        };
+
+        void WriteSlow(int index, int offset, BYTE data);
+        void SwapPages(int a, int b);
+        int BankedIndex(int index, int vramBank, int wramBank) const;
+        void MoveWatches(int vramBank, int wramBank);
+        void CheckWatches(int index, int offset, BYTE before, BYTE after);
+
+        MemoryPage *m_Pages[NUM_PAGES];
+        const BYTE *m_ReadMap[NUM_PAGES];
+
+        // a copy takes write access away from the original too
+        mutable BYTE *m_WriteMap[NUM_PAGES];
+
+        SharedCartridge *m_Cartridge;
+        int m_PagesCopied;
+
+        // patched rom pages and the bank mapped at 0x4000
+        std::vector<Overlay> m_Overlays;
+        int m_ROMBank;
+
+        // color banks mapped at 0x8000 and 0xD000
+        int m_VRAMBank;
+        int m_WRAMBank;
+
+        // write watches and how many sit on each page
+        std::vector<Watch> m_Watches;
+        BYTE m_WatchCount[NUM_PAGES];
+        int m_NextWatch;
+        int m_FiredWatch;
+};
+
+#endif
@@ -0,0 +1,329 @@
+#include "Config.h"
+#include "Movie.h"
+#include <cstring>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+struct MovieHeader {
+    char magic[4];
+    unsigned version;
+    unsigned keyframeInterval;
+    unsigned reserved;
+};
+
+struct MovieTrailer {
+    unsigned long long indexOffset;
+    unsigned blocks;
+    unsigned frames;
+    char magic[4];
+    unsigned version;
+};
+
+MovieWriter::MovieWriter() {
+    m_File = NULL;
+    m_KeyframeInterval = 0;
+    m_Frames = 0;
+    m_State = NULL;
+    m_StateCapacity = 0;
+}
+
+MovieWriter::~MovieWriter() {
+    Close();
+    delete [] m_State;
+}
+
+/**
+ * Start a new movie. The emulator is only used to size the state buffer
+ */
+bool MovieWriter::Open(const char *path, const Emulator &emulator, int keyframeInterval) {
+    assert(keyframeInterval > 0);
+    Close();
+
+    m_File = fopen(path, "wb");
+    if(m_File == NULL)
+        return false;
+
+    if(m_StateCapacity < emulator.SaveStateSize()) {
+        delete [] m_State;
+        m_StateCapacity = emulator.SaveStateSize();
+        m_State = new BYTE[m_StateCapacity];
+    }
+
+    m_KeyframeInterval = keyframeInterval;
+    m_Frames = 0;
+    m_Index.clear();
+
+    MovieHeader header;
+    memcpy(header.magic, "GBMV", 4);
+    header.version = MOVIE_VERSION;
+    header.keyframeInterval = keyframeInterval;
+    header.reserved = 0;
+
+    return fwrite(&header, sizeof(header), 1, m_File) == 1;
+}
+
+/**
+ * Record the frame about to run, call it after the frame's input is set
+ * and before Update. Every keyframeInterval frames the state is embedded
+ */
+bool MovieWriter::Frame(const Emulator &emulator) {
+    if(m_File == NULL)
+        return false;
+
+    if((m_Frames % m_KeyframeInterval) == 0) {
+        unsigned size = (unsigned)emulator.SaveState(m_State, m_StateCapacity);
+        if(size == 0)
+            return false;
+
+        m_Index.push_back((unsigned long long)ftell(m_File));
+        if(fwrite(&size, sizeof(size), 1, m_File) != 1)
+            return false;
+        if(fwrite(m_State, 1, size, m_File) != size)
+            return false;
+    }
+
+    BYTE joypad = emulator.m_JoypadState;
+    if(fwrite(&joypad, 1, 1, m_File) != 1)
+        return false;
+
+    m_Frames++;
+    return true;
+}
+
+/**
+ * Write the index and trailer and close the file
+ */
+bool MovieWriter::Close() {
+    if(m_File == NULL)
+        return false;
+
+    MovieTrailer trailer;
+    trailer.indexOffset = (unsigned long long)ftell(m_File);
+    trailer.blocks = (unsigned)m_Index.size();
+    trailer.frames = m_Frames;
+    memcpy(trailer.magic, "GBMI", 4);
+    trailer.version = MOVIE_VERSION;
+
+    bool ok = true;
+    if(!m_Index.empty())
+        ok = fwrite(&m_Index[0], sizeof(unsigned long long), m_Index.size(), m_File) == m_Index.size();
+    ok = ok && (fwrite(&trailer, sizeof(trailer), 1, m_File) == 1);
+    ok = (fclose(m_File) == 0) && ok;
+
+    m_File = NULL;
+    return ok;
+}
+
+int MovieWriter::Frames() const {
+    return m_Frames;
+}
+
+MovieReader::MovieReader() {
+    m_Data = NULL;
+    m_Size = 0;
+    m_KeyframeInterval = 0;
+    m_Frames = 0;
+    m_Blocks = 0;
+    m_Index = NULL;
+}
+
+MovieReader::~MovieReader() {
+    Close();
+}
+
+/**
+ * Map a movie and check its header, trailer and index
+ */
+bool MovieReader::Open(const char *path) {
+    Close();
+
+#if !defined(_WIN32)
+    int fd = open(path, O_RDONLY);
+    if(fd < 0)
+        return false;
+
+    struct stat info;
+    if((fstat(fd, &info) != 0) || (info.st_size == 0)) {
+        close(fd);
+        return false;
+    }
+
+    void *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED)
+        return false;
+
+    m_Data = (const BYTE *)data;
+    m_Size = info.st_size;
+#else
+    FILE *in = fopen(path, "rb");
+    if(in == NULL)
+        return false;
+
+    fseek(in, 0, SEEK_END);
+    m_Size = ftell(in);
+    fseek(in, 0, SEEK_SET);
+
+    BYTE *data = new BYTE[m_Size];
+    size_t read = fread(data, 1, m_Size, in);
+    fclose(in);
+    m_Data = data;
+
+    if(read != m_Size) {
+        Close();
+        return false;
+    }
+#endif
+
+    MovieHeader header;
+    MovieTrailer trailer;
+    if(m_Size < sizeof(header) + sizeof(trailer)) {
+        Close();
+        return false;
+    }
+
+    memcpy(&header, m_Data, sizeof(header));
+    memcpy(&trailer, m_Data + m_Size - sizeof(trailer), sizeof(trailer));
+
+    bool valid = (memcmp(header.magic, "GBMV", 4) == 0) && (memcmp(trailer.magic, "GBMI", 4) == 0);
+    valid = valid && (header.version == MOVIE_VERSION) && (header.keyframeInterval > 0);
+    valid = valid && (trailer.indexOffset + (trailer.blocks * sizeof(unsigned long long)) + sizeof(trailer) == m_Size);
+    valid = valid && (trailer.blocks == (trailer.frames + header.keyframeInterval - 1) / header.keyframeInterval);
+    if(!valid) {
+        Close();
+        return false;
+    }
+
+    m_KeyframeInterval = header.keyframeInterval;
+    m_Frames = trailer.frames;
+    m_Blocks = trailer.blocks;
+    m_Index = m_Data + trailer.indexOffset;
+
+    // every block has to fit in front of the index
+    for(int block = 0; block < m_Blocks; block++) {
+        unsigned long long offset;
+        memcpy(&offset, m_Index + (block * sizeof(offset)), sizeof(offset));
+
+        unsigned stateSize = 0;
+        if(offset + sizeof(stateSize) > trailer.indexOffset) {
+            Close();
+            return false;
+        }
+        memcpy(&stateSize, m_Data + offset, sizeof(stateSize));
+
+        int frames = m_Frames - (block * m_KeyframeInterval);
+        if(frames > m_KeyframeInterval)
+            frames = m_KeyframeInterval;
+
+        if(offset + sizeof(stateSize) + stateSize + frames > trailer.indexOffset) {
+            Close();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void MovieReader::Close() {
+    if(m_Data == NULL)
+        return;
+
+#if !defined(_WIN32)
+    munmap((void *)m_Data, m_Size);
+#else
+    delete [] m_Data;
+#endif
+
+    m_Data = NULL;
+    m_Size = 0;
+    m_Frames = 0;
+    m_Blocks = 0;
+    m_Index = NULL;
+}
+
+int MovieReader::Frames() const {
+    return m_Frames;
+}
+
+int MovieReader::KeyframeInterval() const {
+    return m_KeyframeInterval;
+}
+
+/**
+ * Start of a block's state, the frame inputs follow it
+ */
+const BYTE *MovieReader::Block(int block, unsigned &stateSize) const {
+    unsigned long long offset;
+    memcpy(&offset, m_Index + (block * sizeof(offset)), sizeof(offset));
+    memcpy(&stateSize, m_Data + offset, sizeof(stateSize));
+    return m_Data + offset + sizeof(stateSize);
+}
+
+/**
+ * Joypad state of a frame
+ */
+BYTE MovieReader::Input(int frame) const {
+    assert((frame >= 0) && (frame < m_Frames));
+
+    unsigned stateSize = 0;
+    const BYTE *state = Block(frame / m_KeyframeInterval, stateSize);
+    return state[stateSize + (frame % m_KeyframeInterval)];
+}
+
+/**
+ * Put the emulator at the start of a frame, before its input is applied.
+ * Frames() seeks to the end of the movie. At most keyframeInterval - 1
+ * frames are replayed, except when seeking to the end of a movie whose
+ * length is a multiple of keyframeInterval, which replays all of its last
+ * block. Replayed frames raise no events
+ */
+bool MovieReader::Seek(Emulator &emulator, int frame) const {
+    if((frame < 0) || (frame > m_Frames) || (m_Blocks == 0))
+        return false;
+
+    int block = frame / m_KeyframeInterval;
+    if(block >= m_Blocks)
+        block = m_Blocks - 1;
+
+    unsigned stateSize = 0;
+    const BYTE *state = Block(block, stateSize);
+    if(!emulator.LoadState(state, stateSize))
+        return false;
+
+    // only the last replayed frame is drawn
+    bool headless = emulator.m_Headless;
+    unsigned muted = emulator.m_MutedEvents;
+    emulator.m_MutedEvents = EVENT_ALL;
+    for(int i = block * m_KeyframeInterval; i < frame; i++) {
+        emulator.m_Headless = headless || (i < frame - 1);
+        ApplyInput(emulator, state[stateSize + (i - (block * m_KeyframeInterval))]);
+        emulator.Update();
+    }
+    emulator.m_Headless = headless;
+    emulator.m_MutedEvents = muted;
+
+    return true;
+}
+
+/**
+ * Press and release keys until m_JoypadState matches, going through
+ * KeyPressed so the joypad interrupt fires as it did while recording
+ */
+void MovieReader::ApplyInput(Emulator &emulator, BYTE joypad) {
+    BYTE changed = emulator.m_JoypadState ^ joypad;
+
+    for(int key = 0; key < 8; key++) {
+        if(!TestBit(changed, key))
+            continue;
+
+        if(TestBit(joypad, key))
+            emulator.KeyReleased(key);
+        else
+            emulator.KeyPressed(key);
+    }
+}
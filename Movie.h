@@ -0,0 +1,72 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include "Config.h"
+#include "Emulator.h"
+
+#define MOVIE_VERSION 1
+
+/**
+ * Input movies: the joypad state of every frame, with a save state
+ * embedded every keyframeInterval frames.
+ *
+ * The file is a header, then one block per keyframe holding the state and
+ * the joypad bytes of the frames that follow it, then an index of block
+ * offsets and a fixed size trailer that points at the index. Everything is
+ * stored in host byte order. Frames within a movie are numbered from 0 and
+ * the joypad byte is m_JoypadState as it was when the frame ran.
+ */
+class MovieWriter {
+    public:
+        MovieWriter();
+        ~MovieWriter();
+        bool Open(const char *path, const Emulator &emulator, int keyframeInterval = 600);
+        bool Frame(const Emulator &emulator);
+        bool Close();
+        int Frames() const;
+
+    private:
+        MovieWriter(const MovieWriter &);
+        MovieWriter &operator=(const MovieWriter &);
+
+        FILE *m_File;
+        int m_KeyframeInterval;
+        int m_Frames;
+        BYTE *m_State;
+        size_t m_StateCapacity;
+        std::vector<unsigned long long> m_Index;
+};
+
+/**
+ * Reads a movie through a read-only mapping of the whole file, so opening
+ * costs nothing and any frame's input is a single lookup. Seek loads the
+ * keyframe before a frame and replays the inputs up to it.
+ */
+class MovieReader {
+    public:
+        MovieReader();
+        ~MovieReader();
+        bool Open(const char *path);
+        void Close();
+        int Frames() const;
+        int KeyframeInterval() const;
+        BYTE Input(int frame) const;
+        bool Seek(Emulator &emulator, int frame) const;
+
+        static void ApplyInput(Emulator &emulator, BYTE joypad);
+
+    private:
+        MovieReader(const MovieReader &);
+        MovieReader &operator=(const MovieReader &);
+
+        const BYTE *Block(int block, unsigned &stateSize) const;
+
+        const BYTE *m_Data;
+        size_t m_Size;
+        int m_KeyframeInterval;
+        int m_Frames;
+        int m_Blocks;
+        const BYTE *m_Index;
+};
+
+#endif
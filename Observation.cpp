@@ -0,0 +1,170 @@
+#include "Config.h"
+#include "Observation.h"
+#include "Emulator.h"
+#include <cstring>
+
+#if defined(__SSSE3__)
+#include <immintrin.h>
+#endif
+
+// gray level of each shade, the same as the rgb screen. Padded to 16 for
+// the shuffle
+alignas(16) static const BYTE SHADE_GRAY[16] = {255, 0xCC, 0x77, 0};
+
+/**
+ * Gray levels of count shades
+ */
+static void ShadesToGray(const BYTE *shades, BYTE *gray, int count) {
+    int i = 0;
+
+#if defined(__SSSE3__)
+    const __m128i table = _mm_load_si128((const __m128i *)SHADE_GRAY);
+    for(; i + 16 <= count; i += 16) {
+        __m128i indices = _mm_loadu_si128((const __m128i *)(shades + i));
+        _mm_storeu_si128((__m128i *)(gray + i), _mm_shuffle_epi8(table, indices));
+    }
+#endif
+
+    for(; i < count; i++)
+        gray[i] = SHADE_GRAY[shades[i] & 3];
+}
+
+Observation::Observation(int width, int height, FILTER filter, int top, int left, int cropHeight, int cropWidth) {
+    assert((top >= 0) && (left >= 0) && (cropHeight > 0) && (cropWidth > 0));
+    assert(((top + cropHeight) <= 144) && ((left + cropWidth) <= 160));
+    assert((width > 0) && (height > 0) && (width <= cropWidth) && (height <= cropHeight));
+
+    m_Width = width;
+    m_Height = height;
+    m_Filter = filter;
+    m_Top = top;
+    m_Left = left;
+    m_CropWidth = cropWidth;
+
+    MakeTaps(cropWidth, width, m_Columns);
+    MakeTaps(cropHeight, height, m_Rows);
+}
+
+int Observation::Width() const {
+    return m_Width;
+}
+
+int Observation::Height() const {
+    return m_Height;
+}
+
+int Observation::Size() const {
+    return m_Width * m_Height;
+}
+
+/**
+ * Source pixels of each of outputs pixels scaled down from length pixels.
+ * Nearest takes the pixel under the output's centre, area every pixel the
+ * output overlaps weighted by how much of it, adding up to 256
+ */
+void Observation::MakeTaps(int length, int outputs, Taps &taps) const {
+    // an output covers length / outputs pixels, and can start part way in
+    taps.count = (m_Filter == NEAREST) ? 1 : ((length + outputs - 1) / outputs) + 1;
+    taps.index.assign(taps.count * outputs, 0);
+    taps.weight.assign(taps.count * outputs, 0);
+
+    for(int o = 0; o < outputs; o++) {
+        if(m_Filter == NEAREST) {
+            taps.index[o] = (((2 * o) + 1) * length) / (2 * outputs);
+            taps.weight[o] = 256;
+            continue;
+        }
+
+        // in units of 1/outputs of a source pixel the output covers
+        // [begin, end), which is length long
+        int begin = o * length;
+        int end = (o + 1) * length;
+        int total = 0;
+        int largest = o;
+        int k = 0;
+
+        for(int s = begin / outputs; (s * outputs) < end; s++) {
+            int from = (s * outputs > begin) ? s * outputs : begin;
+            int to = ((s + 1) * outputs < end) ? (s + 1) * outputs : end;
+            int weight = ((to - from) * 256) / length;
+            if(weight == 0)
+                continue;
+
+            int tap = (k++ * outputs) + o;
+            taps.index[tap] = s;
+            taps.weight[tap] = weight;
+            total += weight;
+            if(weight > taps.weight[largest])
+                largest = tap;
+        }
+
+        // rounding loses a little, the biggest share takes it
+        taps.weight[largest] += 256 - total;
+    }
+}
+
+/**
+ * One row of the crop in gray and filtered across to the output width,
+ * in 1/256ths
+ */
+void Observation::FilterRow(const Emulator &emulator, int row, int *out) const {
+    BYTE gray[160];
+    ShadesToGray(emulator.m_ScreenShades[m_Top + row] + m_Left, gray, m_CropWidth);
+
+    memset(out, 0, m_Width * sizeof(int));
+    for(int k = 0; k < m_Columns.count; k++) {
+        const int *index = &m_Columns.index[k * m_Width];
+        const int *weight = &m_Columns.weight[k * m_Width];
+        for(int x = 0; x < m_Width; x++)
+            out[x] += weight[x] * gray[index[x]];
+    }
+}
+
+/**
+ * Write the observation of the screen as it is now, Size() bytes of gray
+ * rows first
+ */
+void Observation::Render(const Emulator &emulator, BYTE *out) const {
+    if(m_Filter == NEAREST) {
+        BYTE shades[160];
+        for(int y = 0; y < m_Height; y++) {
+            const BYTE *row = emulator.m_ScreenShades[m_Top + m_Rows.index[y]] + m_Left;
+            for(int x = 0; x < m_Width; x++)
+                shades[x] = row[m_Columns.index[x]];
+            ShadesToGray(shades, out + (y * m_Width), m_Width);
+        }
+        return;
+    }
+
+    // neighbouring outputs share the source row between them, so the last
+    // two filtered rows are kept
+    int filtered[2][160];
+    int filteredRow[2] = {-1, -1};
+    int sums[160];
+
+    for(int y = 0; y < m_Height; y++) {
+        memset(sums, 0, m_Width * sizeof(int));
+
+        for(int k = 0; k < m_Rows.count; k++) {
+            int tap = (k * m_Height) + y;
+            int weight = m_Rows.weight[tap];
+            if(weight == 0)
+                continue;
+
+            int row = m_Rows.index[tap];
+            int slot = row & 1;
+            if(filteredRow[slot] != row) {
+                FilterRow(emulator, row, filtered[slot]);
+                filteredRow[slot] = row;
+            }
+
+            const int *line = filtered[slot];
+            for(int x = 0; x < m_Width; x++)
+                sums[x] += weight * line[x];
+        }
+
+        BYTE *line = out + (y * m_Width);
+        for(int x = 0; x < m_Width; x++)
+            line[x] = (BYTE)((sums[x] + (1 << 15)) >> 16);
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef OBSERVATION_H
+#define OBSERVATION_H
+
+#include "Config.h"
+#include <vector>
+
+class Emulator;
+
+/**
+ * Turns the screen into the grayscale observations an agent is trained on,
+ * read straight from the 2-bit shades in m_ScreenShades with no rgb frame
+ * in between.
+ *
+ * An observation is a crop of the screen scaled to width x height, either
+ * by nearest neighbour or by averaging the area of the crop each output
+ * pixel covers. The crop and scale are worked out once in the constructor
+ * as per-column and per-row tables, so Render only walks them, filtering
+ * each source row across once and then adding rows down. Shades go
+ * to gray through a 16 byte table, 16 pixels at a time when the build
+ * targets SSSE3 and a byte at a time otherwise. Observations can't be
+ * larger than their crop.
+ */
+class Observation {
+    public:
+        enum FILTER {
+            NEAREST,
+            AREA
+        };
+
+        Observation(int width, int height, FILTER filter, int top = 0, int left = 0, int cropHeight = 144, int cropWidth = 160);
+        int Width() const;
+        int Height() const;
+        int Size() const;
+        void Render(const Emulator &emulator, BYTE *out) const;
+
+    private:
+        // the source pixels of each output pixel along one axis and their
+        // shares in 1/256ths, tap k of output o at [(k * outputs) + o].
+        // Outputs with fewer taps are padded with zero weights
+        struct Taps {
+            int count;
+            std::vector<int> index;
+            std::vector<int> weight;
+        };
+
+        void MakeTaps(int length, int outputs, Taps &taps) const;
+        void FilterRow(const Emulator &emulator, int row, int *out) const;
+
+        int m_Width;
+        int m_Height;
+        FILTER m_Filter;
+        int m_Top;
+        int m_Left;
+        int m_CropWidth;
+
+        // indexes are relative to the crop
+        Taps m_Columns;
+        Taps m_Rows;
+};
+
+#endif
@@ -0,0 +1,326 @@
+#include "Config.h"
+#include "Emulator.h"
+#include "PPU.h"
+
+/**
+ * Write one emulator color into the screen buffer
+ */
+static void PutPixel(Emulator &emulator, int x, int y, Emulator::COLOR col) {
+    int red = 0;
+    int green = 0;
+    int blue = 0;
+
+    switch(col) {
+        case Emulator::WHITE: red = 255; green = 255; blue = 255; break;
+        case Emulator::LIGHT_GRAY: red = 0xCC; green = 0xCC; blue = 0xCC; break;
+        case Emulator::DARK_GRAY: red = 0x77; green = 0x77; blue = 0x77; break;
+        default: break;
+    }
+
+    emulator.m_ScreenData[x][y][0] = red;
+    emulator.m_ScreenData[x][y][1] = green;
+    emulator.m_ScreenData[x][y][2] = blue;
+    emulator.m_ScreenShades[y][x] = col;
+}
+
+/**
+ * Reset the fifo to the top of the frame
+ */
+void FifoPPU::Reset() {
+    m_Line = -1;
+    m_Dot = 0;
+    m_Mode3Length = 172;
+    m_Mode3Done = false;
+    m_StallDots = 0;
+    m_BgCount = 0;
+    m_FetchX = 0;
+    m_Discard = 0;
+    m_InWindow = false;
+    m_WindowLine = 0;
+    m_SpriteCount = 0;
+    m_NumSprites = 0;
+    m_NextSprite = 0;
+    m_LX = 0;
+}
+
+// a bool restored as raw bytes, anything but 0 or 1 isn't one
+static bool ValidBool(const bool &value) {
+    return *reinterpret_cast<const BYTE *>(&value) <= 1;
+}
+
+/**
+ * Whether counters restored from a save state stay inside the fifos, the
+ * sprite list and, while pixels are still to come, the screen
+ */
+bool FifoPPU::ValidState() const {
+    if(!ValidBool(m_Mode3Done) || !ValidBool(m_InWindow))
+        return false;
+    if((m_BgCount < 0) || (m_BgCount > 8) || (m_SpriteCount < 0) || (m_SpriteCount > 8))
+        return false;
+    if((m_NumSprites < 0) || (m_NumSprites > 10) || (m_NextSprite < 0) || (m_NextSprite > m_NumSprites))
+        return false;
+    if((m_Line < -1) || (m_Line > 153) || (m_LX < 0) || (m_LX > 160))
+        return false;
+
+    // a line of -1 is replaced by the real one before any dot is clocked
+    return m_Mode3Done || (m_Line < 144 && m_LX < 160);
+}
+
+/**
+ * Length of mode 3 on the current line. Until the last pixel has been
+ * pushed the line is still in mode 3, so report the longest possible
+ */
+int FifoPPU::Mode3Length() const {
+    return m_Mode3Done ? m_Mode3Length : 456 - 80;
+}
+
+/**
+ * Clock the fifo up to the given dot of the current line
+ */
+void FifoPPU::Step(Emulator &emulator, int dot) {
+    int line = emulator.ReadMemory(0xFF44);
+    if(line != m_Line)
+        BeginLine(emulator, line);
+
+    if(dot > 456)
+        dot = 456;
+
+    while(m_Dot < dot) {
+        // mode 2 takes the first 80 dots, pixels only move in mode 3
+        if(!m_Mode3Done && (m_Dot >= 80))
+            ClockDot(emulator);
+        m_Dot++;
+    }
+}
+
+/**
+ * Start a new line, this is also where the OAM scan happens
+ */
+void FifoPPU::BeginLine(Emulator &emulator, int line) {
+    // the window has its own line counter which only moves on lines it was drawn on
+    if(line == 0)
+        m_WindowLine = 0;
+    else if(m_InWindow)
+        m_WindowLine++;
+
+    m_Line = line;
+    m_Dot = 0;
+    m_Mode3Length = 172;
+    m_Mode3Done = (line >= 144);
+
+    // the first tile is fetched twice before any pixel comes out
+    m_StallDots = 12;
+    m_BgCount = 0;
+    m_FetchX = 0;
+    m_Discard = emulator.ReadMemory(0xFF43) & 0x7;
+    m_InWindow = false;
+    m_SpriteCount = 0;
+    m_NumSprites = 0;
+    m_NextSprite = 0;
+    m_LX = 0;
+
+    if(m_Mode3Done)
+        return;
+
+    // pick up to 10 sprites on this line in OAM order
+    BYTE lcdControl = emulator.ReadMemory(0xFF40);
+    int ysize = TestBit(lcdControl, 2) ? 16 : 8;
+    for(int sprite = 0; (sprite < 40) && (m_NumSprites < 10); sprite++) {
+        WORD index = 0xFE00 + (sprite * 4);
+        int yPos = emulator.ReadMemory(index) - 16;
+        if((line < yPos) || (line >= yPos + ysize))
+            continue;
+
+        Sprite &entry = m_Sprites[m_NumSprites++];
+        entry.x = emulator.ReadMemory(index + 1);
+        entry.line = line - yPos;
+        entry.tile = emulator.ReadMemory(index + 2);
+        entry.attributes = emulator.ReadMemory(index + 3);
+    }
+
+    // sort by x, stable so OAM order breaks ties
+    for(int i = 1; i < m_NumSprites; i++) {
+        Sprite entry = m_Sprites[i];
+        int j = i - 1;
+        while((j >= 0) && (m_Sprites[j].x > entry.x)) {
+            m_Sprites[j + 1] = m_Sprites[j];
+            j--;
+        }
+        m_Sprites[j + 1] = entry;
+    }
+}
+
+/**
+ * Run one dot of mode 3
+ */
+void FifoPPU::ClockDot(Emulator &emulator) {
+    if(m_StallDots > 0) {
+        m_StallDots--;
+        return;
+    }
+
+    BYTE lcdControl = emulator.ReadMemory(0xFF40);
+
+    // the window restarts the fetcher at its first pixel
+    if(!m_InWindow && TestBit(lcdControl, 5)) {
+        int windowY = emulator.ReadMemory(0xFF4A);
+        int windowX = emulator.ReadMemory(0xFF4B);
+        if((m_Line >= windowY) && (m_LX + 7 >= windowX)) {
+            m_InWindow = true;
+            m_BgCount = 0;
+            m_FetchX = 0;
+            m_Discard = 0;
+            m_StallDots = 5;
+            return;
+        }
+    }
+
+    // a sprite starting here stalls the fifo while it is fetched
+    if(TestBit(lcdControl, 1)) {
+        while((m_NextSprite < m_NumSprites) && (m_Sprites[m_NextSprite].x - 8 <= m_LX)) {
+            FetchSprite(emulator, m_Sprites[m_NextSprite]);
+            m_NextSprite++;
+
+            int fineX = (m_LX + emulator.ReadMemory(0xFF43)) & 0x7;
+            m_StallDots += 11 - ((fineX < 5) ? fineX : 5);
+        }
+
+        if(m_StallDots > 0) {
+            m_StallDots--;
+            return;
+        }
+    }
+
+    if(m_BgCount == 0)
+        FetchBackground(emulator);
+
+    BYTE bgColor = m_BgFifo[8 - m_BgCount];
+    m_BgCount--;
+
+    // fine scroll drops the first pixels of the line
+    if(m_Discard > 0) {
+        m_Discard--;
+        return;
+    }
+
+    PushPixel(emulator, bgColor);
+}
+
+/**
+ * Fetch the next 8 background or window pixels into the fifo
+ */
+void FifoPPU::FetchBackground(Emulator &emulator) {
+    BYTE lcdControl = emulator.ReadMemory(0xFF40);
+    WORD backgroundMemory = 0;
+    BYTE xPos = 0;
+    BYTE yPos = 0;
+
+    if(m_InWindow) {
+        backgroundMemory = TestBit(lcdControl, 6) ? 0x9C00 : 0x9800;
+        xPos = m_FetchX * 8;
+        yPos = m_WindowLine;
+    } else {
+        backgroundMemory = TestBit(lcdControl, 3) ? 0x9C00 : 0x9800;
+        xPos = emulator.ReadMemory(0xFF43) + (m_FetchX * 8);
+        yPos = emulator.ReadMemory(0xFF42) + m_Line;
+    }
+
+    WORD tileAddress = backgroundMemory + ((yPos / 8) * 32) + (xPos / 8);
+    BYTE tileNum = emulator.ReadMemory(tileAddress);
+
+    // 0x8800 addressing uses signed tile identifiers around 0x9000
+    WORD tileLocation = 0;
+    if(TestBit(lcdControl, 4))
+        tileLocation = 0x8000 + (tileNum * 16);
+    else
+        tileLocation = 0x9000 + (((SIGNED_BYTE)tileNum) * 16);
+
+    BYTE line = (yPos % 8) * 2;
+    BYTE data1 = emulator.ReadMemory(tileLocation + line);
+    BYTE data2 = emulator.ReadMemory(tileLocation + line + 1);
+
+    for(int pixel = 0; pixel < 8; pixel++) {
+        int colorBit = 7 - pixel;
+        m_BgFifo[pixel] = (BitGetVal(data2, colorBit) << 1) | BitGetVal(data1, colorBit);
+    }
+
+    m_BgCount = 8;
+    m_FetchX++;
+}
+
+/**
+ * Mix a sprite's row into the sprite fifo. Pixels already in the fifo
+ * belong to a sprite with a lower x so they win over this one
+ */
+void FifoPPU::FetchSprite(Emulator &emulator, const Sprite &sprite) {
+    BYTE lcdControl = emulator.ReadMemory(0xFF40);
+    int ysize = TestBit(lcdControl, 2) ? 16 : 8;
+
+    int line = sprite.line;
+    if(TestBit(sprite.attributes, 6))
+        line = ysize - 1 - line;
+
+    BYTE tile = sprite.tile;
+    if(ysize == 16)
+        tile &= 0xFE;
+
+    WORD dataAddress = 0x8000 + (tile * 16) + (line * 2);
+    BYTE data1 = emulator.ReadMemory(dataAddress);
+    BYTE data2 = emulator.ReadMemory(dataAddress + 1);
+
+    BYTE palette = TestBit(sprite.attributes, 4) ? 1 : 0;
+    BYTE priority = TestBit(sprite.attributes, 7) ? 1 : 0;
+    bool xFlip = TestBit(sprite.attributes, 5);
+
+    // sprites hanging off the left edge lose their first pixels
+    int start = m_LX - (sprite.x - 8);
+
+    for(int pixel = start; pixel < 8; pixel++) {
+        int colorBit = xFlip ? pixel : 7 - pixel;
+        BYTE color = (BitGetVal(data2, colorBit) << 1) | BitGetVal(data1, colorBit);
+
+        int slot = pixel - start;
+        if(slot >= m_SpriteCount) {
+            m_SpriteFifo[slot] = 0;
+            m_SpriteCount = slot + 1;
+        }
+
+        if(((m_SpriteFifo[slot] & 0x3) == 0) && (color != 0))
+            m_SpriteFifo[slot] = color | (palette << 2) | (priority << 3);
+    }
+}
+
+/**
+ * Mix the background and sprite fifos and send the pixel to the screen
+ */
+void FifoPPU::PushPixel(Emulator &emulator, BYTE bgColor) {
+    BYTE lcdControl = emulator.ReadMemory(0xFF40);
+    if(!TestBit(lcdControl, 0))
+        bgColor = 0;
+
+    BYTE sprite = 0;
+    if(m_SpriteCount > 0) {
+        sprite = m_SpriteFifo[0];
+        for(int i = 1; i < m_SpriteCount; i++)
+            m_SpriteFifo[i - 1] = m_SpriteFifo[i];
+        m_SpriteCount--;
+    }
+
+    // headless frames keep the fifo timing and skip the pixel itself
+    if(!emulator.m_Headless) {
+        Emulator::COLOR col;
+        BYTE spriteColor = sprite & 0x3;
+        if((spriteColor != 0) && (!TestBit(sprite, 3) || (bgColor == 0)))
+            col = emulator.GetColor(spriteColor, TestBit(sprite, 2) ? 0xFF49 : 0xFF48);
+        else
+            col = emulator.GetColor(bgColor, 0xFF47);
+
+        PutPixel(emulator, m_LX, m_Line, col);
+    }
+    m_LX++;
+
+    if(m_LX == 160) {
+        m_Mode3Done = true;
+        m_Mode3Length = m_Dot - 80 + 1;
+    }
+}
@@ -0,0 +1,95 @@
+#ifndef PPU_H
+#define PPU_H
+
+#include "Config.h"
+
+class Emulator;
+
+/**
+ * PPU accuracy tiers
+ *
+ * The emulator core holds one of these policies as m_PPU and the choice is
+ * made at compile time, so a build only contains the path it asked for.
+ * Both policies sit underneath the same SetLCDStatus state machine, they
+ * only differ in how long mode 3 lasts and when pixels reach the screen.
+ *
+ * Define GB_ACCURATE_PPU to build the pixel FIFO tier.
+ */
+
+/**
+ * Fast tier: mode 3 is a fixed 172 cycles and DrawScanLine renders the
+ * whole line at once when it starts
+ */
+class ScanlinePPU {
+    public:
+        static const bool PIXEL_FIFO = false;
+
+        void Reset() {}
+        bool ValidState() const { return true; }
+        int Mode3Length() const { return 172; }
+        void Step(Emulator &, int) {}
+};
+
+/**
+ * Accurate tier: mode 3 is clocked a dot at a time through a background
+ * and a sprite pixel FIFO. Its length varies with SCX, the window and the
+ * sprites on the line, and registers are sampled when each pixel is pushed
+ * so mid-line writes show up where they happen.
+ */
+class FifoPPU {
+    public:
+        static const bool PIXEL_FIFO = true;
+
+        FifoPPU() { Reset(); }
+        void Reset();
+        bool ValidState() const;
+        int Mode3Length() const;
+        void Step(Emulator &emulator, int dot);
+
+    private:
+        struct Sprite {
+            int x;
+            int line;
+            BYTE tile;
+            BYTE attributes;
+        };
+
+        void BeginLine(Emulator &emulator, int line);
+        void ClockDot(Emulator &emulator);
+        void FetchBackground(Emulator &emulator);
+        void FetchSprite(Emulator &emulator, const Sprite &sprite);
+        void PushPixel(Emulator &emulator, BYTE bgColor);
+
+        // line timing
+        int m_Line;
+        int m_Dot;
+        int m_Mode3Length;
+        bool m_Mode3Done;
+        int m_StallDots;
+
+        // background fifo and fetcher
+        BYTE m_BgFifo[8];
+        int m_BgCount;
+        int m_FetchX;
+        int m_Discard;
+        bool m_InWindow;
+        int m_WindowLine;
+
+        // sprite fifo, holds color | palette << 2 | priority << 3
+        BYTE m_SpriteFifo[8];
+        int m_SpriteCount;
+        Sprite m_Sprites[10];
+        int m_NumSprites;
+        int m_NextSprite;
+
+        // screen x of the next pixel
+        int m_LX;
+};
+
+#ifdef GB_ACCURATE_PPU
+typedef FifoPPU PPUPolicy;
+#else
+typedef ScanlinePPU PPUPolicy;
+#endif
+
+#endif
@@ -0,0 +1,220 @@
+#include "Config.h"
+#include "PerfCounters.h"
+#include <cstring>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+static const char *EVENT_NAMES[NUM_PERF_EVENTS] = {"cycles", "instructions", "branch-misses", "l1d-misses", "llc-misses"};
+
+PerfCounters::PerfCounters() {
+    for(int i = 0; i < NUM_PERF_EVENTS; i++) {
+        m_Fds[i] = -1;
+        m_Slots[i] = -1;
+    }
+    m_Leader = -1;
+    m_NumOpen = 0;
+    memset(&m_Overhead, 0, sizeof(m_Overhead));
+}
+
+PerfCounters::~PerfCounters() {
+    Close();
+}
+
+const char *PerfCounters::EventName(PERF_EVENT event) {
+    return EVENT_NAMES[event];
+}
+
+#if defined(__linux__)
+static int OpenEvent(PERF_EVENT event, int group) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.disabled = (group < 0) ? 1 : 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    switch(event) {
+        case PERF_CYCLES :
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CPU_CYCLES;
+            break;
+        case PERF_INSTRUCTIONS :
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+            break;
+        case PERF_BRANCH_MISSES :
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+            break;
+        case PERF_L1D_MISSES :
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            break;
+        case PERF_LLC_MISSES :
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CACHE_MISSES;
+            break;
+        default :
+            return -1;
+    }
+
+    // this thread on any cpu
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+}
+#endif
+
+/**
+ * Open every event the host allows, false if it allows none
+ */
+bool PerfCounters::Open() {
+    Close();
+
+#if defined(__linux__)
+    for(int i = 0; i < NUM_PERF_EVENTS; i++) {
+        int fd = OpenEvent((PERF_EVENT)i, m_Leader);
+        if(fd < 0)
+            continue;
+
+        if(m_Leader < 0)
+            m_Leader = fd;
+        m_Fds[i] = fd;
+        m_Slots[i] = m_NumOpen++;
+    }
+
+    if(m_Leader < 0)
+        return false;
+
+    ioctl(m_Leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(m_Leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+
+    // the cheapest of a few back to back reads is the cost of reading
+    for(int i = 0; i < 16; i++) {
+        PerfCounts before, after;
+        Read(before);
+        Read(after);
+        for(int event = 0; event < NUM_PERF_EVENTS; event++) {
+            unsigned long long cost = after.events[event] - before.events[event];
+            if((i == 0) || (cost < m_Overhead.events[event]))
+                m_Overhead.events[event] = cost;
+        }
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+void PerfCounters::Close() {
+#if defined(__linux__)
+    for(int i = 0; i < NUM_PERF_EVENTS; i++) {
+        if(m_Fds[i] >= 0)
+            close(m_Fds[i]);
+        m_Fds[i] = -1;
+        m_Slots[i] = -1;
+    }
+#endif
+    m_Leader = -1;
+    m_NumOpen = 0;
+    memset(&m_Overhead, 0, sizeof(m_Overhead));
+}
+
+bool PerfCounters::Opened() const {
+    return m_Leader >= 0;
+}
+
+bool PerfCounters::Available(PERF_EVENT event) const {
+    return m_Slots[event] >= 0;
+}
+
+/**
+ * Counts since Open. When the kernel had to share the counters with
+ * others the counts are scaled up to the whole time they were enabled
+ */
+void PerfCounters::Read(PerfCounts &counts) const {
+    memset(&counts, 0, sizeof(counts));
+
+#if defined(__linux__)
+    if(m_Leader < 0)
+        return;
+
+    unsigned long long buffer[3 + NUM_PERF_EVENTS];
+    if(read(m_Leader, buffer, sizeof(buffer)) < (ssize_t)(3 * sizeof(unsigned long long)))
+        return;
+
+    unsigned long long enabled = buffer[1];
+    unsigned long long running = buffer[2];
+    for(int i = 0; i < NUM_PERF_EVENTS; i++) {
+        if((m_Slots[i] < 0) || (m_Slots[i] >= (int)buffer[0]))
+            continue;
+
+        unsigned long long value = buffer[3 + m_Slots[i]];
+        if((running > 0) && (running < enabled))
+            value = (unsigned long long)((double)value * enabled / running);
+        counts.events[i] = value;
+    }
+#endif
+}
+
+/**
+ * Add after - before to total
+ */
+void PerfCounters::Accumulate(PerfCounts &total, const PerfCounts &after, const PerfCounts &before) {
+    for(int i = 0; i < NUM_PERF_EVENTS; i++)
+        total.events[i] += after.events[i] - before.events[i];
+}
+
+/**
+ * Accumulate less the cost of the read that ended the interval
+ */
+void PerfCounters::Charge(PerfCounts &total, const PerfCounts &after, const PerfCounts &before) const {
+    for(int i = 0; i < NUM_PERF_EVENTS; i++) {
+        unsigned long long delta = after.events[i] - before.events[i];
+        total.events[i] += (delta > m_Overhead.events[i]) ? delta - m_Overhead.events[i] : 0;
+    }
+}
+
+/**
+ * Run a frame as Emulator::UpdateTimed does, adding the counts of each
+ * part to counts. Reading costs a system call per part per instruction,
+ * so do this on sampled frames only
+ */
+void PerfCounters::Update(Emulator &emulator, SubsystemCounts &counts) {
+    PerfCounts last, now;
+    int cyclesThisUpdate = 0;
+
+    Read(last);
+    while(cyclesThisUpdate < FRAME_CYCLES) {
+        int cycles = emulator.ExecuteInstruction();
+        Read(now);
+        Charge(counts.subsystems[PERF_CPU], now, last);
+        last = now;
+
+        emulator.UpdateTimers(cycles);
+        Read(now);
+        Charge(counts.subsystems[PERF_TIMERS], now, last);
+        last = now;
+
+        cycles = emulator.FrameCycles(cycles);
+        cyclesThisUpdate += cycles;
+
+        emulator.UpdateGraphics(cycles);
+        Read(now);
+        Charge(counts.subsystems[PERF_GRAPHICS], now, last);
+        last = now;
+
+        emulator.DoInterrupts();
+        Read(now);
+        Charge(counts.subsystems[PERF_INTERRUPTS], now, last);
+        last = now;
+    }
+
+    emulator.EndFrame();
+    Read(now);
+    Charge(counts.subsystems[PERF_SOUND], now, last);
+}
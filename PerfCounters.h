@@ -0,0 +1,77 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include "Config.h"
+#include "Emulator.h"
+
+enum PERF_EVENT {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_BRANCH_MISSES,
+    PERF_L1D_MISSES,
+    PERF_LLC_MISSES,
+    NUM_PERF_EVENTS
+};
+
+// the same split as SubsystemTimes
+enum PERF_SUBSYSTEM {
+    PERF_CPU,
+    PERF_TIMERS,
+    PERF_GRAPHICS,
+    PERF_INTERRUPTS,
+    PERF_SOUND,
+    NUM_PERF_SUBSYSTEMS
+};
+
+// user space counts, 0 for events that aren't available
+struct PerfCounts {
+    unsigned long long events[NUM_PERF_EVENTS];
+};
+
+struct SubsystemCounts {
+    PerfCounts subsystems[NUM_PERF_SUBSYSTEMS];
+};
+
+/**
+ * Host hardware counters for this thread through perf_event_open, all in
+ * one group so they are read together with a single read. Only user space
+ * is counted.
+ *
+ * Any event the host won't give us is left out and reads as 0, and when
+ * none can be opened, as on other systems, in most containers or with
+ * perf_event_paranoid too high, Open fails and everything reads as 0.
+ * Reading has a small user space cost of its own, Open measures it and
+ * Update takes it off every subsystem.
+ */
+class PerfCounters {
+    public:
+        PerfCounters();
+        ~PerfCounters();
+        bool Open();
+        void Close();
+        bool Opened() const;
+        bool Available(PERF_EVENT event) const;
+        void Read(PerfCounts &counts) const;
+        void Update(Emulator &emulator, SubsystemCounts &counts);
+
+        static const char *EventName(PERF_EVENT event);
+        static void Accumulate(PerfCounts &total, const PerfCounts &after, const PerfCounts &before);
+
+    private:
+        PerfCounters(const PerfCounters &);
+        PerfCounters &operator=(const PerfCounters &);
+
+        void Charge(PerfCounts &total, const PerfCounts &after, const PerfCounts &before) const;
+
+        int m_Fds[NUM_PERF_EVENTS];
+
+        // position of each event in a group read, -1 if it isn't open
+        int m_Slots[NUM_PERF_EVENTS];
+        int m_Leader;
+        int m_NumOpen;
+
+        // what a back to back pair of reads counts
+        PerfCounts m_Overhead;
+};
+
+#endif
@@ -0,0 +1,244 @@
+#include "Config.h"
+#include "Profiler.h"
+#include "Disassembler.h"
+#include <algorithm>
+#include <cstring>
+
+Profiler::Profiler(Emulator &emulator) : m_Emulator(emulator) {
+    Reset();
+}
+
+Profiler::~Profiler() {
+}
+
+void Profiler::Reset() {
+    memset(m_Opcodes, 0, sizeof(m_Opcodes));
+    memset(&m_Halted, 0, sizeof(m_Halted));
+    memset(m_PageReads, 0, sizeof(m_PageReads));
+    memset(m_PageWrites, 0, sizeof(m_PageWrites));
+    m_Cycles = 0;
+
+    for(int i = 0; i < NUM_CODE_REGIONS; i++)
+        std::vector<Counter>().swap(m_Code[i]);
+}
+
+unsigned long long Profiler::Instructions() const {
+    unsigned long long total = 0;
+    for(int i = 0; i < 256; i++)
+        total += m_Opcodes[i].count;
+    return total;
+}
+
+/**
+ * Run one frame, profiled or not. Either way the frame is the same as
+ * Emulator::Update runs
+ */
+template <bool PROFILE>
+void Profiler::Update() {
+    if(!PROFILE) {
+        m_Emulator.Update();
+        return;
+    }
+
+    int cycles = 0;
+    while(cycles < FRAME_CYCLES)
+        cycles += Step();
+    m_Emulator.EndFrame();
+}
+
+template void Profiler::Update<false>();
+template void Profiler::Update<true>();
+
+/**
+ * Step one instruction, charging it to its opcode and address and its data
+ * accesses to their pages
+ */
+int Profiler::Step() {
+    Emulator &e = m_Emulator;
+
+    if(e.m_Halted) {
+        int cycles = e.Step();
+        m_Halted.count++;
+        m_Halted.cycles += cycles;
+        m_Cycles += cycles;
+        return cycles;
+    }
+
+    WORD pc = e.m_ProgramCounter;
+    int opcode = e.ReadMemory(pc);
+    Counter &site = CodeCounter(pc);
+
+    WORD addresses[2];
+    int reads = DataReads(e, addresses);
+    for(int i = 0; i < reads; i++)
+        m_PageReads[addresses[i] >> PAGE_SHIFT]++;
+    int writes = DataWrites(e, addresses);
+    for(int i = 0; i < writes; i++)
+        m_PageWrites[addresses[i] >> PAGE_SHIFT]++;
+
+    int cycles = e.Step();
+
+    m_Opcodes[opcode].count++;
+    m_Opcodes[opcode].cycles += cycles;
+    if(opcode == 0xCB) {
+        Counter &cb = m_Opcodes[0x100 + e.ReadMemory(pc + 1)];
+        cb.count++;
+        cb.cycles += cycles;
+    }
+
+    site.count++;
+    site.cycles += cycles;
+    m_Cycles += cycles;
+    return cycles;
+}
+
+/**
+ * The counter for an address in the bank mapped there now, regions are
+ * only allocated once code runs in them
+ */
+Profiler::Counter &Profiler::CodeCounter(WORD pc) {
+    int region = 0;
+    if(pc >= 0x8000)
+        region = 1;
+    else if(pc >= 0x4000)
+        region = 2 + (m_Emulator.m_CurrentROMBank % PROFILE_MAX_ROM_BANKS);
+
+    std::vector<Counter> &counters = m_Code[region];
+    if(counters.empty()) {
+        Counter zero = {0, 0};
+        counters.assign((region == 1) ? 0x8000 : 0x4000, zero);
+    }
+
+    return counters[pc - RegionBase(region)];
+}
+
+/**
+ * Rom bank of a region, -1 for code running from ram
+ */
+int Profiler::RegionBank(int region) const {
+    if(region == 0)
+        return 0;
+    return (region == 1) ? -1 : region - 2;
+}
+
+WORD Profiler::RegionBase(int region) const {
+    if(region == 0)
+        return 0x0000;
+    return (region == 1) ? 0x8000 : 0x4000;
+}
+
+/**
+ * Every address that ran, in address order within each region
+ */
+void Profiler::Sites(std::vector<Site> &sites) const {
+    for(int region = 0; region < NUM_CODE_REGIONS; region++) {
+        const std::vector<Counter> &counters = m_Code[region];
+        for(size_t i = 0; i < counters.size(); i++) {
+            if(counters[i].count == 0)
+                continue;
+
+            Site site;
+            site.region = region;
+            site.address = (WORD)(RegionBase(region) + i);
+            site.counter = &counters[i];
+            sites.push_back(site);
+        }
+    }
+}
+
+static bool MoreCycles(const std::pair<int, unsigned long long> &a, const std::pair<int, unsigned long long> &b) {
+    return a.second > b.second;
+}
+
+static double Percent(unsigned long long part, unsigned long long total) {
+    return (total > 0) ? (100.0 * part) / total : 0.0;
+}
+
+/**
+ * Flat profile: opcodes and addresses sorted by cycles, top of each only,
+ * then every page with data accesses
+ */
+void Profiler::WriteProfile(FILE *out, int top) const {
+    fprintf(out, "%llu instructions, %llu cycles, %.1f%% halted\n\n", Instructions(), m_Cycles, Percent(m_Halted.cycles, m_Cycles));
+
+    std::vector<std::pair<int, unsigned long long> > opcodes;
+    for(int i = 0; i < 512; i++) {
+        if((m_Opcodes[i].count > 0) && (i != 0xCB))
+            opcodes.push_back(std::make_pair(i, m_Opcodes[i].cycles));
+    }
+    std::sort(opcodes.begin(), opcodes.end(), MoreCycles);
+
+    fprintf(out, "opcodes by cycles\n");
+    fprintf(out, "  %%cycles        count       cycles  opcode\n");
+    for(size_t i = 0; (i < opcodes.size()) && ((int)i < top); i++) {
+        const Counter &counter = m_Opcodes[opcodes[i].first];
+        fprintf(out, "  %6.2f%% %12llu %12llu  %s%02X  %s\n", Percent(counter.cycles, m_Cycles), counter.count, counter.cycles,
+            (opcodes[i].first >= 0x100) ? "CB " : "", opcodes[i].first & 0xFF, OpcodeName(opcodes[i].first));
+    }
+
+    std::vector<Site> sites;
+    Sites(sites);
+    std::vector<std::pair<int, unsigned long long> > order;
+    for(size_t i = 0; i < sites.size(); i++)
+        order.push_back(std::make_pair((int)i, sites[i].counter->cycles));
+    std::sort(order.begin(), order.end(), MoreCycles);
+
+    fprintf(out, "\naddresses by cycles\n");
+    fprintf(out, "  %%cycles        count       cycles  bank:addr  instruction\n");
+    for(size_t i = 0; (i < order.size()) && ((int)i < top); i++) {
+        const Site &site = sites[order[i].first];
+        BYTE bytes[MAX_INSTRUCTION_LENGTH];
+        char text[32];
+        ReadCode(m_Emulator, RegionBank(site.region), site.address, bytes);
+        Disassemble(bytes, site.address, text, sizeof(text));
+
+        int bank = RegionBank(site.region);
+        fprintf(out, "  %6.2f%% %12llu %12llu  ", Percent(site.counter->cycles, m_Cycles), site.counter->count, site.counter->cycles);
+        if(bank < 0)
+            fprintf(out, "  --:%04X  %s\n", site.address, text);
+        else
+            fprintf(out, "  %02X:%04X  %s\n", bank, site.address, text);
+    }
+
+    fprintf(out, "\ndata accesses by page\n");
+    fprintf(out, "  page         reads       writes\n");
+    for(int page = 0; page < NUM_ADDRESS_PAGES; page++) {
+        if((m_PageReads[page] > 0) || (m_PageWrites[page] > 0))
+            fprintf(out, "  %02Xxx  %12llu %12llu\n", page, m_PageReads[page], m_PageWrites[page]);
+    }
+}
+
+/**
+ * Disassembly of the code that ran, every instruction with its count and
+ * share of cycles. A gap in the addresses starts a new block
+ */
+void Profiler::WriteAnnotated(FILE *out) const {
+    std::vector<Site> sites;
+    Sites(sites);
+
+    int region = -1;
+    WORD next = 0;
+    for(size_t i = 0; i < sites.size(); i++) {
+        const Site &site = sites[i];
+        BYTE bytes[MAX_INSTRUCTION_LENGTH];
+        char text[32];
+        ReadCode(m_Emulator, RegionBank(site.region), site.address, bytes);
+        int length = Disassemble(bytes, site.address, text, sizeof(text));
+
+        if((site.region != region) || (site.address != next)) {
+            int bank = RegionBank(site.region);
+            if(bank < 0)
+                fprintf(out, "\nram:%04X\n", site.address);
+            else
+                fprintf(out, "\nbank %02X:%04X\n", bank, site.address);
+        }
+        region = site.region;
+        next = site.address + length;
+
+        char hex[3 * MAX_INSTRUCTION_LENGTH + 1] = "";
+        for(int j = 0; j < length; j++)
+            snprintf(hex + (j * 3), sizeof(hex) - (j * 3), "%02X ", bytes[j]);
+
+        fprintf(out, "%12llu %6.2f%%  %04X  %-9s %s\n", site.counter->count, Percent(site.counter->cycles, m_Cycles), site.address, hex, text);
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "Config.h"
+#include "Emulator.h"
+
+// 0x0000 - 0x3FFF, 0x8000 - 0xFFFF, then one per rom bank at 0x4000
+#define PROFILE_MAX_ROM_BANKS 128
+#define NUM_CODE_REGIONS (2 + PROFILE_MAX_ROM_BANKS)
+
+/**
+ * Guest profiler: executions and cycles per opcode, CB opcodes included,
+ * and per (bank, PC), and data reads and writes per 256-byte page.
+ *
+ * Like the debugger it adds nothing to the emulator's own paths. Update
+ * takes the flag as a template argument, Update<false> is
+ * Emulator::Update and Update<true> steps the frame itself, looking at
+ * each instruction before it runs. Memory accesses are decoded from the
+ * instruction, so reads done by OAM DMA and pushes done by interrupt
+ * dispatch are not counted. Time spent halted is counted on its own.
+ */
+class Profiler {
+    public:
+        explicit Profiler(Emulator &emulator);
+        ~Profiler();
+        template <bool PROFILE> void Update();
+        void Reset();
+        unsigned long long Instructions() const;
+        void WriteProfile(FILE *out, int top = 40) const;
+        void WriteAnnotated(FILE *out) const;
+
+    private:
+        Profiler(const Profiler &);
+        Profiler &operator=(const Profiler &);
+
+        struct Counter {
+            unsigned long long count;
+            unsigned long long cycles;
+        };
+
+        // a code address and the counter it was charged to
+        struct Site {
+            int region;
+            WORD address;
+            const Counter *counter;
+        };
+
+        int Step();
+        Counter &CodeCounter(WORD pc);
+        int RegionBank(int region) const;
+        WORD RegionBase(int region) const;
+        void Sites(std::vector<Site> &sites) const;
+
+        Emulator &m_Emulator;
+        Counter m_Opcodes[512];
+        Counter m_Halted;
+        unsigned long long m_Cycles;
+        std::vector<Counter> m_Code[NUM_CODE_REGIONS];
+        unsigned long long m_PageReads[NUM_ADDRESS_PAGES];
+        unsigned long long m_PageWrites[NUM_ADDRESS_PAGES];
+};
+
+#endif
@@ -0,0 +1,176 @@
+#include "Config.h"
+#include "Resampler.h"
+#include <cstring>
+#include <cmath>
+
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+Resampler::Resampler() {
+    Setup(131072, 48000);
+}
+
+/**
+ * Build the filter bank for a conversion. The cutoff sits a little under
+ * the lower of the two nyquist frequencies
+ */
+void Resampler::Setup(int inputRate, int outputRate) {
+    const double pi = 3.14159265358979323846;
+
+    m_InputRate = inputRate;
+    m_OutputRate = outputRate;
+
+    double cutoff = 0.45 * ((outputRate < inputRate) ? outputRate : inputRate) / inputRate;
+
+    for(int phase = 0; phase < RESAMPLER_PHASES; phase++) {
+        double sum = 0;
+        for(int i = 0; i < RESAMPLER_TAPS; i++) {
+            double x = i - (RESAMPLER_TAPS / 2) + 1 - ((double)phase / RESAMPLER_PHASES);
+            double sinc = (x == 0) ? 1.0 : sin(2 * pi * cutoff * x) / (2 * pi * cutoff * x);
+            double w = (x + (RESAMPLER_TAPS / 2)) / RESAMPLER_TAPS;
+            double window = 0.42 - 0.5 * cos(2 * pi * w) + 0.08 * cos(4 * pi * w);
+            m_Filter[phase][i] = (float)(sinc * window);
+            sum += sinc * window;
+        }
+
+        for(int i = 0; i < RESAMPLER_TAPS; i++)
+            m_Filter[phase][i] = (float)(m_Filter[phase][i] / sum);
+    }
+
+    SetRateAdjust(1.0);
+    Reset();
+}
+
+void Resampler::Reset() {
+    memset(m_History, 0, sizeof(m_History));
+    m_Available = RESAMPLER_TAPS;
+    m_Position = 0;
+}
+
+/**
+ * Scale the output rate, > 1 produces more output per input frame
+ */
+void Resampler::SetRateAdjust(double adjust) {
+    double step = (double)m_InputRate / (m_OutputRate * adjust);
+    m_Step = (unsigned long long)(step * 4294967296.0);
+}
+
+/**
+ * Upper bound on the output of one Process call
+ */
+int Resampler::MaxOutput(int inFrames) const {
+    return (int)(((unsigned long long)(inFrames + RESAMPLER_TAPS) << 32) / m_Step) + 1;
+}
+
+/**
+ * Resample interleaved stereo input, returns the number of frames written.
+ * Size out with MaxOutput or input that doesn't fit is dropped
+ */
+int Resampler::Process(const short *in, int inFrames, short *out, int maxOutFrames) {
+    int written = 0;
+
+    while(inFrames > 0) {
+        int count = RESAMPLER_TAPS + RESAMPLER_BLOCK - m_Available;
+        if(count > inFrames)
+            count = inFrames;
+
+        // out of room for output, the rest of the input is dropped
+        if(count == 0)
+            break;
+
+        for(int i = 0; i < count; i++) {
+            m_History[0][m_Available + i] = in[i * 2];
+            m_History[1][m_Available + i] = in[(i * 2) + 1];
+        }
+
+        m_Available += count;
+        in += count * 2;
+        inFrames -= count;
+
+        written += Drain(out + (written * 2), maxOutFrames - written);
+    }
+
+    return written;
+}
+
+/**
+ * Produce every output frame the buffered input allows, then shift the
+ * last RESAMPLER_TAPS frames down as history for the next block
+ */
+int Resampler::Drain(short *out, int maxOutFrames) {
+    int written = 0;
+
+    while(written < maxOutFrames) {
+        int base = (int)(m_Position >> 32);
+        if(base + RESAMPLER_TAPS > m_Available)
+            break;
+
+        int phase = (int)((m_Position >> (32 - RESAMPLER_PHASE_BITS)) & (RESAMPLER_PHASES - 1));
+        const float *taps = m_Filter[phase];
+        const float *left = m_History[0] + base;
+        const float *right = m_History[1] + base;
+        float sumLeft = 0;
+        float sumRight = 0;
+
+#if defined(__AVX__)
+        __m256 accLeft = _mm256_setzero_ps();
+        __m256 accRight = _mm256_setzero_ps();
+        for(int i = 0; i < RESAMPLER_TAPS; i += 8) {
+            __m256 coef = _mm256_load_ps(taps + i);
+            accLeft = _mm256_add_ps(accLeft, _mm256_mul_ps(coef, _mm256_loadu_ps(left + i)));
+            accRight = _mm256_add_ps(accRight, _mm256_mul_ps(coef, _mm256_loadu_ps(right + i)));
+        }
+        __m128 lo = _mm_add_ps(_mm256_castps256_ps128(accLeft), _mm256_extractf128_ps(accLeft, 1));
+        __m128 hi = _mm_add_ps(_mm256_castps256_ps128(accRight), _mm256_extractf128_ps(accRight, 1));
+        __m128 pair = _mm_hadd_ps(lo, hi);
+        pair = _mm_hadd_ps(pair, pair);
+        sumLeft = _mm_cvtss_f32(pair);
+        sumRight = _mm_cvtss_f32(_mm_shuffle_ps(pair, pair, 1));
+#elif defined(__SSE2__)
+        __m128 accLeft = _mm_setzero_ps();
+        __m128 accRight = _mm_setzero_ps();
+        for(int i = 0; i < RESAMPLER_TAPS; i += 4) {
+            __m128 coef = _mm_load_ps(taps + i);
+            accLeft = _mm_add_ps(accLeft, _mm_mul_ps(coef, _mm_loadu_ps(left + i)));
+            accRight = _mm_add_ps(accRight, _mm_mul_ps(coef, _mm_loadu_ps(right + i)));
+        }
+        float lanes[8];
+        _mm_storeu_ps(lanes, accLeft);
+        _mm_storeu_ps(lanes + 4, accRight);
+        sumLeft = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+        sumRight = (lanes[4] + lanes[5]) + (lanes[6] + lanes[7]);
+#else
+        for(int i = 0; i < RESAMPLER_TAPS; i++) {
+            sumLeft += taps[i] * left[i];
+            sumRight += taps[i] * right[i];
+        }
+#endif
+
+        float samples[2] = { sumLeft, sumRight };
+        for(int side = 0; side < 2; side++) {
+            float value = samples[side];
+            if(value > 32767.0f)
+                value = 32767.0f;
+            else if(value < -32768.0f)
+                value = -32768.0f;
+            out[(written * 2) + side] = (short)lrintf(value);
+        }
+
+        written++;
+        m_Position += m_Step;
+    }
+
+    // keep what the next output frames still need
+    int keep = (int)(m_Position >> 32);
+    if(keep > m_Available - RESAMPLER_TAPS)
+        keep = m_Available - RESAMPLER_TAPS;
+    if(keep > 0) {
+        for(int side = 0; side < 2; side++)
+            memmove(m_History[side], m_History[side] + keep, (m_Available - keep) * sizeof(float));
+        m_Available -= keep;
+        m_Position -= (unsigned long long)keep << 32;
+    }
+
+    return written;
+}
@@ -0,0 +1,48 @@
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include "Config.h"
+
+// filter length in input samples and number of fractional phases
+#define RESAMPLER_TAPS 32
+#define RESAMPLER_PHASE_BITS 8
+#define RESAMPLER_PHASES (1 << RESAMPLER_PHASE_BITS)
+
+// input frames converted per Process call before the history is shifted
+#define RESAMPLER_BLOCK 4096
+
+/**
+ * Stereo polyphase windowed-sinc resampler, used to take the APU's native
+ * rate down to the host rate. The ratio can be nudged on every call so a
+ * caller can steer the output rate to keep a buffer level steady.
+ *
+ * The inner product over the taps is vectorized with AVX or SSE when the
+ * build targets them and falls back to plain loops otherwise.
+ */
+class Resampler {
+    public:
+        Resampler();
+        void Setup(int inputRate, int outputRate);
+        void Reset();
+        void SetRateAdjust(double adjust);
+        int Process(const short *in, int inFrames, short *out, int maxOutFrames);
+        int MaxOutput(int inFrames) const;
+
+    private:
+        int Drain(short *out, int maxOutFrames);
+
+        int m_InputRate;
+        int m_OutputRate;
+
+        // input position in 32.32 fixed point, relative to the history buffer
+        unsigned long long m_Position;
+        unsigned long long m_Step;
+
+        // deinterleaved input, RESAMPLER_TAPS frames of history then new input
+        alignas(32) float m_History[2][RESAMPLER_TAPS + RESAMPLER_BLOCK];
+        int m_Available;
+
+        alignas(32) float m_Filter[RESAMPLER_PHASES][RESAMPLER_TAPS];
+};
+
+#endif
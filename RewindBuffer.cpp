@@ -0,0 +1,288 @@
+#include "Config.h"
+#include "RewindBuffer.h"
+#include <cstring>
+
+// longest zero run and literal a single token can hold
+#define RLE_MAX_RUN 0x8000
+#define RLE_MAX_LITERAL 128
+
+static inline BYTE Diff(const BYTE *state, const BYTE *previous, size_t i) {
+    return previous ? (state[i] ^ previous[i]) : state[i];
+}
+
+static inline bool ZeroWord(const BYTE *state, const BYTE *previous, size_t i) {
+    unsigned long long a;
+    unsigned long long b = 0;
+    memcpy(&a, state + i, sizeof(a));
+    if(previous)
+        memcpy(&b, previous + i, sizeof(b));
+    return a == b;
+}
+
+/**
+ * Run-length encode state XOR previous, or state itself without a
+ * previous. A control byte below 0x80 starts a zero run whose length - 1
+ * is that byte and the next, 0x80 and up is followed by (control & 0x7F)
+ * + 1 literal bytes
+ */
+static size_t Encode(const BYTE *state, const BYTE *previous, size_t length, BYTE *out) {
+    BYTE *start = out;
+    size_t i = 0;
+
+    while(i < length) {
+        size_t run = 0;
+        while((i + run + 8 <= length) && (run + 8 <= RLE_MAX_RUN) && ZeroWord(state, previous, i + run))
+            run += 8;
+        while((i + run < length) && (run < RLE_MAX_RUN) && (Diff(state, previous, i + run) == 0))
+            run++;
+
+        // short runs are cheaper left inside a literal
+        if((run >= 3) || ((run > 0) && (i + run == length))) {
+            *out++ = (BYTE)((run - 1) >> 8);
+            *out++ = (BYTE)((run - 1) & 0xFF);
+            i += run;
+            continue;
+        }
+
+        BYTE *control = out++;
+        int literal = 0;
+        while((i < length) && (literal < RLE_MAX_LITERAL)) {
+            if((i + 2 < length) && (Diff(state, previous, i) == 0) &&
+               (Diff(state, previous, i + 1) == 0) && (Diff(state, previous, i + 2) == 0))
+                break;
+
+            *out++ = Diff(state, previous, i);
+            i++;
+            literal++;
+        }
+        *control = (BYTE)(0x80 | (literal - 1));
+    }
+
+    return out - start;
+}
+
+/**
+ * XOR an encoded frame into state. Zero runs leave bytes alone, so a
+ * keyframe is decoded by applying it to zeroed memory
+ */
+static void Apply(const BYTE *in, size_t size, BYTE *state) {
+    const BYTE *end = in + size;
+
+    while(in < end) {
+        BYTE control = *in++;
+        if(control & 0x80) {
+            int literal = (control & 0x7F) + 1;
+            for(int i = 0; i < literal; i++)
+                state[i] ^= in[i];
+            in += literal;
+            state += literal;
+        } else {
+            state += ((control << 8) | *in++) + 1;
+        }
+    }
+}
+
+RewindBuffer::RewindBuffer(const Emulator &emulator, size_t bytes, int maxFrames, int keyframeInterval) {
+    assert((maxFrames > 0) && (keyframeInterval > 0));
+
+    m_Capacity = bytes;
+    m_Buffer = new BYTE[bytes];
+    m_MaxFrames = maxFrames;
+    m_Entries = new Entry[maxFrames];
+    m_KeyframeInterval = keyframeInterval;
+
+    // scratch has to hold an all literal encoding of a whole state
+    m_StateCapacity = emulator.SaveStateSize();
+    m_Last = new BYTE[m_StateCapacity];
+    m_Next = new BYTE[m_StateCapacity];
+    m_Scratch = new BYTE[m_StateCapacity + (m_StateCapacity / RLE_MAX_LITERAL) + 2];
+    memset(m_Last, 0, m_StateCapacity);
+    memset(m_Next, 0, m_StateCapacity);
+    m_LastSize = 0;
+    m_NextSize = 0;
+
+    Clear();
+}
+
+RewindBuffer::~RewindBuffer() {
+    delete [] m_Buffer;
+    delete [] m_Entries;
+    delete [] m_Last;
+    delete [] m_Next;
+    delete [] m_Scratch;
+}
+
+void RewindBuffer::Clear() {
+    m_WriteOffset = 0;
+    m_First = 0;
+    m_Count = 0;
+    m_SinceKeyframe = 0;
+    m_Used = 0;
+}
+
+int RewindBuffer::Frames() const {
+    return m_Count;
+}
+
+size_t RewindBuffer::BytesUsed() const {
+    return m_Used;
+}
+
+RewindBuffer::Entry &RewindBuffer::EntryAt(int index) {
+    return m_Entries[(m_First + index) % m_MaxFrames];
+}
+
+/**
+ * Record the state at the end of a frame
+ */
+void RewindBuffer::Push(const Emulator &emulator) {
+    unsigned size = (unsigned)emulator.SaveState(m_Next, m_StateCapacity);
+    assert(size > 0);
+
+    // both buffers stay zero past their state so sizes can differ
+    if(m_NextSize > size)
+        memset(m_Next + size, 0, m_NextSize - size);
+    m_NextSize = size;
+
+    if(m_Count == m_MaxFrames)
+        DropOldest();
+
+    bool keyframe = (m_Count == 0) || (m_SinceKeyframe >= m_KeyframeInterval);
+    size_t encoded = 0;
+    size_t offset = 0;
+
+    while(true) {
+        unsigned length = keyframe ? size : ((size > m_LastSize) ? size : m_LastSize);
+        encoded = Encode(m_Next, keyframe ? NULL : m_Last, length, m_Scratch);
+
+        if(!Reserve(encoded, offset)) {
+            // a single frame bigger than the whole buffer
+            Clear();
+            return;
+        }
+
+        // making room can evict the keyframe this delta was built on
+        if(keyframe || (m_Count > 0))
+            break;
+        keyframe = true;
+    }
+
+    memcpy(m_Buffer + offset, m_Scratch, encoded);
+    m_WriteOffset = offset + encoded;
+    m_Used += encoded;
+
+    Entry &entry = EntryAt(m_Count++);
+    entry.offset = offset;
+    entry.encodedSize = (unsigned)encoded;
+    entry.stateSize = size;
+    entry.keyframe = keyframe;
+
+    BYTE *swap = m_Last;
+    m_Last = m_Next;
+    m_Next = swap;
+    m_NextSize = m_LastSize;
+    m_LastSize = size;
+
+    m_SinceKeyframe = keyframe ? 1 : (m_SinceKeyframe + 1);
+}
+
+/**
+ * Go back the given number of frames, 0 being the last one pushed. The
+ * frames after it are dropped so history continues from there
+ */
+bool RewindBuffer::Rewind(Emulator &emulator, int frames) {
+    if((frames < 0) || (frames >= m_Count))
+        return false;
+
+    // rebuilt in the spare buffer, m_Last stays the base of the next delta
+    // until the emulator has taken the state
+    int index = m_Count - 1 - frames;
+    Entry &entry = EntryAt(index);
+    Reconstruct(index, m_Next);
+    m_NextSize = entry.stateSize;
+    if(!emulator.LoadState(m_Next, m_NextSize))
+        return false;
+
+    BYTE *swap = m_Last;
+    m_Last = m_Next;
+    m_Next = swap;
+    m_NextSize = m_LastSize;
+    m_LastSize = entry.stateSize;
+
+    for(int i = index + 1; i < m_Count; i++)
+        m_Used -= EntryAt(i).encodedSize;
+    m_Count = index + 1;
+    m_WriteOffset = entry.offset + entry.encodedSize;
+
+    m_SinceKeyframe = 1;
+    while(!EntryAt(index - m_SinceKeyframe + 1).keyframe)
+        m_SinceKeyframe++;
+
+    return true;
+}
+
+/**
+ * Rebuild a frame from its keyframe and the deltas after it
+ */
+void RewindBuffer::Reconstruct(int index, BYTE *state) {
+    int keyframe = index;
+    while(!EntryAt(keyframe).keyframe)
+        keyframe--;
+
+    memset(state, 0, m_StateCapacity);
+    for(int i = keyframe; i <= index; i++) {
+        Entry &entry = EntryAt(i);
+        Apply(m_Buffer + entry.offset, entry.encodedSize, state);
+    }
+}
+
+/**
+ * Find size contiguous bytes after the newest frame, wrapping to the start
+ * and dropping old frames as needed
+ */
+bool RewindBuffer::Reserve(size_t size, size_t &offset) {
+    if(size > m_Capacity)
+        return false;
+
+    while(true) {
+        if(m_Count == 0) {
+            offset = 0;
+            return true;
+        }
+
+        size_t tail = EntryAt(0).offset;
+        if(m_WriteOffset > tail) {
+            // used space is [tail, write)
+            if(m_Capacity - m_WriteOffset >= size) {
+                offset = m_WriteOffset;
+                return true;
+            }
+            if(tail >= size) {
+                offset = 0;
+                return true;
+            }
+        } else if(tail - m_WriteOffset >= size) {
+            // wrapped, used space is [tail, end) and [0, write)
+            offset = m_WriteOffset;
+            return true;
+        }
+
+        DropOldest();
+    }
+}
+
+/**
+ * Drop the oldest frame and any deltas that depended on it
+ */
+void RewindBuffer::DropOldest() {
+    do {
+        m_Used -= EntryAt(0).encodedSize;
+        m_First = (m_First + 1) % m_MaxFrames;
+        m_Count--;
+    } while((m_Count > 0) && !EntryAt(0).keyframe);
+
+    if(m_Count == 0) {
+        m_WriteOffset = 0;
+        m_First = 0;
+    }
+}
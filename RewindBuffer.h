@@ -0,0 +1,71 @@
+#ifndef REWIND_BUFFER_H
+#define REWIND_BUFFER_H
+
+#include "Config.h"
+#include "Emulator.h"
+
+/**
+ * History of recent frames for rewind and undo.
+ *
+ * Every frame pushed is a save state. Every keyframeInterval frames the
+ * state is stored whole, in between only its XOR against the previous
+ * frame is kept. Both are run-length encoded, and since most of work RAM,
+ * VRAM, OAM and cartridge RAM is untouched from one frame to the next an
+ * XOR delta is almost all zero runs. Restoring a frame replays at most
+ * keyframeInterval deltas on top of its keyframe.
+ *
+ * All memory is allocated up front. When the buffer fills up the oldest
+ * keyframe is dropped along with the deltas that depend on it. States are
+ * kept without the screen, so run a frame after a rewind to redraw it.
+ */
+class RewindBuffer {
+    public:
+        RewindBuffer(const Emulator &emulator, size_t bytes, int maxFrames, int keyframeInterval = 60);
+        ~RewindBuffer();
+        void Push(const Emulator &emulator);
+        bool Rewind(Emulator &emulator, int frames);
+        void Clear();
+        int Frames() const;
+        size_t BytesUsed() const;
+
+    private:
+        RewindBuffer(const RewindBuffer &);
+        RewindBuffer &operator=(const RewindBuffer &);
+
+        struct Entry {
+            size_t offset;
+            unsigned encodedSize;
+            unsigned stateSize;
+            bool keyframe;
+        };
+
+        Entry &EntryAt(int index);
+        bool Reserve(size_t size, size_t &offset);
+        void DropOldest();
+        void Reconstruct(int index, BYTE *state);
+
+        // encoded frames
+        BYTE *m_Buffer;
+        size_t m_Capacity;
+        size_t m_WriteOffset;
+
+        // ring of entries, oldest first
+        Entry *m_Entries;
+        int m_MaxFrames;
+        int m_First;
+        int m_Count;
+
+        int m_KeyframeInterval;
+        int m_SinceKeyframe;
+
+        // newest state, the one being saved and room to encode it
+        size_t m_StateCapacity;
+        BYTE *m_Last;
+        unsigned m_LastSize;
+        BYTE *m_Next;
+        unsigned m_NextSize;
+        BYTE *m_Scratch;
+        size_t m_Used;
+};
+
+#endif
@@ -0,0 +1,63 @@
+#include "Config.h"
+#include "RunAhead.h"
+
+RunAhead::RunAhead(const Emulator &emulator, int frames) {
+    m_StateCapacity = emulator.SaveStateSize();
+    m_State = new BYTE[m_StateCapacity];
+    SetFrames(frames);
+}
+
+RunAhead::~RunAhead() {
+    delete [] m_State;
+}
+
+/**
+ * Frames to run ahead, 0 turns run-ahead off
+ */
+void RunAhead::SetFrames(int frames) {
+    assert((frames >= 0) && (frames <= RUN_AHEAD_MAX_FRAMES));
+    m_Frames = frames;
+}
+
+int RunAhead::Frames() const {
+    return m_Frames;
+}
+
+/**
+ * Run one host frame, use in place of Emulator::Update with the frame's
+ * input already applied
+ */
+bool RunAhead::Update(Emulator &emulator) {
+    if(m_Frames == 0) {
+        emulator.Update();
+        return true;
+    }
+
+    bool headless = emulator.m_Headless;
+    unsigned muted = emulator.m_MutedEvents;
+    emulator.m_Headless = true;
+    emulator.m_MutedEvents = muted | (1u << EVENT_FRAME);
+    emulator.Update();
+
+    int samples = emulator.m_APU.m_SampleCount;
+    size_t size = emulator.SaveState(m_State, m_StateCapacity);
+    if(size == 0) {
+        emulator.m_Headless = headless;
+        emulator.m_MutedEvents = muted;
+        return false;
+    }
+
+    emulator.m_MutedEvents = EVENT_ALL;
+    for(int i = 1; i < m_Frames; i++)
+        emulator.Update();
+
+    emulator.m_Headless = headless;
+    emulator.Update();
+
+    // the state has no screen, so the frame just drawn stays up
+    bool ok = emulator.LoadState(m_State, size);
+    emulator.m_APU.m_SampleCount = samples;
+    emulator.m_MutedEvents = muted;
+    emulator.Notify(EVENT_FRAME, 0);
+    return ok;
+}
@@ -0,0 +1,40 @@
+#ifndef RUN_AHEAD_H
+#define RUN_AHEAD_H
+
+#include "Config.h"
+#include "Emulator.h"
+
+// most frames a game can be run ahead of its input
+#define RUN_AHEAD_MAX_FRAMES 4
+
+/**
+ * Hides the frames of input lag a game adds itself.
+ *
+ * Each host frame runs the real frame headless and saves the state after
+ * it, then keeps going with the same input for the given number of frames,
+ * drawing only the last, and restores the saved state. The screen is left
+ * showing the frame from the future while the machine itself has only
+ * moved on by one frame. Sound from the frames run ahead is dropped, so
+ * the samples left in the apu are the real frame's.
+ *
+ * Only the real frame's events reach the emulator's sink and queue, and
+ * its frame event is held back until the future frame is on the screen.
+ */
+class RunAhead {
+    public:
+        RunAhead(const Emulator &emulator, int frames);
+        ~RunAhead();
+        void SetFrames(int frames);
+        int Frames() const;
+        bool Update(Emulator &emulator);
+
+    private:
+        RunAhead(const RunAhead &);
+        RunAhead &operator=(const RunAhead &);
+
+        int m_Frames;
+        BYTE *m_State;
+        size_t m_StateCapacity;
+};
+
+#endif
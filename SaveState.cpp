@@ -0,0 +1,377 @@
+#include "Config.h"
+#include "Emulator.h"
+#include <cstring>
+
+// header flags
+#define STATE_FIFO_PPU 1
+#define STATE_SCREEN 2
+
+// the cartridge rom is never written, so only 0x8000 - 0xFFFF is kept
+// along with the cartridge ram pages
+#define STATE_FIRST_PAGE (0x8000 >> PAGE_SHIFT)
+
+// bytes of the fixed sections, in step with SaveState: cpu, mapper,
+// timers, interrupts and joypad, then the color registers, then the apu
+// up to its deltas
+#define STATE_CORE_SIZE ((6 * sizeof(WORD)) + (2 * sizeof(unsigned long long)) + (9 * sizeof(bool)) + (3 * sizeof(BYTE)) + (6 * sizeof(int)))
+#define STATE_COLOR_SIZE ((2 * sizeof(bool)) + (5 * sizeof(int)) + (2 * sizeof(WORD)))
+#define STATE_APU_SIZE (sizeof(APU::m_Registers) + sizeof(APU::m_Channels) + (7 * sizeof(int)) + sizeof(bool) + sizeof(WORD) + \
+    sizeof(APU::m_Level) + sizeof(APU::m_Integrator) + sizeof(APU::m_HighPass))
+#define STATE_SCREEN_SIZE (sizeof(Emulator::m_ScreenData) + sizeof(Emulator::m_ScreenShades))
+
+// most apu deltas a state holds per side
+#define STATE_MAX_DELTAS (APU_MAX_SAMPLES + APU_BLEP_WIDTH)
+
+struct StateHeader {
+    char magic[4];
+    WORD version;
+    WORD flags;
+    unsigned size;
+};
+
+template <typename T>
+static inline void Put(BYTE *&out, const T &value) {
+    memcpy(out, &value, sizeof(T));
+    out += sizeof(T);
+}
+
+template <typename T>
+static inline void Get(const BYTE *&in, T &value) {
+    memcpy(&value, in, sizeof(T));
+    in += sizeof(T);
+}
+
+// any nonzero byte reads back as true
+static inline void Get(const BYTE *&in, bool &value) {
+    value = *in++ != 0;
+}
+
+static inline void PutBytes(BYTE *&out, const void *data, size_t size) {
+    memcpy(out, data, size);
+    out += size;
+}
+
+static inline void GetBytes(const BYTE *&in, void *data, size_t size) {
+    memcpy(data, in, size);
+    in += size;
+}
+
+/**
+ * Delta entries the apu still has to integrate. After EndFrame that is
+ * only the tail of the last band-limited step
+ */
+static int LiveDeltas(const APU &apu) {
+    return ((apu.m_SampleOffset + apu.m_Time) / APU_CLOCKS_PER_SAMPLE) + APU_BLEP_WIDTH + 1;
+}
+
+/**
+ * Pages past the last one a state keeps, the color banks are left out of
+ * states of monochrome games
+ */
+static int StatePages(bool cgb) {
+    return cgb ? NUM_PAGES : FIRST_VRAM_BANK_PAGE;
+}
+
+/**
+ * Exact size of a state of a color or monochrome game holding deltas apu
+ * deltas per side, with or without the screen
+ */
+static size_t StateSize(bool cgb, int deltas, bool withScreen) {
+    size_t size = sizeof(StateHeader) + STATE_CORE_SIZE + STATE_COLOR_SIZE;
+    size += (StatePages(cgb) - STATE_FIRST_PAGE) * PAGE_SIZE;
+    size += sizeof(PPUPolicy) + STATE_APU_SIZE;
+    size += sizeof(int) + (2 * deltas * sizeof(int));
+    if(withScreen)
+        size += STATE_SCREEN_SIZE;
+    return size;
+}
+
+/**
+ * Upper bound on the size of a state, with the screen included
+ */
+size_t Emulator::SaveStateSize() const {
+    return StateSize(true, STATE_MAX_DELTAS, true);
+}
+
+/**
+ * Write the whole machine state into arena. Nothing is allocated, the
+ * cartridge rom and the apu's unread samples are left out and the screen
+ * is only stored on request. Returns the bytes used, 0 if they don't fit
+ */
+size_t Emulator::SaveState(BYTE *arena, size_t capacity, bool withScreen) const {
+    if(capacity < SaveStateSize())
+        return 0;
+
+    BYTE *out = arena + sizeof(StateHeader);
+
+    // cpu
+    Put(out, m_RegisterAF.reg);
+    Put(out, m_RegisterBC.reg);
+    Put(out, m_RegisterDE.reg);
+    Put(out, m_RegisterHL.reg);
+    Put(out, m_StackPointer.reg);
+    Put(out, m_ProgramCounter);
+    Put(out, m_TotalOpcodes);
+    Put(out, m_Halted);
+
+    // mapper
+    Put(out, m_MBC1);
+    Put(out, m_MBC2);
+    Put(out, m_ROMBanking);
+    Put(out, m_UsingMemoryModel16_8);
+    Put(out, m_EnableRAM);
+    Put(out, m_CurrentROMBank);
+    Put(out, m_CurrentRAMBank);
+
+    // timers and interrupts
+    Put(out, m_TimerCounter);
+    Put(out, m_DividerCounter);
+    Put(out, m_DividerRegister);
+    Put(out, m_CurrentClockSpeed);
+    Put(out, m_CyclesThisUpdate);
+    Put(out, m_FrameStart);
+    Put(out, m_ScanlineCounter);
+    Put(out, m_InterruptMaster);
+    Put(out, m_PendingInteruptDisabled);
+    Put(out, m_PendingInteruptEnabled);
+    Put(out, m_JoypadState);
+
+    // color mode
+    int vramBank = m_Memory.VRAMBank();
+    int wramBank = m_Memory.WRAMBank();
+    Put(out, m_CGB);
+    Put(out, m_SpeedShift);
+    Put(out, m_DMAStall);
+    Put(out, m_HDMAActive);
+    Put(out, m_HDMASource);
+    Put(out, m_HDMADestination);
+    Put(out, m_HDMABlocks);
+    Put(out, vramBank);
+    Put(out, wramBank);
+
+    // memory, the color banks only for color cartridges
+    for(int page = STATE_FIRST_PAGE; page < StatePages(m_CGB); page++)
+        PutBytes(out, m_Memory.PageData(page), PAGE_SIZE);
+    PutBytes(out, &m_PPU, sizeof(m_PPU));
+
+    // sound
+    PutBytes(out, m_APU.m_Registers, sizeof(m_APU.m_Registers));
+    PutBytes(out, m_APU.m_Channels, sizeof(m_APU.m_Channels));
+    Put(out, m_APU.m_SweepTimer);
+    Put(out, m_APU.m_SweepShadow);
+    Put(out, m_APU.m_SweepEnabled);
+    Put(out, m_APU.m_LFSR);
+    Put(out, m_APU.m_SequencerDelay);
+    Put(out, m_APU.m_SequencerStep);
+    Put(out, m_APU.m_Time);
+    Put(out, m_APU.m_FrameClock);
+    PutBytes(out, m_APU.m_Level, sizeof(m_APU.m_Level));
+    PutBytes(out, m_APU.m_Integrator, sizeof(m_APU.m_Integrator));
+    PutBytes(out, m_APU.m_HighPass, sizeof(m_APU.m_HighPass));
+    Put(out, m_APU.m_SampleOffset);
+
+    int deltas = LiveDeltas(m_APU);
+    Put(out, deltas);
+    PutBytes(out, m_APU.m_Deltas[0], deltas * sizeof(int));
+    PutBytes(out, m_APU.m_Deltas[1], deltas * sizeof(int));
+
+    if(withScreen) {
+        PutBytes(out, m_ScreenData, sizeof(m_ScreenData));
+        PutBytes(out, m_ScreenShades, sizeof(m_ScreenShades));
+    }
+
+    StateHeader header;
+    memcpy(header.magic, "GBST", 4);
+    header.version = SAVE_STATE_VERSION;
+    header.flags = (PPUPolicy::PIXEL_FIFO ? STATE_FIFO_PPU : 0) | (withScreen ? STATE_SCREEN : 0);
+    header.size = (unsigned)(out - arena);
+    memcpy(arena, &header, sizeof(header));
+    assert(header.size == StateSize(m_CGB, deltas, withScreen));
+
+    return header.size;
+}
+
+/**
+ * Restore a state written by SaveState. States from another version, from
+ * a build with the other PPU or that don't add up to exactly the size
+ * their layout needs are refused and leave the emulator as it was
+ */
+bool Emulator::LoadState(const BYTE *arena, size_t size) {
+    StateHeader header;
+    if(size < sizeof(header))
+        return false;
+
+    memcpy(&header, arena, sizeof(header));
+    if(memcmp(header.magic, "GBST", 4) != 0)
+        return false;
+    if(header.version != SAVE_STATE_VERSION)
+        return false;
+    if(((header.flags & STATE_FIFO_PPU) != 0) != PPUPolicy::PIXEL_FIFO)
+        return false;
+    if((header.size > size) || (header.size < StateSize(false, 0, false)))
+        return false;
+
+    // the layout hangs off the color registers and the delta count, they
+    // are read and checked before anything is restored
+    const BYTE *color = arena + sizeof(header) + STATE_CORE_SIZE;
+    bool cgb = false;
+    int speedShift = 0;
+    int dmaStall = 0;
+    bool hdmaActive = false;
+    WORD hdmaSource = 0;
+    WORD hdmaDestination = 0;
+    int hdmaBlocks = 0;
+    int vramBank = 0;
+    int wramBank = 1;
+    Get(color, cgb);
+    Get(color, speedShift);
+    Get(color, dmaStall);
+    Get(color, hdmaActive);
+    Get(color, hdmaSource);
+    Get(color, hdmaDestination);
+    Get(color, hdmaBlocks);
+    Get(color, vramBank);
+    Get(color, wramBank);
+
+    if((speedShift < 0) || (speedShift > 1) || (vramBank < 0) || (vramBank > 1) || (wramBank < 1) || (wramBank > NUM_WRAM_BANKS))
+        return false;
+    if(!cgb && ((speedShift != 0) || (vramBank != 0) || (wramBank != 1)))
+        return false;
+
+    // hblank dma copies 16 byte blocks into vram, at most 0x80 of them
+    if(((hdmaSource & 0xF) != 0) || ((hdmaDestination & 0xE00F) != 0x8000))
+        return false;
+    if((hdmaBlocks < 0) || (hdmaBlocks > 0x80) || (hdmaActive && (hdmaBlocks == 0)))
+        return false;
+
+    // the cartridge ram bank picks one of the ram pages' 8k banks
+    const BYTE *mapper = arena + sizeof(header) + (6 * sizeof(WORD)) + sizeof(unsigned long long) + (6 * sizeof(bool)) + sizeof(BYTE);
+    BYTE ramBank = 0;
+    Get(mapper, ramBank);
+    if((ramBank * 0x2000) >= (NUM_RAM_PAGES << PAGE_SHIFT))
+        return false;
+
+    // so do the apu's counters, which index its tables and delta buffer
+    if(header.size < StateSize(cgb, 0, false))
+        return false;
+
+    const BYTE *sound = arena + StateSize(cgb, 0, false) - sizeof(int) - STATE_APU_SIZE + sizeof(APU::m_Registers);
+    APU::Channel channels[4];
+    int sequencerDelay = 0;
+    int time = 0;
+    int sampleOffset = 0;
+    int deltas = 0;
+    GetBytes(sound, channels, sizeof(channels));
+    sound += (2 * sizeof(int)) + sizeof(bool) + sizeof(WORD);
+    Get(sound, sequencerDelay);
+    sound += sizeof(int);
+    Get(sound, time);
+    sound += sizeof(int) + sizeof(APU::m_Level) + sizeof(APU::m_Integrator) + sizeof(APU::m_HighPass);
+    Get(sound, sampleOffset);
+    Get(sound, deltas);
+
+    if(!APU::ValidState(channels, sequencerDelay, time, sampleOffset))
+        return false;
+
+    // and the fifo ppu's counters, which index its fifos and the screen
+    PPUPolicy ppu;
+    memcpy(&ppu, color + ((StatePages(cgb) - STATE_FIRST_PAGE) * PAGE_SIZE), sizeof(ppu));
+    if(!ppu.ValidState())
+        return false;
+    if((deltas <= 0) || (deltas > STATE_MAX_DELTAS))
+        return false;
+    if(header.size != StateSize(cgb, deltas, (header.flags & STATE_SCREEN) != 0))
+        return false;
+
+    const BYTE *in = arena + sizeof(header);
+    int oldDeltas = LiveDeltas(m_APU);
+
+    // cpu
+    Get(in, m_RegisterAF.reg);
+    Get(in, m_RegisterBC.reg);
+    Get(in, m_RegisterDE.reg);
+    Get(in, m_RegisterHL.reg);
+    Get(in, m_StackPointer.reg);
+    Get(in, m_ProgramCounter);
+    Get(in, m_TotalOpcodes);
+    Get(in, m_Halted);
+
+    // mapper
+    Get(in, m_MBC1);
+    Get(in, m_MBC2);
+    Get(in, m_ROMBanking);
+    Get(in, m_UsingMemoryModel16_8);
+    Get(in, m_EnableRAM);
+    Get(in, m_CurrentROMBank);
+    Get(in, m_CurrentRAMBank);
+    m_Memory.MapROM(m_CurrentROMBank);
+
+    // timers and interrupts
+    Get(in, m_TimerCounter);
+    Get(in, m_DividerCounter);
+    Get(in, m_DividerRegister);
+    Get(in, m_CurrentClockSpeed);
+    Get(in, m_CyclesThisUpdate);
+    Get(in, m_FrameStart);
+    Get(in, m_ScanlineCounter);
+    Get(in, m_InterruptMaster);
+    Get(in, m_PendingInteruptDisabled);
+    Get(in, m_PendingInteruptEnabled);
+    Get(in, m_JoypadState);
+
+    // color mode, the banked pages come back where the saved banks had them
+    m_CGB = cgb;
+    m_SpeedShift = speedShift;
+    m_DMAStall = dmaStall;
+    m_HDMAActive = hdmaActive;
+    m_HDMASource = hdmaSource;
+    m_HDMADestination = hdmaDestination;
+    m_HDMABlocks = hdmaBlocks;
+    m_Memory.RestoreBanks(vramBank, wramBank);
+    in += STATE_COLOR_SIZE;
+
+    // memory
+    // pages that already match stay shared with any fork
+    for(int page = STATE_FIRST_PAGE; page < StatePages(m_CGB); page++) {
+        if(memcmp(m_Memory.PageData(page), in, PAGE_SIZE) != 0)
+            memcpy(m_Memory.WritablePage(page), in, PAGE_SIZE);
+        in += PAGE_SIZE;
+    }
+    m_PPU = ppu;
+    in += sizeof(m_PPU);
+
+    // sound, whatever the host had not read yet belongs to the old timeline
+    GetBytes(in, m_APU.m_Registers, sizeof(m_APU.m_Registers));
+    GetBytes(in, m_APU.m_Channels, sizeof(m_APU.m_Channels));
+    Get(in, m_APU.m_SweepTimer);
+    Get(in, m_APU.m_SweepShadow);
+    Get(in, m_APU.m_SweepEnabled);
+    Get(in, m_APU.m_LFSR);
+    Get(in, m_APU.m_SequencerDelay);
+    Get(in, m_APU.m_SequencerStep);
+    Get(in, m_APU.m_Time);
+    Get(in, m_APU.m_FrameClock);
+    GetBytes(in, m_APU.m_Level, sizeof(m_APU.m_Level));
+    GetBytes(in, m_APU.m_Integrator, sizeof(m_APU.m_Integrator));
+    GetBytes(in, m_APU.m_HighPass, sizeof(m_APU.m_HighPass));
+    Get(in, m_APU.m_SampleOffset);
+
+    // checked above
+    in += sizeof(deltas);
+    GetBytes(in, m_APU.m_Deltas[0], deltas * sizeof(int));
+    GetBytes(in, m_APU.m_Deltas[1], deltas * sizeof(int));
+
+    // clear what is left of the old steps past the restored ones
+    if(oldDeltas > deltas) {
+        for(int side = 0; side < 2; side++)
+            memset(m_APU.m_Deltas[side] + deltas, 0, (oldDeltas - deltas) * sizeof(int));
+    }
+    m_APU.m_SampleCount = 0;
+
+    if(header.flags & STATE_SCREEN) {
+        GetBytes(in, m_ScreenData, sizeof(m_ScreenData));
+        GetBytes(in, m_ScreenShades, sizeof(m_ScreenShades));
+    }
+
+    return true;
+}
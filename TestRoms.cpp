@@ -0,0 +1,226 @@
+#include "Config.h"
+#include "TestRoms.h"
+
+RomBuilder::RomBuilder(int banks, BYTE type) {
+    assert((banks >= 2) && ((banks & (banks - 1)) == 0));
+    m_Image.assign(banks * 0x4000, 0);
+
+    // rom size in the header is 32k << n
+    int size = 0;
+    while((2 << size) < banks)
+        size++;
+    m_Image[0x147] = type;
+    m_Image[0x148] = (BYTE)size;
+
+    // every interrupt just returns
+    for(WORD vector = 0x40; vector <= 0x60; vector += 8)
+        m_Image[vector] = 0xD9;
+
+    // nop, jp 0x150
+    Org(0x100);
+    Emit(0x00);
+    EmitWord(0xC3, 0x150);
+    Org(0x150);
+}
+
+/**
+ * Carry on emitting at address, in the given bank when it's 0x4000 and up
+ */
+void RomBuilder::Org(WORD address, int bank) {
+    assert(address < 0x8000);
+    m_Address = address;
+    m_Bank = (address < 0x4000) ? 0 : bank;
+}
+
+WORD RomBuilder::Here() const {
+    return m_Address;
+}
+
+void RomBuilder::Emit(BYTE data) {
+    size_t offset = (m_Bank * 0x4000) + (m_Address & 0x3FFF);
+    assert(offset < m_Image.size());
+    m_Image[offset] = data;
+    m_Address++;
+}
+
+void RomBuilder::Emit(BYTE a, BYTE b) {
+    Emit(a);
+    Emit(b);
+}
+
+void RomBuilder::Emit(BYTE a, BYTE b, BYTE c) {
+    Emit(a);
+    Emit(b);
+    Emit(c);
+}
+
+void RomBuilder::EmitWord(BYTE opcode, WORD word) {
+    Emit(opcode, word & 0xFF, word >> 8);
+}
+
+/**
+ * JR or JR cc back or forward to target
+ */
+void RomBuilder::JumpRelative(BYTE opcode, WORD target) {
+    int offset = target - (m_Address + 2);
+    assert((offset >= -128) && (offset <= 127));
+    Emit(opcode, (BYTE)(SIGNED_BYTE)offset);
+}
+
+const std::vector<BYTE> &RomBuilder::Image() const {
+    return m_Image;
+}
+
+const char *TestRomName(TEST_ROM rom) {
+    switch(rom) {
+        case ROM_ALU : return "alu";
+        case ROM_MEMCOPY : return "memcopy";
+        case ROM_BANKSWITCH : return "bankswitch";
+        case ROM_HALT : return "halt";
+        case ROM_SPRITES : return "sprites";
+        case ROM_SCROLL : return "scroll";
+        default : return "";
+    }
+}
+
+/**
+ * Fill blocks of 256 bytes from address with the low byte of each address
+ * masked, clobbers A, BC and HL
+ */
+static void EmitFill(RomBuilder &b, WORD address, int blocks, BYTE mask) {
+    b.EmitWord(0x21, address);          // ld hl, address
+    b.Emit(0x0E, (BYTE)blocks);         // ld c, blocks
+    WORD outer = b.Here();
+    b.Emit(0x06, 0x00);                 // ld b, 0
+    WORD inner = b.Here();
+    b.Emit(0x7D);                       // ld a, l
+    b.Emit(0xE6, mask);                 // and mask
+    b.Emit(0x22);                       // ld (hl+), a
+    b.Emit(0x05);                       // dec b
+    b.JumpRelative(0x20, inner);        // jr nz, inner
+    b.Emit(0x0D);                       // dec c
+    b.JumpRelative(0x20, outer);        // jr nz, outer
+}
+
+/**
+ * Tiles, a background map, the palettes and the vblank interrupt
+ */
+static void EmitScreenSetup(RomBuilder &b, BYTE lcdControl) {
+    EmitFill(b, 0x8000, 1, 0xFF);
+    EmitFill(b, 0x9800, 8, 0x0F);
+    b.Emit(0x3E, 0xE4);                 // ld a, 0xe4
+    b.Emit(0xE0, 0x47);                 // ldh (bgp), a
+    b.Emit(0xE0, 0x48);                 // ldh (obp0), a
+    b.Emit(0xE0, 0x49);                 // ldh (obp1), a
+    b.Emit(0x3E, lcdControl);
+    b.Emit(0xE0, 0x40);                 // ldh (lcdc), a
+    b.Emit(0x3E, 0x01);
+    b.Emit(0xE0, 0xFF);                 // ldh (ie), a
+}
+
+std::vector<BYTE> MakeTestRom(TEST_ROM rom) {
+    RomBuilder b(rom == ROM_BANKSWITCH ? 8 : 2, rom == ROM_BANKSWITCH ? 1 : 0);
+    b.Emit(0xF3);                       // di
+    b.EmitWord(0x31, 0xFFFE);           // ld sp, 0xfffe
+
+    switch(rom) {
+        case ROM_ALU : {
+            WORD loop = b.Here();
+            b.Emit(0x80);               // add a, b
+            b.Emit(0xA9);               // xor c
+            b.Emit(0x92);               // sub d
+            b.Emit(0xA3);               // and e
+            b.Emit(0xB4);               // or h
+            b.Emit(0xBD);               // cp l
+            b.Emit(0x04);               // inc b
+            b.Emit(0x0D);               // dec c
+            b.Emit(0x14);               // inc d
+            b.Emit(0x1D);               // dec e
+            b.JumpRelative(0x18, loop); // jr loop
+            break;
+        }
+
+        case ROM_MEMCOPY : {
+            WORD outer = b.Here();
+            b.EmitWord(0x21, 0xC000);   // ld hl, 0xc000
+            b.EmitWord(0x11, 0xD000);   // ld de, 0xd000
+            b.Emit(0x06, 0x00);         // ld b, 0
+            WORD inner = b.Here();
+            b.Emit(0x2A);               // ld a, (hl+)
+            b.Emit(0x12);               // ld (de), a
+            b.Emit(0x13);               // inc de
+            b.Emit(0x05);               // dec b
+            b.JumpRelative(0x20, inner);
+            b.JumpRelative(0x18, outer);
+            break;
+        }
+
+        case ROM_BANKSWITCH : {
+            WORD loop = b.Here();
+            b.Emit(0x04);               // inc b
+            b.Emit(0x78);               // ld a, b
+            b.Emit(0xE6, 0x07);         // and 7
+            b.EmitWord(0xEA, 0x2000);   // ld (0x2000), a
+            b.EmitWord(0xFA, 0x4000);   // ld a, (0x4000)
+            b.Emit(0x4F);               // ld c, a
+            b.JumpRelative(0x18, loop);
+
+            // something different at the start of every bank
+            for(int bank = 1; bank < 8; bank++) {
+                b.Org(0x4000, bank);
+                b.Emit((BYTE)bank);
+            }
+            break;
+        }
+
+        case ROM_HALT : {
+            b.Emit(0x3E, 0x01);
+            b.Emit(0xE0, 0xFF);         // ldh (ie), a
+            b.Emit(0xFB);               // ei
+            WORD loop = b.Here();
+            b.Emit(0x76);               // halt
+            b.JumpRelative(0x18, loop);
+            break;
+        }
+
+        case ROM_SPRITES : {
+            // 40 sprites in four rows of ten, so every row is at the limit
+            b.EmitWord(0x21, 0xFE00);
+            for(int i = 0; i < 40; i++) {
+                BYTE sprite[4] = {(BYTE)(16 + (i / 10) * 32), (BYTE)(8 + (i % 10) * 16), (BYTE)(i % 16), (BYTE)((i & 1) ? 0x20 : 0x00)};
+                for(int j = 0; j < 4; j++) {
+                    b.Emit(0x3E, sprite[j]);
+                    b.Emit(0x22);       // ld (hl+), a
+                }
+            }
+            EmitScreenSetup(b, 0x93);
+            b.Emit(0xFB);
+            WORD loop = b.Here();
+            b.Emit(0x76);
+            b.JumpRelative(0x18, loop);
+            break;
+        }
+
+        case ROM_SCROLL : {
+            b.Emit(0x3E, 0x40);
+            b.Emit(0xE0, 0x4A);         // ldh (wy), a
+            b.Emit(0x3E, 0x57);
+            b.Emit(0xE0, 0x4B);         // ldh (wx), a
+            EmitScreenSetup(b, 0xB1);
+            WORD loop = b.Here();
+            b.Emit(0xF0, 0x43);         // ldh a, (scx)
+            b.Emit(0x3C);               // inc a
+            b.Emit(0xE0, 0x43);         // ldh (scx), a
+            b.Emit(0xF0, 0x42);         // ldh a, (scy)
+            b.Emit(0x3D);               // dec a
+            b.Emit(0xE0, 0x42);         // ldh (scy), a
+            b.JumpRelative(0x18, loop);
+            break;
+        }
+
+        default :
+            break;
+    }
+
+    return b.Image();
+}
@@ -0,0 +1,44 @@
+#ifndef TEST_ROMS_H
+#define TEST_ROMS_H
+
+#include "Config.h"
+
+/**
+ * Assembles small rom images in memory, enough to write test programs
+ * without shipping a cartridge. Code goes at 0x150 after a header that
+ * jumps there, and every interrupt vector returns with RETI unless
+ * something else is put there.
+ */
+class RomBuilder {
+    public:
+        RomBuilder(int banks = 2, BYTE type = 0);
+        void Org(WORD address, int bank = 1);
+        WORD Here() const;
+        void Emit(BYTE data);
+        void Emit(BYTE a, BYTE b);
+        void Emit(BYTE a, BYTE b, BYTE c);
+        void EmitWord(BYTE opcode, WORD word);
+        void JumpRelative(BYTE opcode, WORD target);
+        const std::vector<BYTE> &Image() const;
+
+    private:
+        std::vector<BYTE> m_Image;
+        WORD m_Address;
+        int m_Bank;
+};
+
+// the synthetic workloads
+enum TEST_ROM {
+    ROM_ALU,
+    ROM_MEMCOPY,
+    ROM_BANKSWITCH,
+    ROM_HALT,
+    ROM_SPRITES,
+    ROM_SCROLL,
+    NUM_TEST_ROMS
+};
+
+const char *TestRomName(TEST_ROM rom);
+std::vector<BYTE> MakeTestRom(TEST_ROM rom);
+
+#endif
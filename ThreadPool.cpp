@@ -0,0 +1,168 @@
+#include "Config.h"
+#include "ThreadPool.h"
+
+// a range packs end in the high half and begin in the low half
+static inline unsigned long long MakeRange(unsigned begin, unsigned end) {
+    return ((unsigned long long)end << 32) | begin;
+}
+
+static inline unsigned RangeBegin(unsigned long long range) {
+    return (unsigned)(range & 0xFFFFFFFF);
+}
+
+static inline unsigned RangeEnd(unsigned long long range) {
+    return (unsigned)(range >> 32);
+}
+
+ThreadPool::ThreadPool(int threads) {
+    if(threads <= 0)
+        threads = (int)std::thread::hardware_concurrency();
+    if(threads <= 0)
+        threads = 1;
+
+    m_NumThreads = threads;
+    m_Queues = new Queue[threads];
+    for(int i = 0; i < threads; i++)
+        m_Queues[i].range.store(0);
+
+    m_Task = NULL;
+    m_Context = NULL;
+    m_Remaining.store(0);
+    m_Generation = 0;
+    m_Stop = false;
+
+    // thread 0 is whoever calls Run
+    m_Threads = new std::thread[threads];
+    for(int i = 1; i < threads; i++)
+        m_Threads[i] = std::thread(&ThreadPool::WorkerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> guard(m_Lock);
+        m_Stop = true;
+    }
+    m_Wake.notify_all();
+
+    for(int i = 1; i < m_NumThreads; i++)
+        m_Threads[i].join();
+
+    delete [] m_Threads;
+    delete [] m_Queues;
+}
+
+int ThreadPool::Threads() const {
+    return m_NumThreads;
+}
+
+/**
+ * Run task(context, i) for every i in [0, count) and wait for all of them
+ */
+void ThreadPool::Run(int count, Task task, void *context) {
+    if(count <= 0)
+        return;
+
+    m_Task = task;
+    m_Context = context;
+    m_Remaining.store(count, std::memory_order_relaxed);
+
+    for(int i = 0; i < m_NumThreads; i++) {
+        unsigned begin = (unsigned)(((long long)count * i) / m_NumThreads);
+        unsigned end = (unsigned)(((long long)count * (i + 1)) / m_NumThreads);
+        m_Queues[i].range.store(MakeRange(begin, end), std::memory_order_release);
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(m_Lock);
+        m_Generation++;
+    }
+    m_Wake.notify_all();
+
+    Work(0);
+
+    std::unique_lock<std::mutex> lock(m_Lock);
+    while(m_Remaining.load(std::memory_order_acquire) > 0)
+        m_Done.wait(lock);
+}
+
+/**
+ * Worker threads sleep until a new batch is published
+ */
+void ThreadPool::WorkerLoop(int id) {
+    unsigned seen = 0;
+
+    while(true) {
+        {
+            std::unique_lock<std::mutex> lock(m_Lock);
+            while(!m_Stop && (m_Generation == seen))
+                m_Wake.wait(lock);
+            if(m_Stop)
+                return;
+            seen = m_Generation;
+        }
+
+        Work(id);
+    }
+}
+
+/**
+ * Drain our own range, then keep stealing until every range is empty.
+ * Tasks never add work, so at that point whatever is left is already
+ * running on another thread and there is no reason to spin
+ */
+void ThreadPool::Work(int id) {
+    while(true) {
+        int index = 0;
+        if(Pop(id, index)) {
+            m_Task(m_Context, index);
+
+            if(m_Remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                std::lock_guard<std::mutex> guard(m_Lock);
+                m_Done.notify_all();
+            }
+        } else if(!Steal(id)) {
+            return;
+        }
+    }
+}
+
+/**
+ * Take the next task off the front of our own range
+ */
+bool ThreadPool::Pop(int id, int &index) {
+    std::atomic<unsigned long long> &range = m_Queues[id].range;
+    unsigned long long current = range.load(std::memory_order_acquire);
+
+    while(RangeBegin(current) < RangeEnd(current)) {
+        unsigned begin = RangeBegin(current);
+        if(range.compare_exchange_weak(current, MakeRange(begin + 1, RangeEnd(current)), std::memory_order_acq_rel)) {
+            index = (int)begin;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Move the back half of the first non-empty range we find into ours
+ */
+bool ThreadPool::Steal(int id) {
+    for(int offset = 1; offset < m_NumThreads; offset++) {
+        std::atomic<unsigned long long> &victim = m_Queues[(id + offset) % m_NumThreads].range;
+        unsigned long long current = victim.load(std::memory_order_acquire);
+
+        while(RangeBegin(current) < RangeEnd(current)) {
+            unsigned begin = RangeBegin(current);
+            unsigned end = RangeEnd(current);
+            unsigned split = begin + ((end - begin) / 2);
+
+            if(victim.compare_exchange_weak(current, MakeRange(begin, split), std::memory_order_acq_rel)) {
+                m_Queues[id].range.store(MakeRange(split, end), std::memory_order_release);
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
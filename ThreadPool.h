@@ -0,0 +1,59 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include "Config.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+/**
+ * Fixed pool of worker threads that runs an indexed batch of tasks with
+ * work stealing.
+ *
+ * Run splits [0, count) into one contiguous range per thread. Each range is
+ * a single atomic word holding begin and end, the owner takes tasks off the
+ * front and an idle thread steals the back half of someone else's range,
+ * so there are no locks on the task path. The calling thread works as
+ * thread 0 and Run returns once every task has finished.
+ */
+class ThreadPool {
+    public:
+        typedef void (*Task)(void *context, int index);
+
+        explicit ThreadPool(int threads = 0);
+        ~ThreadPool();
+        int Threads() const;
+        void Run(int count, Task task, void *context);
+
+    private:
+        ThreadPool(const ThreadPool &);
+        ThreadPool &operator=(const ThreadPool &);
+
+        struct alignas(64) Queue {
+            std::atomic<unsigned long long> range;
+        };
+
+        void WorkerLoop(int id);
+        void Work(int id);
+        bool Pop(int id, int &index);
+        bool Steal(int id);
+
+        int m_NumThreads;
+        std::thread *m_Threads;
+        Queue *m_Queues;
+
+        // current batch
+        Task m_Task;
+        void *m_Context;
+        std::atomic<int> m_Remaining;
+
+        // sleeping between batches
+        std::mutex m_Lock;
+        std::condition_variable m_Wake;
+        std::condition_variable m_Done;
+        unsigned m_Generation;
+        bool m_Stop;
+};
+
+#endif
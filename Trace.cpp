@@ -0,0 +1,97 @@
+#include "Config.h"
+#include "Trace.h"
+#include "Emulator.h"
+#include "Disassembler.h"
+
+static const char *INTERRUPT_NAMES[5] = {"vblank", "lcd", "timer", "serial", "joypad"};
+
+TraceRing::TraceRing() {
+    m_Records.resize(TRACE_RECORDS);
+    m_Next = 0;
+}
+
+void TraceRing::Clear() {
+    m_Next = 0;
+}
+
+size_t TraceRing::Size() const {
+    return (m_Next < TRACE_RECORDS) ? (size_t)m_Next : TRACE_RECORDS;
+}
+
+/**
+ * Record index from the oldest kept, 0, to the newest, Size() - 1
+ */
+const TraceRecord &TraceRing::At(size_t index) const {
+    assert(index < Size());
+    unsigned long long first = m_Next - Size();
+    return m_Records[(first + index) & (TRACE_RECORDS - 1)];
+}
+
+static void Describe(const TraceRecord &record, const Emulator &emulator, char *text, size_t size) {
+    if(record.kind == TraceRing::TRACE_INTERRUPT) {
+        snprintf(text, size, "interrupt %s", INTERRUPT_NAMES[record.interrupt % 5]);
+        return;
+    }
+
+    BYTE bytes[MAX_INSTRUCTION_LENGTH];
+    ReadCode(emulator, record.bank, record.pc, bytes);
+    bytes[0] = record.opcode;
+    Disassemble(bytes, record.pc, text, size);
+}
+
+/**
+ * Chrome trace event format, loads in chrome://tracing and Perfetto.
+ * Instructions are complete events lasting until the next record,
+ * interrupts are instant events. Times are guest microseconds from the
+ * oldest record. Operands come from the cartridge, or from ram as it is
+ * now, only the opcode is in the record
+ */
+bool WriteChromeTrace(const TraceRing &trace, const Emulator &emulator, FILE *out) {
+    fprintf(out, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+
+    // cycles are differences of a wrapping counter, so always add them up
+    unsigned long long cycles = 0;
+    size_t size = trace.Size();
+    for(size_t i = 0; i < size; i++) {
+        const TraceRecord &record = trace.At(i);
+        if(i > 0)
+            cycles += (unsigned)(record.cycle - trace.At(i - 1).cycle);
+
+        char text[32];
+        Describe(record, emulator, text, sizeof(text));
+        double ts = cycles / 4.194304;
+
+        if(record.kind == TraceRing::TRACE_INTERRUPT) {
+            fprintf(out, "{\"name\": \"%s\", \"ph\": \"i\", \"s\": \"t\", \"ts\": %.3f, \"pid\": 1, \"tid\": 1, "
+                "\"args\": {\"from\": \"%02X:%04X\"}}", text, ts, record.bank, record.pc);
+        } else {
+            unsigned length = (i + 1 < size) ? (unsigned)(trace.At(i + 1).cycle - record.cycle) : 4;
+            fprintf(out, "{\"name\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": 1, "
+                "\"args\": {\"pc\": \"%02X:%04X\", \"af\": \"%04X\", \"bc\": \"%04X\", \"de\": \"%04X\", \"hl\": \"%04X\", \"sp\": \"%04X\"}}",
+                text, ts, length / 4.194304, record.bank, record.pc, record.af, record.bc, record.de, record.hl, record.sp);
+        }
+        fprintf(out, "%s\n", (i + 1 < size) ? "," : "");
+    }
+
+    fprintf(out, "]}\n");
+    return ferror(out) == 0;
+}
+
+/**
+ * One line per record, oldest first, cycles counted from the oldest
+ */
+void WriteTraceText(const TraceRing &trace, const Emulator &emulator, FILE *out) {
+    fprintf(out, "       cycle  bank:pc   AF   BC   DE   HL   SP    instruction\n");
+
+    unsigned long long cycles = 0;
+    for(size_t i = 0; i < trace.Size(); i++) {
+        const TraceRecord &record = trace.At(i);
+        if(i > 0)
+            cycles += (unsigned)(record.cycle - trace.At(i - 1).cycle);
+
+        char text[32];
+        Describe(record, emulator, text, sizeof(text));
+        fprintf(out, "%12llu  %02X:%04X  %04X %04X %04X %04X %04X  %s\n", cycles, record.bank, record.pc,
+            record.af, record.bc, record.de, record.hl, record.sp, text);
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "Config.h"
+
+// records kept per emulator, a power of two
+#ifndef TRACE_RECORDS
+#define TRACE_RECORDS 65536
+#endif
+
+class Emulator;
+
+// one instruction about to run or one interrupt being serviced, with the
+// registers as they were just before. cycle is the low 32 bits of
+// Emulator::Cycles
+struct TraceRecord {
+    unsigned cycle;
+    WORD pc;
+    WORD af;
+    WORD bc;
+    WORD de;
+    WORD hl;
+    WORD sp;
+    BYTE bank;
+    BYTE opcode;
+    BYTE kind;
+    BYTE interrupt;
+};
+
+/**
+ * Ring of the last TRACE_RECORDS trace records. The emulator only carries
+ * one when built with GB_TRACE, and then writes a record per instruction
+ * in ExecuteNextOpcode and one per interrupt in ServiceInterrupt. A record
+ * is a single struct store and an index bump, the ring never wraps
+ * explicitly, older records are simply overwritten.
+ *
+ * Unlike the other helpers a ring can be copied, forking an emulator
+ * copies its trace with it.
+ */
+class TraceRing {
+    public:
+        enum KIND {
+            TRACE_INSTRUCTION,
+            TRACE_INTERRUPT
+        };
+
+        TraceRing();
+        void Clear();
+        size_t Size() const;
+        const TraceRecord &At(size_t index) const;
+
+        void Record(const TraceRecord &record) {
+            m_Records[m_Next & (TRACE_RECORDS - 1)] = record;
+            m_Next++;
+        }
+
+    private:
+        std::vector<TraceRecord> m_Records;
+        unsigned long long m_Next;
+};
+
+bool WriteChromeTrace(const TraceRing &trace, const Emulator &emulator, FILE *out);
+void WriteTraceText(const TraceRing &trace, const Emulator &emulator, FILE *out);
+
+#endif
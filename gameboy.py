@@ -0,0 +1,244 @@
+"""Python bindings for libgameboy, the C interface in GbApi.h.
+
+The screen and work ram are views straight onto the emulator's own memory.
+Nothing is copied when a step runs, so reading an array after step() sees
+the new frame. numpy is optional and only needed for the *_array helpers.
+
+    gb = GameBoy(open("game.gb", "rb").read())
+    gb.step(gameboy.A | gameboy.RIGHT, 4)
+    pixels = gb.screen_array()      # (144, 160, 3) uint8 view
+"""
+
+import ctypes
+import functools
+import os
+import sys
+
+SCREEN_WIDTH = 160
+SCREEN_HEIGHT = 144
+PAGE_SIZE = 256
+WRAM_PAGES = 32
+
+# observation filters
+NEAREST = 0
+AREA = 1
+
+# input bits, same order as Emulator::KeyPressed
+RIGHT, LEFT, UP, DOWN, A, B, SELECT, START = (1 << key for key in range(8))
+
+_library = None
+
+
+def _library_path():
+    path = os.environ.get("GAMEBOY_LIBRARY")
+    if path:
+        return path
+    name = {"win32": "gameboy.dll", "darwin": "libgameboy.dylib"}.get(sys.platform, "libgameboy.so")
+    return os.path.join(os.path.dirname(os.path.abspath(__file__)), name)
+
+
+def load_library(path=None):
+    """Load libgameboy once, from path, $GAMEBOY_LIBRARY or next to this file."""
+    global _library
+    if _library is not None:
+        return _library
+
+    lib = ctypes.CDLL(path or _library_path())
+    handle = ctypes.c_void_p
+    buffer = ctypes.c_void_p
+    signatures = {
+        "gb_create": (handle, [ctypes.c_char_p, ctypes.c_size_t]),
+        "gb_destroy": (None, [handle]),
+        "gb_set_headless": (None, [handle, ctypes.c_int]),
+        "gb_step": (None, [handle, ctypes.c_uint, ctypes.c_int]),
+        "gb_step_inputs": (None, [handle, buffer, ctypes.c_int]),
+        "gb_state_size": (ctypes.c_size_t, [handle]),
+        "gb_save_state": (ctypes.c_size_t, [handle, buffer, ctypes.c_size_t]),
+        "gb_load_state": (ctypes.c_int, [handle, buffer, ctypes.c_size_t]),
+        "gb_framebuffer": (ctypes.c_void_p, [handle]),
+        "gb_wram_pages": (ctypes.c_int, [handle, ctypes.POINTER(ctypes.c_void_p)]),
+        "gb_read": (ctypes.c_ubyte, [handle, ctypes.c_ushort]),
+        "gb_write": (None, [handle, ctypes.c_ushort, ctypes.c_ubyte]),
+        "gb_observation_create": (ctypes.c_void_p, [ctypes.c_int] * 7),
+        "gb_observation_destroy": (None, [ctypes.c_void_p]),
+        "gb_observe": (None, [handle, ctypes.c_void_p, buffer]),
+    }
+    for name, (restype, argtypes) in signatures.items():
+        function = getattr(lib, name)
+        function.restype = restype
+        function.argtypes = argtypes
+
+    _library = lib
+    return lib
+
+
+def _address(data):
+    """Address of a bytes-like object's memory, without copying it."""
+    if isinstance(data, bytes):
+        return ctypes.cast(ctypes.c_char_p(data), ctypes.c_void_p).value
+    view = memoryview(data)
+    if view.readonly:
+        raise TypeError("buffer must be bytes or writable")
+    return ctypes.addressof(ctypes.c_ubyte.from_buffer(view))
+
+
+class GameBoy:
+    """One emulator instance running a rom given as bytes.
+
+    step(input, frames) holds the keys in input for frames frames, both
+    must be ints as step doesn't convert its arguments,
+    read(address) and write(address, value) go through the cpu's memory map.
+    """
+
+    def __init__(self, rom, library=None):
+        self._handle = None
+        lib = load_library(library)
+        rom = bytes(rom)
+        address = lib.gb_create(rom, len(rom))
+        if not address:
+            raise ValueError("empty rom")
+
+        self._lib = lib
+        self._handle = ctypes.c_void_p(address)
+
+        # step is the hot call, bound here so a call is one partial and one
+        # foreign call with no attribute lookups. It goes through its own
+        # copy of gb_step without argtypes, which skips ctypes' per-argument
+        # conversion; the handle is already a c_void_p and python ints pass
+        # as C ints, which is what input and frames are
+        step = lib["gb_step"]
+        step.restype = None
+        self.step = functools.partial(step, self._handle)
+        self.read = functools.partial(lib.gb_read, self._handle)
+        self.write = functools.partial(lib.gb_write, self._handle)
+
+        screen = (ctypes.c_ubyte * (SCREEN_WIDTH * SCREEN_HEIGHT * 3)).from_address(lib.gb_framebuffer(self._handle))
+        self._screen = screen
+        self.screen = memoryview(screen).cast("B", (SCREEN_WIDTH, SCREEN_HEIGHT, 3))
+
+        self._pages = None
+        self.refresh_wram()
+
+    def close(self):
+        if self._handle is not None:
+            self.screen.release()
+            self._lib.gb_destroy(self._handle)
+            self._handle = None
+
+    def __del__(self):
+        self.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    def set_headless(self, headless):
+        """Skip drawing frames, the screen keeps the last one drawn."""
+        self._lib.gb_set_headless(self._handle, 1 if headless else 0)
+
+    def step_inputs(self, inputs):
+        """Run one frame per byte of inputs, holding that byte's keys."""
+        self._lib.gb_step_inputs(self._handle, _address(inputs), len(inputs))
+
+    def state_size(self):
+        return self._lib.gb_state_size(self._handle)
+
+    def save_state(self, buffer=None):
+        """Save into buffer, a new bytearray by default. Returns a view of the bytes used."""
+        if buffer is None:
+            buffer = bytearray(self.state_size())
+        size = self._lib.gb_save_state(self._handle, _address(buffer), len(buffer))
+        if size == 0:
+            raise ValueError("buffer smaller than state_size()")
+        return memoryview(buffer)[:size]
+
+    def load_state(self, state):
+        if not self._lib.gb_load_state(self._handle, _address(state), len(state)):
+            raise ValueError("not a state of this build")
+
+    def refresh_wram(self):
+        """Map the work ram pages again, needed after a color game switches banks."""
+        pages = (ctypes.c_void_p * WRAM_PAGES)()
+        self._lib.gb_wram_pages(self._handle, pages)
+        self._pages = [memoryview((ctypes.c_ubyte * PAGE_SIZE).from_address(page)).cast("B") for page in pages]
+
+    @property
+    def wram_pages(self):
+        """The 32 pages of 0xC000 - 0xDFFF as writable memoryviews, in address order."""
+        return self._pages
+
+    def wram(self, address):
+        """Byte of work ram at address, read through the page views."""
+        offset = address - 0xC000
+        return self._pages[offset >> 8][offset & 0xFF]
+
+    def screen_array(self):
+        """The screen as a (144, 160, 3) numpy view, rows first."""
+        import numpy
+        return numpy.frombuffer(self._screen, dtype=numpy.uint8).reshape(SCREEN_WIDTH, SCREEN_HEIGHT, 3).transpose(1, 0, 2)
+
+    def wram_arrays(self):
+        """The work ram pages as numpy views, memory is not one block so there is one per page."""
+        import numpy
+        return [numpy.frombuffer(page, dtype=numpy.uint8) for page in self._pages]
+
+
+class FrameStack:
+    """The last depth grayscale observations of a GameBoy's screen.
+
+    Observations are made natively from the screen's shades and written
+    straight into the next slot of a ring held here, no rgb frame is made
+    and nothing is copied. frames is the ring as a (depth, height, width)
+    memoryview and head the slot of the newest frame, array() a numpy view.
+    crop is (top, left, height, width) of the screen to observe.
+    """
+
+    def __init__(self, gb, width=84, height=84, depth=4, filter=AREA, crop=(0, 0, SCREEN_HEIGHT, SCREEN_WIDTH)):
+        self._observation = None
+        lib = gb._lib
+        top, left, crop_height, crop_width = crop
+        observation = lib.gb_observation_create(width, height, filter, top, left, crop_height, crop_width)
+        if not observation:
+            raise ValueError("crop must fit the screen and be no smaller than the observation")
+
+        self._lib = lib
+        self._gb = gb
+        self._observation = ctypes.c_void_p(observation)
+        self._observe = functools.partial(lib.gb_observe, gb._handle, self._observation)
+
+        self.width = width
+        self.height = height
+        self.depth = depth
+        self.head = depth - 1
+        self._size = width * height
+        self._buffer = bytearray(depth * self._size)
+        self._base = _address(self._buffer)
+        self.frames = memoryview(self._buffer).cast("B", (depth, height, width))
+
+    def close(self):
+        if self._observation is not None:
+            self.frames.release()
+            self._lib.gb_observation_destroy(self._observation)
+            self._observation = None
+
+    def __del__(self):
+        self.close()
+
+    def push(self):
+        """Observe the screen as it is now into the oldest slot, which becomes head."""
+        head = self.head + 1
+        if head == self.depth:
+            head = 0
+        self._observe(self._base + (head * self._size))
+        self.head = head
+
+    def clear(self):
+        self._buffer[:] = bytes(len(self._buffer))
+        self.head = self.depth - 1
+
+    def array(self):
+        """The ring as a (depth, height, width) numpy view, slot head is the newest."""
+        import numpy
+        return numpy.frombuffer(self._buffer, dtype=numpy.uint8).reshape(self.depth, self.height, self.width)